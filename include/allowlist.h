@@ -0,0 +1,72 @@
+/**********************************************************************************
+ *
+ * Defines
+ *
+ * The allowlist holds the senders (24 bit ids as hex, e.g. 80abcd) whose frames
+ * are published, one or more per line, lines starting with # are comments. An
+ * empty list lets every sender pass. Frames of other senders are dropped right
+ * after the id was decoded and counted per sender.
+ *
+ * Learning adds every sender with a valid command for some minutes, press the
+ * buttons of your remotes meanwhile. The list is stored in flash (NVS) and can
+ * be changed at http://<ip address>/api/senders.
+ *
+ **********************************************************************************/
+#define MAX_SENDERS 32             // senders in allowlist
+#define UNKNOWN_SENDERS 16         // unknown senders with filtered frame counts
+#define SENDERS_TEXT_MAX 1000      // max length of stored sender text (NVS string)
+#define LEARN_MINUTES 5            // default length of learning
+#define LEARN_MINUTES_MAX 60       // longest learning
+
+/**********************************************************************************
+ *
+ * Load allowlist from flash
+ *
+ **********************************************************************************/
+void AllowlistInit();
+
+/**********************************************************************************
+ *
+ * True if frames of sender are published (decode task). Frames of other
+ * senders are counted.
+ *
+ **********************************************************************************/
+bool senderAllowed(uint32_t sender);
+
+/**********************************************************************************
+ *
+ * Add sender of a valid command to the allowlist while learning (decode task)
+ *
+ **********************************************************************************/
+void learnSender(uint32_t sender);
+
+/**********************************************************************************
+ *
+ * Store learned senders in flash and end learning after its time (network
+ * task)
+ *
+ **********************************************************************************/
+void storeLearnedSenders();
+
+/**********************************************************************************
+ *
+ * Learn senders for minutes, 0 ends learning
+ *
+ **********************************************************************************/
+void learnSenders(unsigned int minutes);
+
+/**********************************************************************************
+ *
+ * Replace the allowlist and store it in flash. Returns the errors found, empty
+ * if the list was stored.
+ *
+ **********************************************************************************/
+String storeSenders(const String &text);
+
+/**********************************************************************************
+ *
+ * Create allowlist report as JSON string: senders, learning time left and
+ * filtered frames of unknown senders
+ *
+ **********************************************************************************/
+String sendersReport();
@@ -0,0 +1,17 @@
+#include <command.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ **********************************************************************************/
+#define COALESCE_SENDERS 16      // sun sensor groups with state, power of 2
+#define SUN_REFRESH_INTERVAL 900 // seconds after which an unchanged state is published again, 0 = never
+
+/**********************************************************************************
+ *
+ * Decide whether a command is published. Sun sensors repeat their state, only
+ * state changes and periodic refreshes are published, the repeats are counted.
+ *
+ **********************************************************************************/
+bool coalesceCommand(const command_t &command);
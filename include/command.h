@@ -0,0 +1,25 @@
+/**********************************************************************************
+ *
+ * Decoded Fernotron command, passed from the decode task to the network task
+ *
+ **********************************************************************************/
+#pragma once
+
+typedef struct
+{
+  uint8_t type;         // type of sender (1 plain sender, 2 sun sensor, 8 central unit)
+  uint8_t id1;          // sender id, high byte
+  uint8_t id2;          // sender id, middle byte
+  uint8_t id3;          // sender id, low byte
+  uint8_t counter;      // command counter
+  uint8_t group;        // group id (central unit only)
+  uint8_t member;       // member id (central unit only)
+  uint8_t action;       // command (up, down, stop, ...)
+  int8_t rssi;          // CC1101 rssi in dBm at the first sync block of the frame
+  uint8_t errors;       // discarded data words while decoding
+  uint8_t repaired;     // bytes taken from their second copy because the first was damaged
+  uint16_t timing;      // average deviation of the data periods from 1 or 2 symbols in us
+  uint16_t max_timing;  // largest deviation in us, the margin is tolerance - max_timing
+  uint8_t receiver;     // receiver that decoded the frame
+  int64_t capture_time; // esp_timer time in us when the frame was complete
+} command_t;
@@ -0,0 +1,43 @@
+#include <command.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ **********************************************************************************/
+#define ELECTION_SLOTS 8 // frames in election at the same time
+
+/**********************************************************************************
+ *
+ * Set id of this gateway (lower 3 bytes of MAC address)
+ *
+ **********************************************************************************/
+void CoordinationInit(uint32_t gateway);
+
+/**********************************************************************************
+ *
+ * Start election for a command decoded by this gateway
+ *
+ **********************************************************************************/
+void electCommand(const command_t &command);
+
+/**********************************************************************************
+ *
+ * Handle a frame announcement received on COORDINATION_TOPIC
+ *
+ **********************************************************************************/
+void receiveAnnouncement(const char *payload, unsigned int length);
+
+/**********************************************************************************
+ *
+ * Announce frames, publish won and store lost commands when their time is due
+ *
+ **********************************************************************************/
+void runElection();
+
+/**********************************************************************************
+ *
+ * ms until runElection has to be called again
+ *
+ **********************************************************************************/
+unsigned long electionTimeout(unsigned long idle_timeout);
@@ -0,0 +1,71 @@
+#pragma once
+#include <glitchfilter.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ **********************************************************************************/
+#define MAX_DECODERS 4 // decoders fed with the same edges
+#define EDGE_BATCH 32  // edges passed to the decoders at once
+
+/**********************************************************************************
+ *
+ * Decoder of a 433 Mhz protocol. feed() gets the duration (us) and the signal
+ * level of every period between two edges, after the glitch filter, and
+ * returns true if a frame was completed. The decoder handles the frame itself (e.g. queue a command).
+ *
+ **********************************************************************************/
+typedef struct
+{
+  const char *name;                                                 // protocol name for report
+  void *state;                                                      // decoder specific state
+  bool (*feed)(void *state, unsigned long duration, uint8_t level); // process one period
+  unsigned long edges;                                              // periods fed
+  unsigned long frames;                                             // frames found
+  int64_t busy_time;                                                // processing time in us
+  int64_t max_busy_time;                                            // longest batch in us
+} decoder_t;
+
+/**********************************************************************************
+ *
+ * Decoders fed with the edges of one receiver
+ *
+ **********************************************************************************/
+typedef struct
+{
+  decoder_t *decoders[MAX_DECODERS];
+  unsigned int count;
+  uint32_t previous_edge_time; // time of previous edge (31 bit)
+  glitch_filter_t filter;      // in front of all decoders
+} decoder_registry_t;
+
+/**********************************************************************************
+ *
+ * Add decoder to registry
+ *
+ **********************************************************************************/
+void registerDecoder(decoder_registry_t *registry, decoder_t *decoder);
+
+/**********************************************************************************
+ *
+ * Pass a batch of edges (time << 1 | level) through the glitch filter to all
+ * decoders of the registry
+ *
+ **********************************************************************************/
+void feedDecoders(decoder_registry_t *registry, const uint32_t *edges, unsigned int count);
+
+/**********************************************************************************
+ *
+ * Pass the periods held back by the glitch filter to all decoders, when the
+ * receiver is quiet or a capture ends
+ *
+ **********************************************************************************/
+void flushDecoders(decoder_registry_t *registry);
+
+/**********************************************************************************
+ *
+ * Create decoder report of registry as JSON string
+ *
+ **********************************************************************************/
+String decoderReport(decoder_registry_t *registry);
@@ -0,0 +1,39 @@
+#include <command.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ * The last command of every sender, group and member is published retained on
+ * STATE_TOPIC, e.g. Fernotron2MQTT/State/ID_80abcd/Group_1/Member_2, with the
+ * compact JSON payload. A consumer gets the state of all shutters with its
+ * subscription instead of waiting for the next button press. A state is only
+ * published when the action changed, all states are published again after
+ * every connect to the broker.
+ *
+ **********************************************************************************/
+#define MAX_DEVICES 64          // sender, group and member combinations in state table
+#define STATE_SNAPSHOT_BATCH 8  // states published per network task cycle after a connect
+
+/**********************************************************************************
+ *
+ * Keep the state of a command and publish it if it changed (network task).
+ * Without publish the state is only kept, for commands another gateway
+ * published (see coordination.h), so a later snapshot is not stale.
+ *
+ **********************************************************************************/
+void updateState(const command_t &command, int64_t time, bool publish);
+
+/**********************************************************************************
+ *
+ * Publish all states again, e.g. after a connect to the broker (network task)
+ *
+ **********************************************************************************/
+void requestStateSnapshot();
+
+/**********************************************************************************
+ *
+ * Publish the next states of a requested snapshot (network task)
+ *
+ **********************************************************************************/
+void publishStates();
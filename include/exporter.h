@@ -0,0 +1,55 @@
+#include <command.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ * The exporter posts the decoded commands in batches to a local time series
+ * database or collector, one HTTP request per batch instead of one MQTT
+ * message per command. Set EXPORT_URL to switch it on, e.g. for InfluxDB 2
+ *
+ *   http://192.168.1.10:8086/api/v2/write?org=home&bucket=fernotron&precision=ms
+ *
+ * with EXPORT_FORMAT EXPORT_INFLUX and the token in EXPORT_AUTHORIZATION
+ * ("Token ..."), or any endpoint that takes newline delimited JSON with
+ * EXPORT_FORMAT EXPORT_NDJSON. A batch is sent when EXPORT_BATCH commands are
+ * waiting or the oldest one waited EXPORT_MAX_AGE. If the endpoint fails, the
+ * commands are kept and the next attempt waits twice as long, up to
+ * EXPORT_BACKOFF_MAX. At most EXPORT_QUEUE commands are kept, the oldest are
+ * dropped first. tools/export/sink.py is a stand-in endpoint for tests.
+ *
+ **********************************************************************************/
+#define EXPORT_INFLUX 0            // line protocol, measurement "fernotron", time in ms
+#define EXPORT_NDJSON 1            // one compact JSON object per line
+
+#define EXPORT_URL ""              // endpoint, "" = exporter off
+#define EXPORT_FORMAT EXPORT_INFLUX
+#define EXPORT_AUTHORIZATION ""    // Authorization header, "" = none
+#define EXPORT_BATCH 50            // commands per request
+#define EXPORT_MAX_AGE 10000       // ms the oldest command waits at most
+#define EXPORT_QUEUE 256           // commands kept while the endpoint is slow or down
+#define EXPORT_TIMEOUT 1000        // ms to wait for the endpoint
+#define EXPORT_BACKOFF 1000        // ms before the first retry
+#define EXPORT_BACKOFF_MAX 60000   // ms, longest time between retries
+
+/**********************************************************************************
+ *
+ * Queue command for export, time is the unix time of the frame in ms or 0
+ * (network task)
+ *
+ **********************************************************************************/
+void exportCommand(const command_t &command, int64_t time);
+
+/**********************************************************************************
+ *
+ * Send a batch if it is full or old enough (network task)
+ *
+ **********************************************************************************/
+void runExport();
+
+/**********************************************************************************
+ *
+ * Create exporter report as JSON string
+ *
+ **********************************************************************************/
+String exportReport();
@@ -40,6 +40,20 @@ unsigned int previousIndex(unsigned int index);
  **********************************************************************************/
 String reverseString(String original);
 
+/**********************************************************************************
+ *
+ * name of action as used in topics
+ *
+ **********************************************************************************/
+String actionName(uint8_t action);
+
+/**********************************************************************************
+ *
+ * action for a name as used in topics, 0 if unknown
+ *
+ **********************************************************************************/
+uint8_t actionNumber(const String &name);
+
 /**********************************************************************************
  *
  * show error code
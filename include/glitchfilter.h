@@ -0,0 +1,64 @@
+#pragma once
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ * The glitch filter sits between the edges of a receiver and its decoders. Every
+ * stage merges pulses up to its width into the surrounding period of the other
+ * level, and periods with the same level as the one before (an edge was lost)
+ * into that one. Each stage holds back one period until the next one shows
+ * whether it goes on. The widths are glitch_stages in header.h. One stage is
+ * best for bursts of spikes: a narrower stage in front joins the short gaps
+ * between the spikes into them, so they pass the wider stage as a pulse
+ * (compare with make bench in tools/decode).
+ *
+ **********************************************************************************/
+#define MAX_GLITCH_STAGES 4 // stages of a filter
+
+// one stage, holds the last period
+typedef struct
+{
+  unsigned long duration; // us, 0 if none yet
+  uint8_t level;
+  bool glitch;            // last period was a glitch, the next one continues the period
+} glitch_stage_t;
+
+typedef struct
+{
+  const unsigned int *widths; // us per stage, NULL for glitch_stages
+  unsigned int stage_count;
+  glitch_stage_t stages[MAX_GLITCH_STAGES];
+  unsigned long glitches; // pulses removed
+  unsigned long merged;   // periods joined because the level did not change
+} glitch_filter_t;
+
+/**********************************************************************************
+ *
+ * Use other stage widths than glitch_stages, no stages pass all periods
+ *
+ **********************************************************************************/
+void setGlitchStages(glitch_filter_t *filter, const unsigned int *widths, unsigned int count);
+
+/**********************************************************************************
+ *
+ * Filter periods (duration in us and level) in place, returns the number of
+ * periods left
+ *
+ **********************************************************************************/
+unsigned int filterPeriods(glitch_filter_t *filter, unsigned long *durations, uint8_t *levels, unsigned int count);
+
+/**********************************************************************************
+ *
+ * Take the held periods out of the filter when no edge follows (receiver
+ * quiet, end of a capture), returns the number of periods
+ *
+ **********************************************************************************/
+unsigned int flushGlitchFilter(glitch_filter_t *filter, unsigned long *durations, uint8_t *levels);
+
+/**********************************************************************************
+ *
+ * Create filter report as JSON string
+ *
+ **********************************************************************************/
+String glitchFilterReport(const glitch_filter_t *filter);
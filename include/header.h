@@ -4,8 +4,10 @@
  *
  **********************************************************************************/
 #define INFO_LED 2            // LED (internal LED for ESP32 D1 Mini)
-#define RECEIVE 22            // interrupt pin
-#define RING_BUFFER_SIZE 1000 // maximum count of high / low changes
+#define RECEIVE 22            // interrupt pin (CC1101 GDO2)
+#define TRANSMIT 4            // transmit data pin (CC1101 GDO0)
+#define RECEIVER_COUNT 1      // number of receiver modules, pins in receiver_pins
+#define RING_BUFFER_SIZE 1000 // maximum count of high / low changes of a Fernotron frame
 
 /**********************************************************************************
  *
@@ -13,6 +15,25 @@
  *
  **********************************************************************************/
 #define C1101_SPI_ERROR 5 // Error connecting to C1101 module
+#define RSSI_UNKNOWN -128 // receiver module without rssi
+
+/**********************************************************************************
+ *
+ * Receiver modules, first one is the CC1101 (or an RXB8 at the same pin). Add
+ * pins for further RXB8 / XY-MK-5V modules, e.g. {RECEIVE, 21} with
+ * RECEIVER_COUNT 2. Frames received by several modules are published once.
+ *
+ **********************************************************************************/
+const uint8_t receiver_pins[RECEIVER_COUNT] = {RECEIVE};
+
+/**********************************************************************************
+ *
+ * Further pins used by the gateway: LED, CC1101 GDO0 and SPI (CSN, SCK, MISO,
+ * MOSI), serial console (TX, RX) and the SPI flash (6 - 11). Gpio rules must
+ * not switch them.
+ *
+ **********************************************************************************/
+const uint8_t reserved_pins[] = {INFO_LED, TRANSMIT, 5, 18, 19, 23, 1, 3, 6, 7, 8, 9, 10, 11};
 
 /**********************************************************************************
  *
@@ -20,10 +41,12 @@
  *
  **********************************************************************************/
 const unsigned int glitch = 50;               // ignore to short signals
+const unsigned int glitch_stages[] = {glitch}; // glitch filter, pulses up to this width are merged, see glitchfilter.h
 const unsigned int symbol_length = 400;       // fernotron symbol length 400us
 const unsigned int tolerance = 200;           // tolerance range 200us
 const unsigned int block_min_duration = 2750; // sync block min duration in us
 const unsigned int block_max_duration = 3650; // sync block max duration in us
+const unsigned long frame_holdoff = 2 * (block_max_duration + 30 * symbol_length); // skip words 11 and 12 after a frame
 
 /**********************************************************************************
  *
@@ -31,3 +54,10 @@ const unsigned int block_max_duration = 3650; // sync block max duration in us
  *
  **********************************************************************************/
 void publishMQTT(String topic, String payload);
+void publishMQTTBinary(const char *topic, const uint8_t *payload, unsigned int length);
+void publishMQTTRetained(const char *topic, const String &payload);
+bool connectMQTT();
+int receiverRssi(uint8_t receiver);
+void setRadioTransmit(bool transmit);
+uint8_t checkRadio();           // WATCHDOG_OK or the CC1101 fault, see watchdog.h
+void recoverRadio(bool reset);  // SetRx(), with reset a new CCInit()
@@ -0,0 +1,52 @@
+#pragma once
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ **********************************************************************************/
+#define HEAP_FRAME 0          // decoding of a frame (processFernotronFrame)
+#define HEAP_PUBLISH 1        // publishing a command (sendMessage)
+#define HEAP_PAGE 2           // rendering the history page
+#define HEAP_STAGES 3
+#define HEAP_TREND_SIZE 48    // largest free block samples kept
+#define HEAP_TREND_INTERVAL 3600 // seconds per trend sample
+
+// state of the heap before a stage
+typedef struct
+{
+  uint32_t free_bytes;      // free heap
+  uint32_t largest_block;   // largest free block, 0 if the heap is not walked
+  uint32_t used_blocks;     // allocated blocks, 0 if the heap is not walked
+  uint32_t allocations;     // allocations so far, 0 if the allocator does not count
+  uint32_t allocated_bytes; // bytes allocated so far, 0 if the allocator does not count
+} heap_mark_t;
+
+/**********************************************************************************
+ *
+ * Current state of the heap, cheap enough for every frame: on the ESP32 only
+ * the free bytes, the heap is walked by heapSample() and heapReport()
+ *
+ **********************************************************************************/
+heap_mark_t heapMark();
+
+/**********************************************************************************
+ *
+ * Account heap use of a stage that started at mark begin
+ *
+ **********************************************************************************/
+void heapStage(uint8_t stage, const heap_mark_t &begin);
+
+/**********************************************************************************
+ *
+ * Sample largest free block for the trend, walks the heap (loop task)
+ *
+ **********************************************************************************/
+void heapSample();
+
+/**********************************************************************************
+ *
+ * Heap state, stage accounting and trend as JSON string
+ *
+ **********************************************************************************/
+String heapReport();
@@ -1,20 +1,37 @@
+#include <command.h>
+
 /**********************************************************************************
  *
  * Defines
  *
  **********************************************************************************/
 #define HISTORY_BUFFER_SIZE 100 // command history buffer size
+#define HISTORY_READ_RETRIES 5  // reads of a slot, one tick apart, before it is skipped as busy
+
+/**********************************************************************************
+ *
+ * Start time synchronisation (call when network is up)
+ *
+ **********************************************************************************/
+void TimeInit();
+
+/**********************************************************************************
+ *
+ * Unix time of the frame of a command in ms, 0 if the clock is not set
+ *
+ **********************************************************************************/
+int64_t captureTime(const command_t &command);
 
 /**********************************************************************************
  *
  * Store command in history buffer
  *
  **********************************************************************************/
-void storeCommand(uint8_t type, uint8_t id1, uint8_t id2, uint8_t id3, uint8_t counter, uint8_t member, uint8_t group, uint8_t action);
+void storeCommand(const command_t &command);
 
 /**********************************************************************************
  *
  * read command history buffer and create html table string
  *
  **********************************************************************************/
-String readHistory();
\ No newline at end of file
+String readHistory();
@@ -0,0 +1,52 @@
+#include <command.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ * The history log is an append only log of fixed size records in the flash
+ * partition "history" (see partitions.csv). Sectors are written one after the
+ * other and the oldest sector is erased when the log wraps around, so every
+ * sector is erased equally often.
+ *
+ **********************************************************************************/
+#define HISTORY_LOG_PARTITION "history" // partition label
+#define HISTORY_LOG_SECTOR_SIZE 4096    // flash erase unit
+#define HISTORY_LOG_RECORD_SIZE 32      // bytes per command record
+#define HISTORY_LOG_MAX_SECTORS 512     // index size, larger partitions are only partly used
+#define HISTORY_LOG_QUERY_LIMIT 100     // default number of commands returned by a query
+#define HISTORY_LOG_MAX_LIMIT 500       // most commands returned by a query (about 45 kB of JSON)
+#define HISTORY_LOG_ANY_SENDER -1       // query all senders
+#define HISTORY_LOG_QUIET 200           // ms without an edge before the next sector is erased in advance
+
+/**********************************************************************************
+ *
+ * Open history log partition and rebuild the in memory index
+ *
+ **********************************************************************************/
+void HistoryLogInit();
+
+/**********************************************************************************
+ *
+ * Append command with timestamp (seconds since epoch, 0 if unknown) to log
+ *
+ **********************************************************************************/
+void appendHistoryLog(const command_t &command, uint32_t time);
+
+/**********************************************************************************
+ *
+ * Erase the sector after the head in advance, so appending never has to wait
+ * for an erase. Call only while the receivers are quiet, an erase stops the
+ * receiver interrupts for about 45 ms. The oldest sector is dropped a little
+ * earlier than needed.
+ *
+ **********************************************************************************/
+void prepareHistoryLog();
+
+/**********************************************************************************
+ *
+ * Find newest commands of a sender (or all senders) in time range [from..to]
+ * and create JSON string, at most HISTORY_LOG_MAX_LIMIT commands
+ *
+ **********************************************************************************/
+String queryHistoryLog(long sender, uint32_t from, uint32_t to, unsigned int limit);
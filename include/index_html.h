@@ -3,7 +3,8 @@
  *
  * File: index_html.h
  *
- * HTML code for displaying the command history in a browser.
+ * Web page for the command history, gzip compressed. Generated from
+ * web/index.html by tools/web/compress.py, do not edit.
  *
  */
 
@@ -16,70 +17,47 @@
 
 /**********************************************************************************
  *
- * HTML Code index.html
+ * index.html, 1184 bytes, 574 bytes compressed
  *
  **********************************************************************************/
-const char index_html[] PROGMEM = R"stringliteral(
-<!DOCTYPE HTML>
-<html>
-<head>
-<style>
-  * {
-  padding: 0;
-  margin: 0;
-  box-sizing: border-box;
-}
-body {
-  font-family: sans-serif;
-  line-height: 1;
-  font-weight: 400;
-  color: #555;
-  margin: 1.6rem !important;
-  overflow-x: hidden;
-}
-h1 {
-  text-align: center;
-  line-height: 1.8;
-  font-weight: 700;
-  color: #333;
-}
-h2 {
-  text-align: center;
-  line-height: 1.4;
-  font-weight: 600;
-  color: #333;
-  margin-top: 2rem;
-}
-h3 {
-  text-align: center;
-  font-weight: 600;
-  line-height: 0.6;
-  color: teal;
-  margin-top: 0.8rem;
-}
-table {
-  text-align: center;
-  margin-top: 1rem;
-}
-th {
-  color: royalblue; 
-}
-td {
-  padding: 0.3rem;
-}
-.centered {
-  display: flex;
-  align-items: center;
-  justify-content: center;
-}
-</style>
-</head>
-<body>
-  <h1>Fernotron 2 MQTT Gateway</h1>
-  <h3>Wifi connection: %WIFIRSSI% dBm</h2>
-  <h3>433Mhz connection: %C1101RSSI% dBm</h2>
-  <h2>Command History</h2>
-  <p>%TABLE%</p>
-</body>
-</html>
-)stringliteral";
+#define INDEX_HTML_ETAG "\"85ae5051e639c01f\""
+
+const size_t index_html_gz_length = 574;
+const uint8_t index_html_gz[] PROGMEM = {
+  0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x8d, 0x54, 0x4d, 0x6f, 0xdb, 0x30,
+  0x0c, 0xbd, 0xfb, 0x57, 0xa8, 0xdd, 0xa1, 0xe9, 0x00, 0x3b, 0x1f, 0x6e, 0xb3, 0xc2, 0x4e, 0x7d,
+  0x68, 0xd7, 0xad, 0x03, 0x56, 0x6c, 0x2b, 0x02, 0x0c, 0x3b, 0x2a, 0x16, 0x1d, 0xab, 0x90, 0x25,
+  0x43, 0x62, 0x96, 0xb8, 0x43, 0xff, 0xfb, 0x28, 0xdb, 0xfd, 0x48, 0xda, 0x60, 0x3b, 0xd9, 0x26,
+  0xf9, 0xde, 0xe3, 0xa3, 0x68, 0xcd, 0x0e, 0x3e, 0x7e, 0xbb, 0x9c, 0xff, 0xfa, 0x7e, 0xc5, 0xae,
+  0xe7, 0x37, 0x5f, 0xb3, 0x60, 0x56, 0x62, 0xa5, 0xfc, 0x03, 0xb8, 0xa0, 0x87, 0xc3, 0x46, 0x41,
+  0x16, 0xbc, 0x67, 0x7f, 0x82, 0x9a, 0x0b, 0x21, 0xf5, 0x32, 0x61, 0xa3, 0x34, 0xa8, 0xb8, 0x5d,
+  0x4a, 0xdd, 0xbe, 0x2e, 0xcc, 0x26, 0x74, 0xf2, 0xbe, 0xcd, 0x2c, 0x8c, 0x15, 0x60, 0x43, 0x0a,
+  0xa5, 0xc1, 0x03, 0x65, 0x44, 0x43, 0xb8, 0xc2, 0x68, 0x0c, 0x0b, 0x5e, 0x49, 0xd5, 0x24, 0xcc,
+  0x71, 0xed, 0x42, 0x07, 0x56, 0x16, 0x69, 0xa0, 0xa4, 0x86, 0xb0, 0x04, 0xb9, 0x2c, 0x31, 0x61,
+  0xe3, 0xb4, 0x2b, 0x5c, 0xf7, 0xdf, 0x27, 0x23, 0xe2, 0xce, 0x8d, 0x32, 0x36, 0x61, 0xef, 0x4e,
+  0x4f, 0x4f, 0x9f, 0x35, 0xc7, 0xd1, 0xd4, 0x42, 0xc5, 0x0e, 0x64, 0x55, 0x1b, 0x8b, 0x5c, 0x63,
+  0x1a, 0x98, 0xdf, 0x60, 0x0b, 0x65, 0xd6, 0xe1, 0x26, 0x61, 0xa5, 0x14, 0x02, 0xb4, 0xd7, 0x2f,
+  0xc7, 0xa4, 0x8e, 0xb0, 0xc1, 0x90, 0x2b, 0xb9, 0x24, 0x64, 0x0e, 0x1a, 0xc1, 0xee, 0x0a, 0x47,
+  0x67, 0x3b, 0xd2, 0x1f, 0x5e, 0x4a, 0xc7, 0x71, 0xdc, 0x72, 0x4d, 0xfe, 0x8f, 0xeb, 0x64, 0x87,
+  0x6b, 0xfa, 0x8a, 0xab, 0xb3, 0x11, 0xa2, 0xa9, 0x13, 0x36, 0x21, 0x23, 0x2d, 0x7b, 0xbc, 0x87,
+  0xfd, 0x35, 0xd7, 0x96, 0xde, 0x28, 0x9a, 0x3e, 0xb1, 0x23, 0x70, 0xb5, 0xcd, 0x3e, 0x8a, 0xce,
+  0x7a, 0x7e, 0xe4, 0x0b, 0x05, 0x7b, 0x24, 0x5e, 0x22, 0xc6, 0x8f, 0xf5, 0x25, 0x15, 0xf7, 0xbc,
+  0xd6, 0x34, 0x5c, 0x2d, 0xd4, 0x0a, 0xda, 0x84, 0xd8, 0x5a, 0x84, 0x28, 0xee, 0x01, 0x51, 0xc7,
+  0x06, 0x3e, 0x2d, 0xa4, 0xab, 0x15, 0xa7, 0xb3, 0x2e, 0x14, 0xd0, 0x1e, 0xb4, 0x72, 0xa1, 0x44,
+  0xa8, 0xdc, 0xb3, 0xe8, 0xdd, 0xca, 0xa1, 0x2c, 0x9a, 0x30, 0x27, 0x7f, 0x14, 0x7a, 0x4e, 0x3c,
+  0x04, 0xb3, 0x61, 0xbf, 0x73, 0xb3, 0x61, 0xbf, 0x83, 0x7e, 0x8f, 0xfc, 0x46, 0x8e, 0xb3, 0x4f,
+  0x60, 0xb5, 0x41, 0x6b, 0x34, 0x9b, 0xb0, 0x9b, 0x1f, 0xf3, 0x39, 0xfb, 0xcc, 0x11, 0xd6, 0xbc,
+  0xa1, 0xd2, 0xb1, 0xaf, 0x88, 0xb3, 0x9f, 0xb2, 0x90, 0x8c, 0x58, 0x35, 0xe4, 0x28, 0x0d, 0xd9,
+  0x9c, 0xb9, 0x9a, 0x6b, 0x26, 0xc5, 0xf9, 0xe1, 0x9a, 0x52, 0x87, 0x19, 0xd1, 0x53, 0x20, 0x63,
+  0xe2, 0xa2, 0x22, 0x54, 0xdc, 0xa1, 0x4e, 0xe2, 0xf8, 0xa6, 0xbc, 0xdf, 0x83, 0xb3, 0x5c, 0x48,
+  0xf3, 0x26, 0x70, 0x92, 0x5d, 0x9a, 0xaa, 0xe2, 0x5a, 0xb0, 0x6b, 0xe9, 0xd0, 0x58, 0xdf, 0xc7,
+  0x84, 0x12, 0x75, 0x8b, 0x6b, 0x87, 0xee, 0x71, 0xb5, 0xff, 0x8f, 0x72, 0x2b, 0x6b, 0xcc, 0x82,
+  0x02, 0x30, 0x2f, 0x07, 0x47, 0x43, 0x5e, 0x4b, 0xf2, 0xc9, 0x71, 0xe5, 0x8e, 0x8e, 0x23, 0x2c,
+  0x41, 0x0f, 0x2c, 0x3b, 0xcf, 0x98, 0x8d, 0xee, 0x9c, 0xd1, 0x83, 0xe3, 0x3e, 0xe6, 0x7c, 0x8c,
+  0x26, 0x6a, 0xf2, 0x55, 0x45, 0x03, 0x8a, 0x96, 0x80, 0x57, 0x0a, 0xfc, 0xeb, 0x45, 0xf3, 0x45,
+  0x0c, 0x8e, 0xbc, 0x25, 0x8f, 0xa7, 0x63, 0xbd, 0xec, 0x26, 0xc9, 0xce, 0x99, 0x8b, 0xfc, 0x10,
+  0x6e, 0x9d, 0x93, 0xe9, 0x7e, 0x64, 0x6b, 0xea, 0x0d, 0xe8, 0xad, 0x8f, 0x77, 0xd8, 0x87, 0xe3,
+  0x74, 0xab, 0xdd, 0xd6, 0xcf, 0x4e, 0xb7, 0x1e, 0xfe, 0xd4, 0x2d, 0xfe, 0xa3, 0xdb, 0x47, 0x02,
+  0x49, 0x53, 0xb6, 0xfe, 0xb6, 0x21, 0x45, 0xec, 0x74, 0x68, 0xb8, 0xfd, 0x80, 0x66, 0xc3, 0xfe,
+  0xb8, 0x87, 0xdd, 0x45, 0xf4, 0x17, 0x37, 0x63, 0x81, 0xea, 0xa0, 0x04, 0x00, 0x00,
+};
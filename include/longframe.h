@@ -0,0 +1,61 @@
+#pragma once
+#include <command.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ * A central unit (2411) sends long frames when it programs a receiver: the
+ * command bytes followed by lines of 9 data bytes and a checksum byte, every
+ * byte sent twice like in a command frame. Line 0 is the clock, lines 1 - 8
+ * the weekly timer, lines 9 - 20 the astro table and line 21 the flags. A
+ * clock frame has only line 0.
+ *
+ **********************************************************************************/
+#define LONG_FRAME_LINE_BYTES 10   // 9 data bytes and checksum
+#define LONG_FRAME_LINES 22        // clock, 8 timer, 12 astro and flag lines
+#define LONG_FRAME_TIMER_LINE 1    // first weekly timer line
+#define LONG_FRAME_ASTRO_LINE 9    // first astro line
+#define LONG_FRAME_FLAG_LINE 21    // flags
+#define LONG_FRAME_QUEUE_LENGTH 2  // long frames waiting for the network task
+#define LONG_FRAME_REPEAT_TIME 500 // ms in which the same long frame is a repeat
+#define LONG_FRAME_TOPIC "/Program"
+
+// decoded long frame
+typedef struct
+{
+  command_t command;                                      // command bytes and reception data
+  uint8_t lines;                                          // complete lines received
+  uint32_t bad_lines;                                     // bit per line with damaged bytes or wrong checksum
+  uint8_t data[LONG_FRAME_LINES][LONG_FRAME_LINE_BYTES];  // line bytes
+} long_frame_t;
+
+/**********************************************************************************
+ *
+ * Create the queue for long frames
+ *
+ **********************************************************************************/
+void LongFrameInit();
+
+/**********************************************************************************
+ *
+ * Pass a decoded long frame to the network task (decode task), of a frame and
+ * its repeats the copy with the fewest bad lines is published
+ *
+ **********************************************************************************/
+void queueLongFrame(const long_frame_t &frame);
+
+/**********************************************************************************
+ *
+ * Publish queued long frames (network task), e.g. on
+ * Fernotron2MQTT/CentralUnit/ID_80abcd/Program
+ *
+ **********************************************************************************/
+void publishLongFrames();
+
+/**********************************************************************************
+ *
+ * Long frame as JSON string
+ *
+ **********************************************************************************/
+String longFrameJson(const long_frame_t &frame);
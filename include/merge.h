@@ -0,0 +1,33 @@
+#include <command.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ **********************************************************************************/
+#define MERGE_WINDOW 30 // ms to wait for the same frame from other receivers
+#define MERGE_SLOTS 4   // frames waiting for other receivers
+
+/**********************************************************************************
+ *
+ * Pass a decoded command to the merge stage (decode task). With several
+ * receivers the best copy of a frame is kept, repeated frames of a central
+ * unit (same id and counter) are dropped.
+ *
+ **********************************************************************************/
+void mergeCommand(const command_t &command);
+
+/**********************************************************************************
+ *
+ * Queue merged commands whose merge window has ended, returns ms until the
+ * next window ends
+ *
+ **********************************************************************************/
+unsigned long flushMergedCommands(unsigned long idle_timeout);
+
+/**********************************************************************************
+ *
+ * Number of copies dropped because another receiver had a better one
+ *
+ **********************************************************************************/
+unsigned long mergedCommands();
@@ -9,3 +9,73 @@
 #define MQTT_PASSWORD "MY_MQTT_PASSWORD" // Password for MQTT connection
 #define MQTT_SERVER "MY_MQTT_SERVER_IP"  // address of your MQTT server
 #define MQTT_PORT 1883
+#define MQTT_RETRY_INTERVAL 2000 // ms between connection attempts
+#define MQTT_BUFFER_SIZE 1024    // bytes of topic and payload, long frames need about 700
+
+/**********************************************************************************
+ *
+ * Defines for several gateways in one building
+ *
+ * With GATEWAY_COORDINATION 1 every gateway announces the frames it received on
+ * COORDINATION_TOPIC. Within ELECTION_WINDOW ms only the gateway with the best
+ * rssi publishes the command, the others just store it in their history.
+ *
+ **********************************************************************************/
+
+#define GATEWAY_COORDINATION 0                                   // 1 = several gateways receive the same senders
+#define COORDINATION_TOPIC MQTT_CLIENT_ID "/Coordination/Frames" // topic for frame announcements
+#define ELECTION_WINDOW 150                                      // ms to wait for better announcements
+#define ANNOUNCE_DELAY 2                                         // ms announcement delay per dB below ANNOUNCE_BEST_RSSI
+#define ANNOUNCE_BEST_RSSI -30                                   // rssi announced without delay
+
+/**********************************************************************************
+ *
+ * Defines for sending commands
+ *
+ * With TRANSMIT_COMMANDS 1 the gateway sends a Fernotron frame for every message
+ * on COMMAND_TOPIC, the topic names the command like the published topics,
+ * e.g. Fernotron2MQTT/Command/CentralUnit/ID_80abcd/Group_1/Member_2/down.
+ * Everybody who may publish on the broker can then move your shutters, allow
+ * COMMAND_TOPIC only for your home automation in the broker's access list.
+ *
+ **********************************************************************************/
+
+#define TRANSMIT_COMMANDS 0                      // 1 = send commands from COMMAND_TOPIC
+#define COMMAND_TOPIC MQTT_CLIENT_ID "/Command/" // prefix of command topics
+
+/**********************************************************************************
+ *
+ * Defines for the published messages
+ *
+ * PAYLOAD_ENCODING selects the payload of the command topics:
+ *   PAYLOAD_JSON    {"Id":"80abcd","Group":"1","Member":"2","Action":"5","Counter":"3"}
+ *   PAYLOAD_COMPACT {"t":8,"id":"80abcd","g":1,"m":2,"a":5,"c":3,"r":-62,"ts":1700000000123}
+ *   PAYLOAD_BINARY  fixed record of BINARY_RECORD_SIZE bytes, see mqttmessage.h
+ * ts is the unix time of the frame in ms (0 while the clock is not set), r the rssi.
+ *
+ * With PUBLISH_AGGREGATE_TOPIC 1 every command is also published on the short
+ * AGGREGATE_TOPIC of this gateway, compact JSON or binary record, so a consumer
+ * subscribes to one topic per gateway. PUBLISH_COMMAND_TOPICS 0 drops the long
+ * per command topics.
+ *
+ * With PUBLISH_SIGNAL_QUALITY 1 the JSON payloads also carry the signal quality
+ * of the frame: rssi at the first sync block, average and largest deviation of
+ * the periods from the symbol length in us, repaired bytes and discarded words
+ * ("Rssi", "Timing", "MaxTiming", "Repaired", "Errors" or "te", "tm", "rp", "e").
+ *
+ * With PUBLISH_STATE_TOPICS 1 the last command of every device is also kept
+ * retained on Fernotron2MQTT/State/ID_80abcd/Group_1/Member_2 (compact JSON).
+ *
+ **********************************************************************************/
+
+#define PAYLOAD_JSON 0
+#define PAYLOAD_COMPACT 1
+#define PAYLOAD_BINARY 2
+
+#define PAYLOAD_ENCODING PAYLOAD_JSON        // payload of the command topics
+#define PUBLISH_COMMAND_TOPICS 1             // 1 = publish on e.g. Fernotron2MQTT/PlainSender/ID_80abcd/up
+#define PUBLISH_AGGREGATE_TOPIC 0            // 1 = publish on AGGREGATE_TOPIC as well
+#define PUBLISH_SIGNAL_QUALITY 0             // 1 = add signal quality to the JSON payloads
+#define PUBLISH_STATE_TOPICS 1               // 1 = retained last command per device, see devicestate.h
+#define GATEWAY_NAME "gw1"                   // short name of this gateway, unique per broker
+#define AGGREGATE_TOPIC "f2m/" GATEWAY_NAME  // all commands of this gateway
@@ -1,6 +1,31 @@
+#include <command.h>
+
+/**********************************************************************************
+ *
+ * Binary payload (PAYLOAD_BINARY), all values little endian
+ *
+ *   0  version (BINARY_RECORD_VERSION)   9  rssi in dBm (int8)
+ *   1  sender type                      10  discarded words while decoding
+ *   2  id, high byte to low byte        11  receiver
+ *   5  counter                          12  unix time of the frame in ms (int64),
+ *   6  group                               0 while the clock is not set
+ *   7  member
+ *   8  action
+ *
+ **********************************************************************************/
+#define BINARY_RECORD_VERSION 1
+#define BINARY_RECORD_SIZE 20
+
+/**********************************************************************************
+ *
+ * Compact JSON payload of a command, time is the unix time in ms
+ *
+ **********************************************************************************/
+String compactPayload(const command_t &command, int64_t time);
+
 /**********************************************************************************
  *
  * Send Message
  *
  **********************************************************************************/
-void sendMessage(uint8_t type, uint8_t id1, uint8_t id2, uint8_t id3, uint8_t counter, uint8_t group, uint8_t member, uint8_t action);
+void sendMessage(const command_t &command);
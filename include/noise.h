@@ -0,0 +1,31 @@
+/**********************************************************************************
+ *
+ * Defines
+ *
+ * The noise monitor samples the edge rate of every receiver and the rssi of
+ * the CC1101 while no frame is received, once per NOISE_SAMPLE_INTERVAL. The
+ * samples are counted in histograms since boot and averaged per hour for the
+ * trend, so a gateway that drowns in noise can be told from a quiet one.
+ *
+ **********************************************************************************/
+#define NOISE_SAMPLE_INTERVAL 1000 // ms between samples
+#define NOISE_RATE_BUCKETS 8       // edges per second below 50, 100, 200, ... 3200 and above
+#define NOISE_RATE_BUCKET_1 50     // edges per second, upper limit of first bucket
+#define NOISE_RSSI_BUCKETS 12      // 5 dB steps from NOISE_RSSI_MIN
+#define NOISE_RSSI_MIN -115        // dBm, upper limit of first bucket
+#define NOISE_TREND_SIZE 24        // hours in trend
+#define NOISE_TREND_INTERVAL 3600  // s per trend value
+
+/**********************************************************************************
+ *
+ * Take a sample if NOISE_SAMPLE_INTERVAL has passed (decode task)
+ *
+ **********************************************************************************/
+void noiseSample();
+
+/**********************************************************************************
+ *
+ * Histograms and trend as JSON string
+ *
+ **********************************************************************************/
+String noiseReport();
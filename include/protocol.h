@@ -1,9 +1,22 @@
+#include <command.h>
+#include <decoder.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ **********************************************************************************/
+#define FRAME_BYTES 6        // id1, id2, id3, counter / member, group / action, checksum
+#define FRAME_WORDS 12       // every byte is sent twice
+#define COUNTER_WORD 6       // first word with the counter, changes with every frame
+#define CHECKSUM_WORD 10     // first word with the checksum
+
 /**********************************************************************************
  *
  * Convert timings to tribits as string for readability
  *
  **********************************************************************************/
-String duration2TriBit(volatile unsigned long *timings, int start, int end);
+String duration2TriBit(const unsigned long *timings, int start, int end);
 
 /**********************************************************************************
  *
@@ -14,17 +27,32 @@ String getByteFromCandidates(String cand1, String cand2);
 
 /**********************************************************************************
  *
- * Analyse the 5 command bytes and check their content
+ * Analyse the 5 command bytes and check their content. The command is
+ * prefilled with the reception data (rssi, errors, capture time). Frames of
+ * senders not in the allowlist are dropped.
  *
  **********************************************************************************/
-void analyseCommand(String byte0, String byte1, String byte2, String byte3, String byte4);
+void analyseCommand(String byte0, String byte1, String byte2, String byte3, String byte4, command_t command);
 
 /**********************************************************************************
  *
- * Split messagage in 10 words of 10 bits. We omit error detection mechnisms
+ * Split messagage in 10 words of 10 bits. We omit error detection mechnisms.
+ * The command is prefilled with the reception data (rssi, capture time).
  *
  **********************************************************************************/
-void processReceivedData(String triBits);
-
+void processReceivedData(String triBits, command_t command);
 
+/**********************************************************************************
+ *
+ * Create Fernotron decoder for the decoder registry of a receiver
+ *
+ **********************************************************************************/
+decoder_t *createFernotronDecoder(uint8_t receiver);
 
+/**********************************************************************************
+ *
+ * Encode command as the 12 words of 10 bits of a Fernotron frame (8 data bits,
+ * low bit first, and 2 check bits). Reverse of processReceivedData.
+ *
+ **********************************************************************************/
+void encodeCommand(const command_t &command, uint16_t words[FRAME_WORDS]);
@@ -0,0 +1,132 @@
+#pragma once
+#include <decoder.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ * The receiver interrupt only stores a timestamp and the signal level of every
+ * edge in the edge buffer of its receiver. Decoding is done by the decode task,
+ * so the cost of an interrupt does not depend on the number of decoders.
+ *
+ **********************************************************************************/
+#define EDGE_BUFFER_SIZE 1024 // edges waiting for the decode task (about 400 ms of Fernotron signal)
+#define EDGE_NOTIFY_COUNT 64  // wake decode task after this many edges
+#define EDGE_NOTIFY_GAP 2000  // or after a gap longer than this (us), e.g. a sync block
+#define EDGE_POLL_INTERVAL 10 // ms, decode task also looks for edges without notification
+
+/**********************************************************************************
+ *
+ * Interrupt storm protection
+ *
+ * A Fernotron frame has at most one edge per 200 us. If a receiver delivers
+ * more than STORM_WINDOW_EDGES edges within STORM_WINDOW, its interrupt stops
+ * storing edges and the decode task disables it for STORM_BACKOFF ms. Each
+ * storm within STORM_BACKOFF_MAX after the last one doubles the time.
+ *
+ **********************************************************************************/
+#define STORM_WINDOW 10000       // us
+#define STORM_WINDOW_EDGES 80    // edges per window, 8000 edges per second
+#define STORM_BACKOFF 100        // ms the interrupt is disabled after a storm
+#define STORM_BACKOFF_MAX 5000   // ms, longest time the interrupt is disabled
+
+/**********************************************************************************
+ *
+ * Capture backend
+ *
+ * CAPTURE_GPIO times every edge in the receiver interrupt. CAPTURE_RMT lets the
+ * RMT peripheral time the pulses in hardware and hand over whole blocks, no
+ * interrupt per edge and no jitter from Wi-Fi interrupts (see rmtcapture.h).
+ * It needs a receiver that is quiet between frames like the CC1101, the noise
+ * of an RXB8 fills the RMT memory before a frame starts.
+ *
+ **********************************************************************************/
+#define CAPTURE_GPIO 0
+#define CAPTURE_RMT 1
+#define CAPTURE_BACKEND CAPTURE_GPIO
+
+typedef struct edge_source_s edge_source_t;
+
+/**********************************************************************************
+ *
+ * Capture state of one receiver module, each with its own decoders
+ *
+ **********************************************************************************/
+typedef struct
+{
+  uint8_t id;                                 // index in receivers
+  uint8_t pin;                                // interrupt pin
+  volatile uint32_t edges[EDGE_BUFFER_SIZE];  // time << 1 | level of each edge
+  volatile unsigned int head;                 // next edge written by interrupt
+  volatile unsigned int tail;                 // next edge read by decode task
+  volatile unsigned long overflow;            // edges lost, buffer full
+  volatile uint32_t last_edge_time;           // time of previous edge
+  volatile unsigned int edges_since_notify;   // edges since decode task was woken
+  volatile uint32_t edge_count;               // all edges, for the edge rate
+  volatile uint32_t window_start;             // start of the rate limit window (us)
+  volatile unsigned int window_edges;         // edges in the rate limit window
+  volatile bool storm;                        // rate limit exceeded, set by interrupt
+  bool muted;                                 // interrupt disabled by the decode task
+  unsigned long muted_at;                     // ms
+  unsigned long unmuted_at;                   // ms
+  unsigned long backoff;                      // ms of the current or last mute
+  unsigned long storms;                       // number of storms
+  unsigned long muted_time;                   // ms muted in total
+  TaskHandle_t task;                          // decode task
+  const edge_source_t *source;                // capture backend
+  void *source_state;                         // backend specific state
+  decoder_registry_t decoders;                // decoders fed with the edges
+} receiver_t;
+
+/**********************************************************************************
+ *
+ * Capture backend of a receiver. start() is called by the decode task,
+ * read() returns up to count edges (time << 1 | level) like the receiver
+ * interrupt stores them and counts them in edge_count.
+ *
+ **********************************************************************************/
+struct edge_source_s
+{
+  const char *name;                                                                // backend name for report
+  void (*start)(receiver_t *receiver);                                             // start capture
+  unsigned int (*read)(receiver_t *receiver, uint32_t *edges, unsigned int count); // get waiting edges
+};
+
+extern receiver_t receivers[RECEIVER_COUNT];
+
+/**********************************************************************************
+ *
+ * Start capture of receiver with CAPTURE_BACKEND, edges wake the given task
+ *
+ **********************************************************************************/
+void ReceiverInit(receiver_t *receiver, TaskHandle_t task);
+
+/**********************************************************************************
+ *
+ * Get up to count edges of receiver, 0 if there are none
+ *
+ **********************************************************************************/
+unsigned int readEdges(receiver_t *receiver, uint32_t *edges, unsigned int count);
+
+/**********************************************************************************
+ *
+ * Disable the interrupt of a receiver in an interrupt storm and enable it
+ * again after the backoff time (decode task)
+ *
+ **********************************************************************************/
+void checkStorm(receiver_t *receiver);
+
+/**********************************************************************************
+ *
+ * Time in ms since the last edge of any receiver (network task, looks for new
+ * edges at every call)
+ *
+ **********************************************************************************/
+unsigned long receiversQuietTime();
+
+/**********************************************************************************
+ *
+ * Create report of all receivers and their decoders as JSON string
+ *
+ **********************************************************************************/
+String receiverReport();
@@ -0,0 +1,39 @@
+#pragma once
+#include <driver/rmt.h>
+#include <receiver.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ * The RMT receiver measures the pulses at the receiver pin in 1 us ticks and
+ * ends a block after RMT_IDLE_THRESHOLD without an edge. The blocks are copied
+ * to a ring buffer by the RMT driver, the decode task turns them into edges.
+ * The RMT memory holds 64 pulse pairs per block of channel memory, channel 0
+ * is used by the transmitter. A block longer than the memory is lost, so long
+ * frames of a central unit need CAPTURE_GPIO.
+ *
+ **********************************************************************************/
+#define RMT_RECEIVE_CHANNEL 1                        // first channel, receiver i uses 1 + i * RMT_RECEIVE_BLOCKS
+#define RMT_RECEIVE_BLOCKS (7 / RECEIVER_COUNT)      // memory blocks per receiver
+#define RMT_IDLE_THRESHOLD 10000                     // us without edge that end a block (> sync block)
+#define RMT_FILTER_TICKS 200                         // pulses shorter than this are dropped (80 MHz ticks, max 255)
+#define RMT_RING_BUFFER_SIZE 8192                    // bytes of blocks waiting for the decode task
+
+// RMT state of one receiver
+typedef struct
+{
+  rmt_channel_t channel;
+  RingbufHandle_t ring_buffer; // blocks from the RMT driver
+  rmt_item32_t *items;         // block being read, NULL if none
+  size_t item_count;
+  size_t next;                 // next pulse in block, two per item
+  uint32_t time;               // time of last edge (us)
+} rmt_capture_t;
+
+/**********************************************************************************
+ *
+ * RMT capture backend
+ *
+ **********************************************************************************/
+extern const edge_source_t rmt_edge_source;
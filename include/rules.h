@@ -0,0 +1,63 @@
+#include <command.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ * A rule is one line: sender group member action, then what to do. Use * for
+ * any value, the action is given by its name as in the topics.
+ *
+ *   80abcd * * down publish Garage/Door/Set close
+ *   80abcd 1 2 up webhook http://192.168.1.20/open
+ *   10f00d * * stop gpio 25 500      (on, off, toggle or pulse length in ms)
+ *   2a5a5a * * sun_down send CentralUnit/ID_80abcd/Group_2/Member_0/down
+ *
+ * Lines starting with # are comments. The rules are stored in flash (NVS) and
+ * can be changed at http://<ip address>/api/rules.
+ *
+ **********************************************************************************/
+#define DEFAULT_RULES ""           // rules used until rules are stored in flash
+#define MAX_RULES 32               // rules in rule table
+#define RULE_TEXT 64               // max length of topic, payload or url
+#define RULES_TEXT_MAX 4000        // max length of stored rule text (NVS string)
+#define RULE_QUEUE_LENGTH 8        // rule actions waiting for the network task
+#define RULE_PULSES 4              // gpio pulses running at the same time
+#define RULE_WEBHOOK_TIMEOUT 500   // ms to wait for a webhook
+
+/**********************************************************************************
+ *
+ * Load rules from flash and compile them into the rule table
+ *
+ **********************************************************************************/
+void RulesInit();
+
+/**********************************************************************************
+ *
+ * Apply rules to a command that passed coalescing (network task). Switches
+ * gpio pins at once, other actions are done by runRuleActions().
+ *
+ **********************************************************************************/
+void applyRules(const command_t &command);
+
+/**********************************************************************************
+ *
+ * Publish, call webhooks, send commands and end gpio pulses of fired rules
+ * (network task)
+ *
+ **********************************************************************************/
+void runRuleActions();
+
+/**********************************************************************************
+ *
+ * Compile new rules, store them in flash if they are valid. Returns the
+ * errors found, empty if the rules were stored.
+ *
+ **********************************************************************************/
+String storeRules(const String &text);
+
+/**********************************************************************************
+ *
+ * Rule text as stored in flash
+ *
+ **********************************************************************************/
+String readRules();
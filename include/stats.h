@@ -0,0 +1,31 @@
+#include <command.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ **********************************************************************************/
+#define STATS_SENDERS 64 // senders with statistics, power of 2 (hash table)
+#define STATS_ACTIONS 16 // action is a 4 bit value
+#define STATS_HOURS 24   // hour of day histogram
+
+/**********************************************************************************
+ *
+ * Update statistics of the command's sender, hour is 0..23 or -1 if unknown
+ *
+ **********************************************************************************/
+void updateStats(const command_t &command, uint32_t time, int hour);
+
+/**********************************************************************************
+ *
+ * Count a command of the sender that was not published
+ *
+ **********************************************************************************/
+void countSuppressed(const command_t &command);
+
+/**********************************************************************************
+ *
+ * Create statistics of all senders as JSON string
+ *
+ **********************************************************************************/
+String statsReport();
@@ -0,0 +1,121 @@
+/**********************************************************************************
+ *
+ * Task layout
+ *
+ * decode task   core 1, high priority: woken by the receiver interrupt, feeds
+ *               the edges to the decoders, which put commands into the command
+ *               queue. Owns the decoders and their state.
+ * network task  core 0, low priority: brings up Wi-Fi, web server and MQTT,
+ *               takes commands from the command queue, writes the history,
+ *               flash log and export at once and publishes them when the
+ *               broker is reachable. Owns the MQTT client.
+ * transmit task core 0, above network task: sends commands from COMMAND_TOPIC
+ *               with the CC1101. Owns the waveform cache.
+ * async_tcp     core 0 (CONFIG_ASYNC_TCP_RUNNING_CORE): web server requests,
+ *               only reads the history.
+ * loop task     core 1, lowest priority: periodic task report.
+ *
+ **********************************************************************************/
+#include <command.h>
+
+#define DECODE_TASK_CORE 1       // keep decoding away from the Wi-Fi stack on core 0
+#define DECODE_TASK_PRIORITY 10  // above loop task and web server
+#define DECODE_TASK_STACK 8192   // String based decoding needs some stack
+#define NETWORK_TASK_CORE 0      // same core as Wi-Fi stack and web server
+#define NETWORK_TASK_PRIORITY 2  // below Wi-Fi and lwIP tasks
+#define NETWORK_TASK_STACK 8192  //
+#define NETWORK_TASK_CYCLE 10    // ms to wait for a command before MQTT housekeeping (MQTT receive latency)
+#define TRANSMIT_TASK_CORE 0     // transmitter waits for the RMT most of the time
+#define TRANSMIT_TASK_PRIORITY 5 // start sending as soon as a command is queued
+#define TRANSMIT_TASK_STACK 4096 //
+#define COMMAND_QUEUE_LENGTH 32  // decoded commands waiting for the network task
+#define COMMAND_HOLD_LENGTH 32   // commands waiting for the broker (also while connecting)
+#define TASK_REPORT_INTERVAL 60  // seconds between task reports on the serial monitor
+
+/**********************************************************************************
+ *
+ * Task ids for statistics
+ *
+ **********************************************************************************/
+#define DECODE_TASK 0
+#define NETWORK_TASK 1
+#define WEB_TASK 2
+#define LOOP_TASK 3
+#define TRANSMIT_TASK 4
+#define TASK_COUNT 5
+
+/**********************************************************************************
+ *
+ * Startup stages for boot timing report
+ *
+ **********************************************************************************/
+#define BOOT_ARMED 0 // receiver interrupts attached
+#define BOOT_WIFI 1  // got ip address
+#define BOOT_WEB 2   // web server started
+#define BOOT_MQTT 3  // connected to broker
+#define BOOT_STAGES 4
+
+/**********************************************************************************
+ *
+ * Create command queue
+ *
+ **********************************************************************************/
+void createCommandQueue();
+
+/**********************************************************************************
+ *
+ * Put decoded command into command queue (decode task)
+ *
+ **********************************************************************************/
+void queueCommand(const command_t &command);
+
+/**********************************************************************************
+ *
+ * Get next command from command queue (network task), false on timeout
+ *
+ **********************************************************************************/
+bool receiveCommand(command_t *command, TickType_t timeout);
+
+/**********************************************************************************
+ *
+ * Keep a command until the broker is reachable (network task). If the hold is
+ * full, the oldest command is returned in dropped and the result is true, it
+ * will not be published.
+ *
+ **********************************************************************************/
+bool holdCommand(const command_t &command, command_t *dropped);
+
+/**********************************************************************************
+ *
+ * Oldest held command (network task), false if none
+ *
+ **********************************************************************************/
+bool releaseCommand(command_t *command);
+
+/**********************************************************************************
+ *
+ * Register a task for the task report
+ *
+ **********************************************************************************/
+void registerTask(uint8_t task, const char *name, TaskHandle_t handle);
+
+/**********************************************************************************
+ *
+ * Add processing time of a task activation in us
+ *
+ **********************************************************************************/
+void addTaskBusyTime(uint8_t task, int64_t busy_time);
+
+/**********************************************************************************
+ *
+ * Remember time since boot when a startup stage was reached (first time only)
+ *
+ **********************************************************************************/
+void recordBootTime(uint8_t stage);
+
+/**********************************************************************************
+ *
+ * Create task report (cpu usage, stack high water mark) as JSON string
+ *
+ **********************************************************************************/
+String taskReport();
@@ -0,0 +1,50 @@
+#include <command.h>
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ **********************************************************************************/
+#define TRANSMIT_CACHE_SIZE 8    // waveforms kept ready to play
+#define TRANSMIT_SENDERS 8       // sender ids with their own command counter
+#define TRANSMIT_QUEUE_LENGTH 8  // commands waiting for the transmitter
+#define TRANSMIT_REPEATS 2       // frames sent per command
+#define TRANSMIT_FRAME_GAP 20    // ms between repeated frames
+
+/**********************************************************************************
+ *
+ * Set up RMT channel for the transmit pin and the transmit queue
+ *
+ **********************************************************************************/
+void TransmitInit();
+
+/**********************************************************************************
+ *
+ * Handle a message on COMMAND_TOPIC (network task): build the command from the
+ * topic, give it the next counter of its sender and queue it for transmission.
+ * Returns false if the topic is not a valid command.
+ *
+ **********************************************************************************/
+bool receiveTransmitCommand(const char *topic);
+
+/**********************************************************************************
+ *
+ * Follow the counter of a received sender we also transmit for (network task)
+ *
+ **********************************************************************************/
+void updateTransmitCounter(const command_t &command);
+
+/**********************************************************************************
+ *
+ * Wait for the next command to transmit (transmit task)
+ *
+ **********************************************************************************/
+bool nextTransmitCommand(command_t *command, TickType_t timeout);
+
+/**********************************************************************************
+ *
+ * Send command as Fernotron frame (transmit task). Returns the processing time
+ * in us, without the time on air.
+ *
+ **********************************************************************************/
+int64_t transmitCommand(const command_t &command);
@@ -0,0 +1,58 @@
+#pragma once
+
+/**********************************************************************************
+ *
+ * Defines
+ *
+ * The receiver watchdog checks every WATCHDOG_INTERVAL whether the gateway
+ * still receives:
+ *
+ * - the CC1101 answers on SPI, is in RX and still has its configuration (it
+ *   forgets it at a brownout)
+ * - every receiver delivered an edge within WATCHDOG_SILENCE_TIMEOUT
+ * - every receiver decoded a frame within WATCHDOG_FRAME_TIMEOUT (0 = not
+ *   checked, for senders that are used at least once a day set e.g. 86400)
+ * - the decode task ran within WATCHDOG_STALL_TIMEOUT
+ *
+ * While a fault persists the recovery escalates from SetRx() to a new
+ * CCInit() to a reboot. A silent receiver is never rebooted, a CC1101 may just
+ * be quiet between frames. Every step and the recovery are published on
+ * WATCHDOG_TOPIC, http://<ip address>/api/watchdog shows the counters.
+ *
+ **********************************************************************************/
+#define WATCHDOG_INTERVAL 5000           // ms between checks
+#define WATCHDOG_SILENCE_TIMEOUT 300     // s without an edge
+#define WATCHDOG_FRAME_TIMEOUT 0         // s without a frame, 0 = not checked
+#define WATCHDOG_STALL_TIMEOUT 10        // s without a round of the decode task
+#define WATCHDOG_EVENTS 8                // events waiting for the broker
+#define WATCHDOG_TOPIC MQTT_CLIENT_ID "/Watchdog"
+
+// faults, most severe first
+#define WATCHDOG_OK 0
+#define WATCHDOG_STALLED 1     // decode task does not run
+#define WATCHDOG_RADIO_SPI 2   // CC1101 does not answer
+#define WATCHDOG_RADIO_RESET 3 // CC1101 lost its configuration
+#define WATCHDOG_RADIO_IDLE 4  // CC1101 not in RX
+#define WATCHDOG_SILENT 5      // no edge for WATCHDOG_SILENCE_TIMEOUT
+#define WATCHDOG_NO_FRAMES 6   // no frame for WATCHDOG_FRAME_TIMEOUT
+
+/**********************************************************************************
+ *
+ * Tell the watchdog that the decode task is running (decode task)
+ *
+ **********************************************************************************/
+void decodeTaskAlive();
+
+/**********************************************************************************
+ *
+ * Check receivers and CC1101, recover and publish the events (network task)
+ *
+ **********************************************************************************/
+void watchdogCheck();
+
+/**********************************************************************************
+ *
+ * Create watchdog report as JSON string
+ *
+ **********************************************************************************/
+String watchdogReport();
@@ -1,3 +1,5 @@
+#pragma once
+
 /**********************************************************************************
  *
  * Defines for Wifi Connection
@@ -7,3 +9,68 @@
 #define WIFI_SSID "MY_WIFI_SSID"
 #define WIFI_PASSWORD "MY_WIFI_PASSWORD"
 
+/**********************************************************************************
+ *
+ * Reconnect manager
+ *
+ * After a drop the gateway first associates directly with the access point and
+ * channel of the last connection and takes the IP address of the last DHCP
+ * lease, without a scan and without DHCP. If that fails (e.g. a mesh moved the
+ * gateway to another access point) the next attempt scans and asks DHCP.
+ * Failed scans are repeated after WIFI_BACKOFF ms, doubled up to
+ * WIFI_BACKOFF_MAX. The lease is only reused within WIFI_LEASE_REUSE % of the
+ * lease time the DHCP server gave. When that time is over while the gateway
+ * is online with the reused lease, DHCP is switched on again to renew it,
+ * which clears the address for a moment and drops the MQTT connection.
+ *
+ **********************************************************************************/
+#define WIFI_CONNECT_TIMEOUT 10000 // ms for association and IP address
+#define WIFI_BACKOFF 250           // ms before the first retry of a failed scan
+#define WIFI_BACKOFF_MAX 30000     // ms, longest time between attempts
+#define WIFI_LEASE_REUSE 50        // % of the lease time in which a lease is reused without DHCP, 0 = never
+#define WIFI_REASONS 8             // disconnect reasons counted, the last one counts all others
+#define WIFI_DURATION_BUCKETS 8    // offline time below 0.5, 1, 2, 5, 10, 30, 60 s and above
+
+#define WIFI_REASON_ASSOC_LEAVE 8  // disconnect asked for by the gateway
+#define WIFI_REASON_NO_AP_FOUND 201
+
+// access to the Wi-Fi driver, simulated on Linux (tools/decode/wifisim.cpp)
+typedef struct
+{
+  void (*begin)(const uint8_t *bssid, int32_t channel); // associate, NULL and 0 to scan
+  void (*configure)(const uint32_t *lease);             // ip, gateway, subnet and dns to use, NULL for DHCP (also while online)
+  void (*disconnect)();
+} wifi_hal_t;
+
+/**********************************************************************************
+ *
+ * Start the reconnect manager, the first attempt is made by wifiRun()
+ *
+ **********************************************************************************/
+void WifiManagerInit(const wifi_hal_t *hal, unsigned long now);
+
+/**********************************************************************************
+ *
+ * Driver events (Wi-Fi event task), they only change the state, the driver is
+ * called by wifiRun(). duration is the lease time DHCP gave in s, 0 if unknown
+ * or for a static address.
+ *
+ **********************************************************************************/
+void wifiAssociated(const uint8_t *bssid, int32_t channel, unsigned long now);
+void wifiGotIp(const uint32_t lease[4], uint32_t duration, unsigned long now);
+void wifiDisconnected(uint8_t reason, unsigned long now);
+
+/**********************************************************************************
+ *
+ * Start the next attempt or end a timed out one (network task)
+ *
+ **********************************************************************************/
+void wifiRun(unsigned long now);
+
+/**********************************************************************************
+ *
+ * Create reconnect report as JSON string: attempts, reasons of the drops and
+ * histogram of the offline times
+ *
+ **********************************************************************************/
+String wifiReport(unsigned long now);
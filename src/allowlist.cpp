@@ -0,0 +1,349 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: allowlist.cpp
+ *
+ * Sender allowlist, so the remotes and sun sensors of the neighbours are not
+ * published. The ids are kept in an open addressing hash set, a lookup costs
+ * one multiplication and mostly one comparison, cheap enough to be done for
+ * every frame as soon as its id is known.
+ *
+ * Frames of unknown senders are counted in a small table. When it is full,
+ * the sender with the fewest frames makes room, so the busy neighbours stay.
+ *
+ * While learning, every frame passes and the senders of valid commands are
+ * added. The decode task does not write to flash, the learned ids are
+ * appended to the stored list by the network task. The set is replaced by the
+ * web server, a mutex keeps the decode task from reading it meanwhile.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <Preferences.h>
+#include <header.h>
+#include <allowlist.h>
+
+#define SENDER_SLOTS 64                 // hash table slots, twice MAX_SENDERS
+#define NO_SENDER 0xffffffff            // empty slot, ids have 24 bits
+#define SENDERS_NAMESPACE "senders"     // NVS namespace and key of sender text
+#define SENDERS_KEY "text"
+
+typedef struct
+{
+  uint32_t slots[SENDER_SLOTS]; // sender ids, NO_SENDER if empty
+  unsigned int count;
+} sender_set_t;
+
+typedef struct
+{
+  uint32_t sender;
+  unsigned long frames; // filtered frames
+} unknown_sender_t;
+
+sender_set_t allowed_senders;                        // used by decode task
+sender_set_t compiled_senders;                       // new list, web server and setup only
+unknown_sender_t unknown_senders[UNKNOWN_SENDERS];   // frames == 0 if unused
+unsigned long filtered_frames = 0;                   // all frames of unknown senders
+bool learning = false;
+unsigned long learn_end = 0;                         // ms
+String learned_senders = "";                         // learned ids not yet in flash
+SemaphoreHandle_t senders_mutex = NULL;              // protects all of the above but compiled_senders
+
+/**********************************************************************************
+ *
+ * Hash set
+ *
+ **********************************************************************************/
+
+unsigned int senderSlot(uint32_t sender)
+{
+  return (uint32_t)(sender * 0x9E3779B9U) >> 26; // 6 bits for 64 slots
+}
+
+// slot of sender, or the empty slot where it belongs
+unsigned int findSender(const sender_set_t *set, uint32_t sender)
+{
+  unsigned int slot = senderSlot(sender);
+  while (set->slots[slot] != sender && set->slots[slot] != NO_SENDER)
+  {
+    slot = (slot + 1) % SENDER_SLOTS; // never full, at most MAX_SENDERS are added
+  }
+  return slot;
+}
+
+// false if the set is full
+bool addSender(sender_set_t *set, uint32_t sender)
+{
+  unsigned int slot = findSender(set, sender);
+  if (set->slots[slot] == sender)
+  {
+    return true;
+  }
+  if (set->count >= MAX_SENDERS)
+  {
+    return false;
+  }
+  set->slots[slot] = sender;
+  set->count++;
+  return true;
+}
+
+String senderText(uint32_t sender)
+{
+  char text[8];
+  snprintf(text, sizeof(text), "%06x", (unsigned int)sender);
+  return text;
+}
+
+/**********************************************************************************
+ *
+ * Compile sender text into compiled_senders, returns errors or ""
+ *
+ **********************************************************************************/
+
+String compileSenders(const String &text)
+{
+  String errors = "";
+  memset(compiled_senders.slots, 0xff, sizeof(compiled_senders.slots));
+  compiled_senders.count = 0;
+
+  int start = 0;
+  unsigned int number = 1;
+  while (start < (int)text.length())
+  {
+    int end = text.indexOf('\n', start);
+    if (end < 0)
+    {
+      end = text.length();
+    }
+    int comment = text.indexOf('#', start);
+    int stop = comment >= 0 && comment < end ? comment : end;
+
+    // words of any length between separators, a long line is not cut
+    int word_start = start;
+    for (int i = start; i <= stop; i++)
+    {
+      if (i < stop && strchr(" \t\r,", text.charAt(i)) == NULL)
+      {
+        continue;
+      }
+      if (i > word_start)
+      {
+        String word = text.substring(word_start, i);
+        char *last;
+        uint32_t sender = strtoul(word.c_str(), &last, 16);
+        if (*last != 0 || sender > 0xffffff)
+        {
+          errors += "line " + String(number) + ": bad sender " + word + "\n";
+        }
+        else if (!addSender(&compiled_senders, sender))
+        {
+          errors += "line " + String(number) + ": more than " + String(MAX_SENDERS) + " senders\n";
+        }
+      }
+      word_start = i + 1;
+    }
+    start = end + 1;
+    number++;
+  }
+  return errors;
+}
+
+void activateSenders()
+{
+  xSemaphoreTake(senders_mutex, portMAX_DELAY);
+  memcpy(&allowed_senders, &compiled_senders, sizeof(allowed_senders));
+  learned_senders = "";
+  xSemaphoreGive(senders_mutex);
+  Serial.println("Allowlist: " + String(allowed_senders.count) + " senders");
+}
+
+String readSenders()
+{
+  Preferences preferences;
+  preferences.begin(SENDERS_NAMESPACE, true);
+  String text = preferences.getString(SENDERS_KEY, "");
+  preferences.end();
+  return text;
+}
+
+void writeSenders(const String &text)
+{
+  Preferences preferences;
+  preferences.begin(SENDERS_NAMESPACE, false);
+  preferences.putString(SENDERS_KEY, text);
+  preferences.end();
+}
+
+/**********************************************************************************
+ *
+ * Load allowlist from flash
+ *
+ **********************************************************************************/
+
+void AllowlistInit()
+{
+  senders_mutex = xSemaphoreCreateMutex();
+  String errors = compileSenders(readSenders());
+  if (errors != "")
+  {
+    Serial.print("Allowlist errors:\n" + errors); // keep the valid senders
+  }
+  activateSenders();
+}
+
+String storeSenders(const String &text)
+{
+  if (text.length() > SENDERS_TEXT_MAX)
+  {
+    return "senders too long";
+  }
+  String errors = compileSenders(text);
+  if (errors != "")
+  {
+    return errors;
+  }
+  writeSenders(text);
+  activateSenders();
+  return "";
+}
+
+/**********************************************************************************
+ *
+ * Check and learn senders (decode task)
+ *
+ **********************************************************************************/
+
+void countUnknownSender(uint32_t sender)
+{
+  unknown_sender_t *fewest = &unknown_senders[0];
+  for (int i = 0; i < UNKNOWN_SENDERS; i++)
+  {
+    if (unknown_senders[i].frames > 0 && unknown_senders[i].sender == sender)
+    {
+      unknown_senders[i].frames++;
+      return;
+    }
+    if (unknown_senders[i].frames < fewest->frames)
+    {
+      fewest = &unknown_senders[i];
+    }
+  }
+  fewest->sender = sender;
+  fewest->frames = 1;
+}
+
+bool senderAllowed(uint32_t sender)
+{
+  xSemaphoreTake(senders_mutex, portMAX_DELAY);
+  bool allowed = allowed_senders.count == 0 || learning ||
+                 allowed_senders.slots[findSender(&allowed_senders, sender)] == sender;
+  if (!allowed)
+  {
+    filtered_frames++;
+    countUnknownSender(sender);
+  }
+  xSemaphoreGive(senders_mutex);
+  return allowed;
+}
+
+void learnSender(uint32_t sender)
+{
+  if (!learning)
+  {
+    return;
+  }
+  xSemaphoreTake(senders_mutex, portMAX_DELAY);
+  if (allowed_senders.slots[findSender(&allowed_senders, sender)] != sender)
+  {
+    if (addSender(&allowed_senders, sender))
+    {
+      learned_senders += senderText(sender) + " # learned\n";
+    }
+    else
+    {
+      Serial.println("Allowlist full, sender " + senderText(sender) + " not learned.");
+    }
+  }
+  xSemaphoreGive(senders_mutex);
+}
+
+/**********************************************************************************
+ *
+ * Learning, learned senders are stored by the network task
+ *
+ **********************************************************************************/
+
+void learnSenders(unsigned int minutes)
+{
+  minutes = min(minutes, (unsigned int)LEARN_MINUTES_MAX);
+  xSemaphoreTake(senders_mutex, portMAX_DELAY);
+  learning = minutes > 0;
+  learn_end = millis() + minutes * 60000UL;
+  xSemaphoreGive(senders_mutex);
+  Serial.println(learning ? "Learning senders for " + String(minutes) + " minutes" : String("Learning ended"));
+}
+
+void storeLearnedSenders()
+{
+  xSemaphoreTake(senders_mutex, portMAX_DELAY);
+  bool learn_ended = learning && (long)(millis() - learn_end) >= 0;
+  String learned = learned_senders;
+  learned_senders = "";
+  xSemaphoreGive(senders_mutex);
+
+  if (learn_ended)
+  {
+    learnSenders(0);
+  }
+  if (learned == "")
+  {
+    return;
+  }
+
+  String text = readSenders();
+  if (text != "" && !text.endsWith("\n"))
+  {
+    text += "\n";
+  }
+  writeSenders(text + learned);
+  Serial.print("Learned senders:\n" + learned);
+}
+
+/**********************************************************************************
+ *
+ * Create allowlist report as JSON string
+ *
+ **********************************************************************************/
+
+String sendersReport()
+{
+  xSemaphoreTake(senders_mutex, portMAX_DELAY);
+  String senders = "";
+  for (int slot = 0; slot < SENDER_SLOTS; slot++)
+  {
+    if (allowed_senders.slots[slot] != NO_SENDER)
+    {
+      senders += String(senders == "" ? "" : ",") + "\"" + senderText(allowed_senders.slots[slot]) + "\"";
+    }
+  }
+  String unknown = "";
+  for (int i = 0; i < UNKNOWN_SENDERS; i++)
+  {
+    if (unknown_senders[i].frames > 0)
+    {
+      unknown += String(unknown == "" ? "" : ",") + "{\"Sender\":\"" + senderText(unknown_senders[i].sender) +
+                 "\",\"Frames\":" + String(unknown_senders[i].frames) + "}";
+    }
+  }
+  long left = learning ? max((long)(learn_end - millis()), 0L) / 1000 : 0;
+  String report = "{\"Senders\":[" + senders + "],\"Learning\":" + String(left) + ",\"Filtered\":" +
+                  String(filtered_frames) + ",\"Unknown\":[" + unknown + "]}";
+  xSemaphoreGive(senders_mutex);
+  return report;
+}
@@ -0,0 +1,85 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: coalesce.cpp
+ *
+ * Suppress repeated sun sensor commands before they are published. The last
+ * published state per sender and group is kept in a small hash table, which
+ * is only used by the network task.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <coalesce.h>
+#include <stats.h>
+
+// last published state of a sun sensor group
+typedef struct
+{
+  bool used;               // table slot in use
+  uint32_t key;            // sender id and group
+  uint8_t action;          // last published action
+  unsigned long published; // time of last publish in ms
+} sun_state_t;
+
+sun_state_t sun_state[COALESCE_SENDERS];
+
+/**********************************************************************************
+ *
+ * Find state of sender and group, a free slot or the oldest slot (linear probing)
+ *
+ **********************************************************************************/
+sun_state_t *findState(uint32_t key, unsigned long now)
+{
+  unsigned int index = (key * 2654435761u) >> 28; // 4 bit hash for 16 slots
+  sun_state_t *oldest = NULL;
+  for (unsigned int i = 0; i < COALESCE_SENDERS; i++)
+  {
+    sun_state_t *state = &sun_state[(index + i) % COALESCE_SENDERS];
+    if (!state->used || state->key == key)
+    {
+      return state;
+    }
+    if (oldest == NULL || now - state->published > now - oldest->published)
+    {
+      oldest = state;
+    }
+  }
+  oldest->used = false; // table full, forget the sensor not seen for the longest time
+  return oldest;
+}
+
+/**********************************************************************************
+ *
+ * Decide whether a command is published
+ *
+ **********************************************************************************/
+bool coalesceCommand(const command_t &command)
+{
+  if (command.type != 2)
+  {
+    return true; // only sun sensors repeat their state
+  }
+
+  unsigned long now = millis();
+  uint32_t key = ((uint32_t)command.id1 << 24) | ((uint32_t)command.id2 << 16) | ((uint32_t)command.id3 << 8) | command.group;
+  sun_state_t *state = findState(key, now);
+
+  if (state->used && state->action == command.action &&
+      (SUN_REFRESH_INTERVAL == 0 || now - state->published < SUN_REFRESH_INTERVAL * 1000UL))
+  {
+    countSuppressed(command);
+    return false;
+  }
+
+  state->used = true;
+  state->key = key;
+  state->action = command.action;
+  state->published = now;
+  return true;
+}
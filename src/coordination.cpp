@@ -0,0 +1,279 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: coordination.cpp
+ *
+ * Several gateways in one building receive the same button press. Each
+ * gateway announces the frame with its rssi on COORDINATION_TOPIC, and only
+ * the gateway with the best reception publishes the command.
+ *
+ * To keep the number of announcements small, a gateway delays its
+ * announcement by ANNOUNCE_DELAY ms per dB of weaker signal and does not
+ * announce at all if it has already heard a better gateway. So usually the
+ * best one or two gateways announce a frame, however many gateways there are.
+ *
+ * Everything runs in the network task (the MQTT callback is called from
+ * client.loop()), so the election table needs no locking.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <header.h>
+#include <mqttconnection.h>
+#include <mqttmessage.h>
+#include <history.h>
+#include <devicestate.h>
+#include <coordination.h>
+
+// election of one frame
+typedef struct
+{
+  bool used;                 // table slot in use
+  bool local;                // frame decoded by this gateway
+  bool announced;            // own announcement sent
+  command_t command;         // decoded command, key for matching announcements
+  int8_t best_rssi;          // best rssi announced by another gateway
+  uint32_t best_gateway;     // id of that gateway, 0 if none
+  unsigned long announce_at; // time for own announcement (ms)
+  unsigned long decide_at;   // end of election (ms)
+} election_t;
+
+election_t elections[ELECTION_SLOTS];
+uint32_t gateway_id = 0;
+
+/**********************************************************************************
+ *
+ * Set id of this gateway
+ *
+ **********************************************************************************/
+void CoordinationInit(uint32_t gateway)
+{
+  gateway_id = gateway;
+}
+
+/**********************************************************************************
+ *
+ * Helpers
+ *
+ **********************************************************************************/
+
+// same frame: same sender, counter and command
+bool sameFrame(const command_t &a, const command_t &b)
+{
+  return a.id1 == b.id1 && a.id2 == b.id2 && a.id3 == b.id3 && a.counter == b.counter &&
+         a.group == b.group && a.member == b.member && a.action == b.action;
+}
+
+// is reception (rssi, gateway) better than (other_rssi, other_gateway)? Lower id wins a tie.
+bool isBetter(int8_t rssi, uint32_t gateway, int8_t other_rssi, uint32_t other_gateway)
+{
+  return other_gateway == 0 || rssi > other_rssi || (rssi == other_rssi && gateway < other_gateway);
+}
+
+election_t *findElection(const command_t &command)
+{
+  for (int i = 0; i < ELECTION_SLOTS; i++)
+  {
+    if (elections[i].used && sameFrame(elections[i].command, command))
+    {
+      return &elections[i];
+    }
+  }
+  return NULL;
+}
+
+// end of election: publish the command if this gateway has the best reception, else only keep its state
+void decideElection(election_t *election)
+{
+  if (election->local && isBetter(election->command.rssi, gateway_id, election->best_rssi, election->best_gateway))
+  {
+    sendMessage(election->command);
+  }
+  else if (election->local)
+  {
+    if (PUBLISH_STATE_TOPICS)
+    {
+      updateState(election->command, captureTime(election->command), false); // published by a better gateway
+    }
+    Serial.printf("Command published by gateway %06x\n", (unsigned int)election->best_gateway);
+  }
+  election->used = false;
+}
+
+// a free slot, else the announcement of another gateway that ends first, else
+// for a local frame the own election that ends first, decided before its slot
+// is taken. NULL if an announcement finds no slot.
+election_t *newElection(const command_t &command, unsigned long now, bool local)
+{
+  election_t *election = NULL;
+  for (int i = 0; i < ELECTION_SLOTS; i++)
+  {
+    if (!elections[i].used)
+    {
+      election = &elections[i];
+      break;
+    }
+    if (election == NULL || (election->local && !elections[i].local) ||
+        (election->local == elections[i].local && (long)(elections[i].decide_at - election->decide_at) < 0))
+    {
+      election = &elections[i];
+    }
+  }
+  if (election->used && election->local)
+  {
+    if (!local)
+    {
+      return NULL; // own elections are more important than a late decode
+    }
+    decideElection(election); // rather published twice than lost
+  }
+  memset(election, 0, sizeof(election_t));
+  election->used = true;
+  election->command = command;
+  election->decide_at = now + ELECTION_WINDOW;
+  return election;
+}
+
+void announce(election_t *election)
+{
+  char payload[80];
+  const command_t &command = election->command;
+  snprintf(payload, sizeof(payload), "%06x,%02x%02x%02x,%u,%u,%u,%u,%llu,%d", (unsigned int)gateway_id,
+           command.id1, command.id2, command.id3, command.counter, command.action, command.group, command.member,
+           (unsigned long long)captureTime(command), command.rssi);
+  publishMQTT(COORDINATION_TOPIC, payload);
+  election->announced = true;
+}
+
+/**********************************************************************************
+ *
+ * Start election for a command decoded by this gateway
+ *
+ **********************************************************************************/
+void electCommand(const command_t &command)
+{
+  unsigned long now = millis();
+  election_t *election = findElection(command);
+  if (election == NULL)
+  {
+    election = newElection(command, now, true);
+  }
+  else
+  {
+    election->command = command; // another gateway was faster, keep its best rssi
+    election->decide_at = now + ELECTION_WINDOW;
+  }
+  election->local = true;
+
+  int wait = (ANNOUNCE_BEST_RSSI - command.rssi) * ANNOUNCE_DELAY;
+  election->announce_at = now + constrain(wait, 0, ELECTION_WINDOW / 2);
+}
+
+/**********************************************************************************
+ *
+ * Handle a frame announcement: "gateway,sender,counter,action,group,member,time,rssi"
+ *
+ **********************************************************************************/
+void receiveAnnouncement(const char *payload, unsigned int length)
+{
+  char text[80];
+  unsigned int gateway, sender, counter, action, group, member;
+  unsigned long long time;
+  int rssi;
+
+  length = min(length, (unsigned int)sizeof(text) - 1);
+  memcpy(text, payload, length);
+  text[length] = 0;
+  if (sscanf(text, "%x,%x,%u,%u,%u,%u,%llu,%d", &gateway, &sender, &counter, &action, &group, &member, &time, &rssi) != 8 ||
+      gateway == gateway_id)
+  {
+    return; // garbage or our own announcement
+  }
+
+  command_t command;
+  memset(&command, 0, sizeof(command));
+  command.id1 = sender >> 16;
+  command.id2 = sender >> 8;
+  command.id3 = sender;
+  command.counter = counter;
+  command.action = action;
+  command.group = group;
+  command.member = member;
+
+  election_t *election = findElection(command);
+  if (election == NULL)
+  {
+    // not decoded here (yet), remember it for a late decode
+    election = newElection(command, millis(), false);
+    if (election == NULL)
+    {
+      return;
+    }
+  }
+  if (isBetter(rssi, gateway, election->best_rssi, election->best_gateway))
+  {
+    election->best_rssi = rssi;
+    election->best_gateway = gateway;
+  }
+}
+
+/**********************************************************************************
+ *
+ * Announce frames, publish won and store lost commands when their time is due
+ *
+ **********************************************************************************/
+void runElection()
+{
+  unsigned long now = millis();
+  for (int i = 0; i < ELECTION_SLOTS; i++)
+  {
+    election_t *election = &elections[i];
+    if (!election->used)
+    {
+      continue;
+    }
+    bool winning = election->local && isBetter(election->command.rssi, gateway_id, election->best_rssi, election->best_gateway);
+
+    // announce only if no better gateway was heard
+    if (winning && !election->announced && (long)(now - election->announce_at) >= 0)
+    {
+      announce(election);
+    }
+
+    if ((long)(now - election->decide_at) >= 0)
+    {
+      decideElection(election);
+    }
+  }
+}
+
+/**********************************************************************************
+ *
+ * ms until runElection has to be called again
+ *
+ **********************************************************************************/
+unsigned long electionTimeout(unsigned long idle_timeout)
+{
+  unsigned long now = millis();
+  unsigned long timeout = idle_timeout;
+  for (int i = 0; i < ELECTION_SLOTS; i++)
+  {
+    election_t *election = &elections[i];
+    if (!election->used)
+    {
+      continue;
+    }
+    unsigned long due = election->decide_at;
+    if (election->local && !election->announced && (long)(election->announce_at - due) < 0)
+    {
+      due = election->announce_at;
+    }
+    timeout = (long)(due - now) <= 0 ? 0 : min(timeout, due - now);
+  }
+  return timeout;
+}
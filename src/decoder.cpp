@@ -0,0 +1,115 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: decoder.cpp
+ *
+ * Registry of the protocol decoders. Every receiver has its own registry, every
+ * edge from the receiver is passed to all decoders of its registry, so one
+ * receiver can serve several protocols. Decoders run in the decode task only.
+ * The glitch filter of the registry cleans the periods for all decoders.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <decoder.h>
+
+/**********************************************************************************
+ *
+ * Add decoder to registry
+ *
+ **********************************************************************************/
+void registerDecoder(decoder_registry_t *registry, decoder_t *decoder)
+{
+  if (registry->count < MAX_DECODERS)
+  {
+    registry->decoders[registry->count++] = decoder;
+  }
+  else
+  {
+    Serial.println("Too many decoders, " + String(decoder->name) + " not registered.");
+  }
+}
+
+/**********************************************************************************
+ *
+ * Pass a batch of edges to all decoders, one decoder after the other
+ *
+ **********************************************************************************/
+void feedPeriods(decoder_registry_t *registry, const unsigned long *durations, const uint8_t *levels, unsigned int count)
+{
+  for (unsigned int d = 0; d < registry->count; d++)
+  {
+    decoder_t *decoder = registry->decoders[d];
+    int64_t begin = esp_timer_get_time();
+    for (unsigned int i = 0; i < count; i++)
+    {
+      if (decoder->feed(decoder->state, durations[i], levels[i]))
+      {
+        decoder->frames++;
+      }
+    }
+    int64_t busy_time = esp_timer_get_time() - begin;
+    decoder->edges += count;
+    decoder->busy_time += busy_time;
+    if (busy_time > decoder->max_busy_time)
+    {
+      decoder->max_busy_time = busy_time;
+    }
+  }
+}
+
+void feedDecoders(decoder_registry_t *registry, const uint32_t *edges, unsigned int count)
+{
+  unsigned long durations[EDGE_BATCH];
+  uint8_t levels[EDGE_BATCH];
+
+  // time between edges, timestamps are 31 bit
+  for (unsigned int i = 0; i < count; i++)
+  {
+    uint32_t time = edges[i] >> 1;
+    durations[i] = (time - registry->previous_edge_time) & 0x7fffffff;
+    levels[i] = edges[i] & 1;
+    registry->previous_edge_time = time;
+  }
+  count = filterPeriods(&registry->filter, durations, levels, count);
+  feedPeriods(registry, durations, levels, count);
+}
+
+/**********************************************************************************
+ *
+ * Pass the periods held by the glitch filter to the decoders
+ *
+ **********************************************************************************/
+void flushDecoders(decoder_registry_t *registry)
+{
+  unsigned long durations[MAX_GLITCH_STAGES];
+  uint8_t levels[MAX_GLITCH_STAGES];
+  unsigned int count = flushGlitchFilter(&registry->filter, durations, levels);
+  if (count > 0)
+  {
+    feedPeriods(registry, durations, levels, count);
+  }
+}
+
+/**********************************************************************************
+ *
+ * Create decoder report as JSON string
+ *
+ **********************************************************************************/
+String decoderReport(decoder_registry_t *registry)
+{
+  String report = "[";
+  for (unsigned int d = 0; d < registry->count; d++)
+  {
+    decoder_t *decoder = registry->decoders[d];
+    report += String(d == 0 ? "" : ",") + "{\"Name\":\"" + String(decoder->name) + "\",\"Edges\":" + String(decoder->edges) +
+              ",\"Frames\":" + String(decoder->frames) + ",\"Busy\":" + String((unsigned long)decoder->busy_time) +
+              ",\"MaxBusy\":" + String((unsigned long)decoder->max_busy_time) + "}";
+  }
+  return report + "]";
+}
@@ -0,0 +1,154 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: devicestate.cpp
+ *
+ * Last known state per sender, group and member, published as retained
+ * messages. The command topics are events, a consumer that starts or
+ * reconnects would have to wait for the next command or scan the history.
+ *
+ * The states are kept in an open addressing hash table like the rules. A
+ * repeated action (e.g. down pressed twice) does not change the state and is
+ * not published again. After a connect all states are published in batches,
+ * so a broker that lost its retained messages gets them back and the command
+ * queue is not held up. Commands published by another gateway update the
+ * table too, without publishing. Used by the network task only.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <mqttconnection.h>
+#include <header.h>
+#include <mqttmessage.h>
+#include <devicestate.h>
+
+#define DEVICE_SLOTS 128 // hash table slots, twice MAX_DEVICES
+
+typedef struct
+{
+  uint32_t key;      // sender << 8 | group << 4 | member
+  command_t command; // last command
+  int64_t time;      // unix time of the command in ms
+} device_state_t;
+
+device_state_t devices[MAX_DEVICES];
+unsigned int device_count = 0;
+int8_t device_slots[DEVICE_SLOTS];  // device of a key, -1 if empty
+bool device_slots_ready = false;
+unsigned int snapshot_next = MAX_DEVICES; // next device of a snapshot, MAX_DEVICES if none
+
+/**********************************************************************************
+ *
+ * Helpers
+ *
+ **********************************************************************************/
+
+uint32_t deviceKey(const command_t &command)
+{
+  return ((uint32_t)command.id1 << 24) | ((uint32_t)command.id2 << 16) | ((uint32_t)command.id3 << 8) |
+         ((command.group & 0x0f) << 4) | (command.member & 0x0f);
+}
+
+unsigned int deviceSlot(uint32_t key)
+{
+  return (uint32_t)(key * 0x9E3779B9U) >> 25; // 7 bits for 128 slots
+}
+
+// slot of key, or the empty slot where it belongs
+unsigned int findDevice(uint32_t key)
+{
+  unsigned int slot = deviceSlot(key);
+  while (device_slots[slot] >= 0 && devices[device_slots[slot]].key != key)
+  {
+    slot = (slot + 1) % DEVICE_SLOTS; // never full, at most MAX_DEVICES are added
+  }
+  return slot;
+}
+
+void publishState(const device_state_t *device)
+{
+  const command_t &command = device->command;
+  char topic[64];
+  snprintf(topic, sizeof(topic), "%s/State/ID_%02x%02x%02x/Group_%u/Member_%u", MQTT_CLIENT_ID, command.id1,
+           command.id2, command.id3, command.group, command.member);
+  publishMQTTRetained(topic, compactPayload(command, device->time));
+}
+
+/**********************************************************************************
+ *
+ * Keep state of a published command
+ *
+ **********************************************************************************/
+
+void updateState(const command_t &command, int64_t time, bool publish)
+{
+  if (!device_slots_ready)
+  {
+    memset(device_slots, -1, sizeof(device_slots));
+    device_slots_ready = true;
+  }
+  uint32_t key = deviceKey(command);
+  unsigned int slot = findDevice(key);
+  device_state_t *device;
+  if (device_slots[slot] >= 0)
+  {
+    device = &devices[device_slots[slot]];
+    bool changed = device->command.action != command.action;
+    device->command = command;
+    device->time = time;
+    if (!changed)
+    {
+      return;
+    }
+  }
+  else if (device_count < MAX_DEVICES)
+  {
+    device_slots[slot] = device_count;
+    device = &devices[device_count++];
+    device->key = key;
+    device->command = command;
+    device->time = time;
+  }
+  else
+  {
+    // state table full, publish without keeping the state
+    device_state_t state = {key, command, time};
+    if (publish)
+    {
+      publishState(&state);
+    }
+    return;
+  }
+  if (publish)
+  {
+    publishState(device);
+  }
+}
+
+/**********************************************************************************
+ *
+ * Snapshot of all states
+ *
+ **********************************************************************************/
+
+void requestStateSnapshot()
+{
+  snapshot_next = 0;
+}
+
+void publishStates()
+{
+  for (unsigned int n = 0; n < STATE_SNAPSHOT_BATCH && snapshot_next < device_count; n++)
+  {
+    publishState(&devices[snapshot_next++]);
+  }
+  if (snapshot_next >= device_count)
+  {
+    snapshot_next = MAX_DEVICES;
+  }
+}
@@ -0,0 +1,185 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: exporter.cpp
+ *
+ * Batched export of the decoded commands to a time series endpoint. The
+ * commands are kept in a ring of fixed records, so the memory is bounded
+ * however long the endpoint is down, and are written into a static body
+ * buffer when a batch is sent, no String per command.
+ *
+ * A batch is only removed from the ring when the endpoint accepted it (2xx).
+ * After a failure or timeout the exporter waits before it tries again, twice
+ * as long after every further failure, so a slow endpoint does not hold up
+ * the network task on every cycle. Used by the network task only.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include <header.h>
+#include <exporter.h>
+
+#define EXPORT_LINE 224 // bytes per command in the body, longest line is about 200
+
+typedef struct
+{
+  command_t command;
+  int64_t time;         // unix time in ms, 0 if the clock was not set
+  unsigned long queued; // ms
+} export_record_t;
+
+export_record_t export_queue[EXPORT_QUEUE];
+unsigned int export_head = 0;  // oldest record
+unsigned int export_count = 0; // records waiting
+char export_body[EXPORT_BATCH * EXPORT_LINE];
+
+unsigned long export_sent = 0;     // commands accepted by the endpoint
+unsigned long export_batches = 0;  // requests accepted
+unsigned long export_failed = 0;   // requests failed
+unsigned long export_dropped = 0;  // commands dropped, queue full
+int export_status = 0;             // HTTP status of the last request
+unsigned long export_backoff = 0;  // ms to wait after the last failure
+unsigned long export_attempt = 0;  // ms of the last request
+int64_t export_post_time = 0;      // us in all requests
+
+/**********************************************************************************
+ *
+ * Queue command
+ *
+ **********************************************************************************/
+
+void exportCommand(const command_t &command, int64_t time)
+{
+  if (EXPORT_URL[0] == 0)
+  {
+    return;
+  }
+  if (export_count == EXPORT_QUEUE)
+  {
+    export_head = (export_head + 1) % EXPORT_QUEUE; // drop oldest
+    export_count--;
+    export_dropped++;
+  }
+  export_record_t *record = &export_queue[(export_head + export_count) % EXPORT_QUEUE];
+  record->command = command;
+  record->time = time;
+  record->queued = millis();
+  export_count++;
+}
+
+/**********************************************************************************
+ *
+ * Format a command as one line of EXPORT_FORMAT, returns the length
+ *
+ **********************************************************************************/
+
+int formatRecord(const export_record_t *record, char *line, size_t size)
+{
+  const command_t &c = record->command;
+  if (EXPORT_FORMAT == EXPORT_NDJSON)
+  {
+    return snprintf(line, size,
+                    "{\"t\":%u,\"id\":\"%02x%02x%02x\",\"g\":%u,\"m\":%u,\"a\":%u,\"c\":%u,\"r\":%d,\"ts\":%lld,"
+                    "\"te\":%u,\"tm\":%u,\"rp\":%u,\"e\":%u,\"rc\":%u}\n",
+                    c.type, c.id1, c.id2, c.id3, c.group, c.member, c.action, c.counter, c.rssi, (long long)record->time,
+                    c.timing, c.max_timing, c.repaired, c.errors, c.receiver);
+  }
+  int length = snprintf(line, size,
+                        "fernotron,sender=%02x%02x%02x,type=%u,group=%u,member=%u,receiver=%u "
+                        "action=%ui,counter=%ui,rssi=%di,timing=%ui,max_timing=%ui,repaired=%ui,errors=%ui",
+                        c.id1, c.id2, c.id3, c.type, c.group, c.member, c.receiver, c.action, c.counter, c.rssi,
+                        c.timing, c.max_timing, c.repaired, c.errors);
+  if (record->time != 0)
+  {
+    length += snprintf(line + length, size - length, " %lld", (long long)record->time); // else time of arrival
+  }
+  return length + snprintf(line + length, size - length, "\n");
+}
+
+/**********************************************************************************
+ *
+ * Send a batch if it is full or old enough
+ *
+ **********************************************************************************/
+
+void runExport()
+{
+  if (EXPORT_URL[0] == 0 || export_count == 0)
+  {
+    return;
+  }
+  unsigned long now = millis();
+  if (export_count < EXPORT_BATCH && now - export_queue[export_head].queued < EXPORT_MAX_AGE)
+  {
+    return;
+  }
+  if (export_backoff > 0 && now - export_attempt < export_backoff)
+  {
+    return;
+  }
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    return;
+  }
+
+  unsigned int count = min(export_count, (unsigned int)EXPORT_BATCH);
+  size_t length = 0;
+  for (unsigned int i = 0; i < count; i++)
+  {
+    length += formatRecord(&export_queue[(export_head + i) % EXPORT_QUEUE], export_body + length,
+                           sizeof(export_body) - length);
+  }
+
+  HTTPClient http;
+  http.setConnectTimeout(EXPORT_TIMEOUT);
+  http.setTimeout(EXPORT_TIMEOUT);
+  http.begin(EXPORT_URL);
+  http.addHeader("Content-Type", EXPORT_FORMAT == EXPORT_NDJSON ? "application/x-ndjson" : "text/plain; charset=utf-8");
+  if (EXPORT_AUTHORIZATION[0] != 0)
+  {
+    http.addHeader("Authorization", EXPORT_AUTHORIZATION);
+  }
+  int64_t begin = esp_timer_get_time();
+  export_status = http.POST((uint8_t *)export_body, length);
+  export_post_time += esp_timer_get_time() - begin;
+  http.end();
+  export_attempt = millis();
+
+  if (export_status >= 200 && export_status < 300)
+  {
+    export_head = (export_head + count) % EXPORT_QUEUE;
+    export_count -= count;
+    export_sent += count;
+    export_batches++;
+    export_backoff = 0;
+  }
+  else
+  {
+    export_failed++;
+    export_backoff = export_backoff == 0 ? EXPORT_BACKOFF : min(2 * export_backoff, (unsigned long)EXPORT_BACKOFF_MAX);
+    Serial.println("Export failed: " + String(export_status) + ", " + String(export_count) + " commands waiting");
+  }
+}
+
+/**********************************************************************************
+ *
+ * Create exporter report as JSON string
+ *
+ **********************************************************************************/
+
+String exportReport()
+{
+  unsigned long requests = export_batches + export_failed;
+  return "{\"Enabled\":" + String(EXPORT_URL[0] != 0 ? "true" : "false") + ",\"Queued\":" + String(export_count) +
+         ",\"Sent\":" + String(export_sent) + ",\"Batches\":" + String(export_batches) +
+         ",\"Failed\":" + String(export_failed) + ",\"Dropped\":" + String(export_dropped) +
+         ",\"Status\":" + String(export_status) + ",\"Backoff\":" + String(export_backoff) +
+         ",\"RequestTime\":" + String(requests == 0 ? 0 : (unsigned long)(export_post_time / requests / 1000)) + "}";
+}
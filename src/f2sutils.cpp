@@ -81,6 +81,53 @@ String reverseString(String original)
   return reverse;
 }
 
+/**********************************************************************************
+ *
+ * name of action as used in topics
+ *
+ **********************************************************************************/
+
+String actionName(uint8_t action)
+{
+  switch (action)
+  {
+  case 3:
+    return "stop";
+  case 4:
+    return "up";
+  case 5:
+    return "down";
+  case 6:
+    return "sun_down";
+  case 7:
+    return "sun_up";
+  case 8:
+    return "sun_inst";
+  case 15:
+    return "test";
+  default:
+    return "NotRecognized";
+  }
+}
+
+/**********************************************************************************
+ *
+ * action for a name as used in topics, 0 if unknown
+ *
+ **********************************************************************************/
+
+uint8_t actionNumber(const String &name)
+{
+  for (uint8_t action = 1; action < 16; action++)
+  {
+    if (actionName(action) == name)
+    {
+      return action;
+    }
+  }
+  return 0;
+}
+
 /**********************************************************************************
  *
  * show error code
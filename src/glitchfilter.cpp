@@ -0,0 +1,134 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: glitchfilter.cpp
+ *
+ * Glitch filter in front of the decoders. A spike inside a long period splits
+ * it into three periods, the decoders would have to put them together again
+ * and lose the level sequence if spikes follow each other or hit a sync gap.
+ * Here a pulse up to the stage width and the period after it are added to the
+ * period before, so the decoders only see clean periods with alternating
+ * levels and the signal time is kept. Runs in the decode task only.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <header.h>
+#include <glitchfilter.h>
+
+/**********************************************************************************
+ *
+ * Use other stage widths than glitch_stages
+ *
+ **********************************************************************************/
+
+void setGlitchStages(glitch_filter_t *filter, const unsigned int *widths, unsigned int count)
+{
+  memset(filter->stages, 0, sizeof(filter->stages));
+  filter->widths = widths;
+  filter->stage_count = min(count, (unsigned int)MAX_GLITCH_STAGES);
+}
+
+/**********************************************************************************
+ *
+ * Filter periods through all stages
+ *
+ **********************************************************************************/
+
+// one stage in place, returns the number of periods passed on
+unsigned int filterStage(glitch_filter_t *filter, glitch_stage_t *stage, unsigned int width, unsigned long *durations,
+                         uint8_t *levels, unsigned int count)
+{
+  unsigned int out = 0;
+  for (unsigned int i = 0; i < count; i++)
+  {
+    unsigned long duration = durations[i]; // overwritten by the output
+    uint8_t level = levels[i];
+    if (stage->duration == 0)
+    {
+      stage->duration = duration; // first period
+      stage->level = level;
+      continue;
+    }
+    if (level == stage->level)
+    {
+      // period goes on after a glitch or an edge was lost
+      stage->duration += duration;
+      filter->merged += stage->glitch ? 0 : 1;
+      stage->glitch = false;
+      continue;
+    }
+    if (duration <= width)
+    {
+      stage->duration += duration; // glitch
+      stage->glitch = true;
+      filter->glitches++;
+      continue;
+    }
+    durations[out] = stage->duration; // held period is complete
+    levels[out] = stage->level;
+    out++;
+    stage->duration = duration;
+    stage->level = level;
+    stage->glitch = false;
+  }
+  return out;
+}
+
+unsigned int filterPeriods(glitch_filter_t *filter, unsigned long *durations, uint8_t *levels, unsigned int count)
+{
+  if (filter->widths == NULL)
+  {
+    setGlitchStages(filter, glitch_stages, sizeof(glitch_stages) / sizeof(glitch_stages[0]));
+  }
+  for (unsigned int s = 0; s < filter->stage_count && count > 0; s++)
+  {
+    count = filterStage(filter, &filter->stages[s], filter->widths[s], durations, levels, count);
+  }
+  return count;
+}
+
+/**********************************************************************************
+ *
+ * Take the held periods out of the filter, the period held by a stage still
+ * passes the later stages
+ *
+ **********************************************************************************/
+
+unsigned int flushGlitchFilter(glitch_filter_t *filter, unsigned long *durations, uint8_t *levels)
+{
+  unsigned int count = 0;
+  for (unsigned int s = 0; s < filter->stage_count; s++)
+  {
+    count = filterStage(filter, &filter->stages[s], filter->widths[s], durations, levels, count);
+    if (filter->stages[s].duration > 0)
+    {
+      durations[count] = filter->stages[s].duration;
+      levels[count] = filter->stages[s].level;
+      count++;
+    }
+    memset(&filter->stages[s], 0, sizeof(glitch_stage_t));
+  }
+  return count;
+}
+
+/**********************************************************************************
+ *
+ * Create filter report as JSON string
+ *
+ **********************************************************************************/
+
+String glitchFilterReport(const glitch_filter_t *filter)
+{
+  String widths = "[";
+  for (unsigned int s = 0; s < filter->stage_count; s++)
+  {
+    widths += String(s == 0 ? "" : ",") + String(filter->widths[s]);
+  }
+  return "{\"Stages\":" + widths + "],\"Glitches\":" + String(filter->glitches) + ",\"Merged\":" + String(filter->merged) + "}";
+}
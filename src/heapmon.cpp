@@ -0,0 +1,143 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: heapmon.cpp
+ *
+ * Heap monitor. Decoding a frame, publishing a command and rendering the
+ * history page all build Arduino Strings; a stage that keeps memory or
+ * fragments the heap shows up here long before the gateway stops working.
+ *
+ * For each stage the change of free bytes is summed up. Other tasks may
+ * allocate at the same time, so single values are noisy, but a stage that
+ * leaks has a steadily positive average. Walking the heap takes the heap lock
+ * for the whole walk, so it is not done per stage: the largest free block is
+ * sampled by the loop task, every HEAP_TREND_INTERVAL seconds a trend value
+ * shows fragmentation over days.
+ *
+ * The host soak test (tools/decode) implements heapMark with an instrumented
+ * allocator that also counts allocations.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <heapmon.h>
+
+// accounting of one stage
+typedef struct
+{
+  uint32_t count;        // stage runs
+  int64_t retained;      // sum of free bytes lost
+  int32_t max_retained;  // most free bytes lost in one run
+} heap_stage_t;
+
+const char *heap_stage_names[HEAP_STAGES] = {"Frame", "Publish", "Page"};
+heap_stage_t heap_stages[HEAP_STAGES];
+portMUX_TYPE heap_mux = portMUX_INITIALIZER_UNLOCKED;
+
+uint32_t heap_trend[HEAP_TREND_SIZE]; // smallest largest free block per interval
+unsigned int heap_trend_count = 0;    // samples taken
+uint32_t heap_trend_min = UINT32_MAX; // of current interval
+unsigned long heap_trend_start = 0;   // ms
+uint32_t heap_min_largest = UINT32_MAX; // smallest largest free block sampled
+
+/**********************************************************************************
+ *
+ * Current state of the heap, free bytes only (no heap walk)
+ *
+ **********************************************************************************/
+
+heap_mark_t heapMark()
+{
+  heap_mark_t mark;
+  mark.free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  mark.largest_block = 0;
+  mark.used_blocks = 0;
+  mark.allocations = 0;
+  mark.allocated_bytes = 0;
+  return mark;
+}
+
+/**********************************************************************************
+ *
+ * Account heap use of a stage
+ *
+ **********************************************************************************/
+
+void heapStage(uint8_t stage, const heap_mark_t &begin)
+{
+  heap_mark_t end = heapMark();
+  int32_t retained = (int32_t)(begin.free_bytes - end.free_bytes);
+
+  portENTER_CRITICAL(&heap_mux);
+  heap_stage_t *stats = &heap_stages[stage];
+  if (stats->count == 0 || retained > stats->max_retained)
+  {
+    stats->max_retained = retained;
+  }
+  stats->count++;
+  stats->retained += retained;
+  portEXIT_CRITICAL(&heap_mux);
+}
+
+/**********************************************************************************
+ *
+ * Sample largest free block for the trend (loop task)
+ *
+ **********************************************************************************/
+
+void heapSample()
+{
+  uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  heap_trend_min = min(heap_trend_min, largest);
+  heap_min_largest = min(heap_min_largest, largest);
+  if (millis() - heap_trend_start >= HEAP_TREND_INTERVAL * 1000UL || heap_trend_count == 0)
+  {
+    heap_trend[heap_trend_count % HEAP_TREND_SIZE] = heap_trend_min;
+    heap_trend_count++;
+    heap_trend_min = UINT32_MAX;
+    heap_trend_start = millis();
+  }
+}
+
+/**********************************************************************************
+ *
+ * Heap state, stage accounting and trend as JSON string
+ *
+ **********************************************************************************/
+
+String heapReport()
+{
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT); // walks the heap, only on request
+  uint32_t free_bytes = info.total_free_bytes;
+  uint32_t largest = info.largest_free_block;
+  String report = "{\"Free\":" + String(free_bytes) + ",\"MinFree\":" + String((unsigned int)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT)) +
+                  ",\"LargestBlock\":" + String(largest) + ",\"MinLargestBlock\":" + String(min(heap_min_largest, largest)) +
+                  ",\"Blocks\":" + String((unsigned int)info.allocated_blocks) +
+                  ",\"Fragmentation\":" + String(free_bytes == 0 ? 0.0f : 100.0f - 100.0f * largest / free_bytes, 1U) +
+                  ",\"Stages\":[";
+  for (int i = 0; i < HEAP_STAGES; i++)
+  {
+    portENTER_CRITICAL(&heap_mux);
+    heap_stage_t stats = heap_stages[i];
+    portEXIT_CRITICAL(&heap_mux);
+    report += String(i == 0 ? "" : ",") + "{\"Name\":\"" + heap_stage_names[i] + "\",\"Count\":" + String(stats.count) +
+              ",\"Retained\":" + String(stats.count == 0 ? 0.0f : (float)stats.retained / stats.count, 1U) +
+              ",\"MaxRetained\":" + String(stats.max_retained) + "}";
+  }
+
+  // oldest sample first
+  report += "],\"Trend\":[";
+  unsigned int first = heap_trend_count > HEAP_TREND_SIZE ? heap_trend_count - HEAP_TREND_SIZE : 0;
+  for (unsigned int i = first; i < heap_trend_count; i++)
+  {
+    report += String(i == first ? "" : ",") + String(heap_trend[i % HEAP_TREND_SIZE]);
+  }
+  return report + "]}";
+}
@@ -5,6 +5,12 @@
  *
  * The command history is stored in a buffer that can be displayed in a browser.
  *
+ * The buffer is written by the network task and read by the web server on the
+ * same or the other core. Each slot is protected by a sequence lock: the writer
+ * makes the sequence odd while it changes a slot and even again afterwards, a
+ * reader copies the slot and retries if the sequence was odd or has changed.
+ * So the writer never waits for a reader and readers always get whole records.
+ *
  */
 
 /**********************************************************************************
@@ -14,123 +20,195 @@
  **********************************************************************************/
 #include <Arduino.h>
 #include "time.h"
+#include <sys/time.h>
 #include <history.h>
+#include <historylog.h>
+#include <stats.h>
+#include <exporter.h>
 
 // read time from a time server to get a timestamp for the command
 const char *ntpServer = "europe.pool.ntp.org";
 const long gmtOffset_sec = 3600;
 const int daylightOffset_sec = 3600;
-struct tm timeinfo;
+const time_t time_valid = 1600000000; // earlier times mean the clock is not set yet
+
+// one command with timestamp
+typedef struct
+{
+    uint32_t number; // running number of command, tells which command is in a slot
+    uint8_t day;
+    uint8_t month;
+    uint8_t year;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    command_t command;
+} history_record_t;
+
+// slot of cyclic command buffer
+typedef struct
+{
+    volatile uint32_t sequence; // odd while slot is written
+    history_record_t record;
+} history_slot_t;
 
 // cyclic command buffer
-uint8_t history_buffer[HISTORY_BUFFER_SIZE][18]; // buffer to store command history
-unsigned static int start = 0;                   // points to oldest command in buffer
-unsigned static int ende = 0;                    // points to position to store next command
+history_slot_t history_buffer[HISTORY_BUFFER_SIZE]; // buffer to store command history
+volatile uint32_t history_count = 0;                // number of commands stored so far
 
-const String table_header = "<tr><th>Date</th><th>Time</th><th>Type</th><th>Id</th><th>Counter</th><th>Member</th><th>Group</th><th>Action</th></tr>";
+const String table_header = "<tr><th>Date</th><th>Time</th><th>Type</th><th>Id</th><th>Counter</th><th>Member</th><th>Group</th><th>Action</th><th>Rssi</th><th>Timing</th><th>Repaired</th></tr>";
 
 /**********************************************************************************
  *
- * Store commnand in history buffer
+ * Start time synchronisation, the SNTP client keeps the clock up to date
  *
  **********************************************************************************/
-void storeCommand(uint8_t type, uint8_t id1, uint8_t id2, uint8_t id3, uint8_t counter, uint8_t member, uint8_t group, uint8_t action)
+void TimeInit()
 {
-    // init and get the time
     configTime(gmtOffset_sec, daylightOffset_sec, ntpServer);
+}
 
-    if (!getLocalTime(&timeinfo))
+/**********************************************************************************
+ *
+ * Unix time of the frame in ms, the command may have waited in the queue
+ *
+ **********************************************************************************/
+int64_t captureTime(const command_t &command)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (now.tv_sec < time_valid)
     {
-        Serial.println("Failed to obtain time.");
+        return 0;
     }
+    return (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000 - (esp_timer_get_time() - command.capture_time) / 1000;
+}
 
-    if (!getLocalTime(&timeinfo))
+/**********************************************************************************
+ *
+ * Store commnand in history buffer (single writer)
+ *
+ **********************************************************************************/
+void storeCommand(const command_t &command)
+{
+    history_record_t record;
+    struct tm timeinfo;
+
+    // capture time of the frame, it may have waited in the queue for the network
+    time_t now = time(NULL);
+    if (now < time_valid)
     {
-        history_buffer[ende][0] = 0;
-        history_buffer[ende][1] = 0;
-        history_buffer[ende][2] = 0;
-        history_buffer[ende][3] = 0;
-        history_buffer[ende][4] = 0;
-        history_buffer[ende][5] = 0;
+        now = 0;
+        Serial.println("Failed to obtain time.");
+        record.day = 0;
+        record.month = 0;
+        record.year = 0;
+        record.hour = 0;
+        record.minute = 0;
+        record.second = 0;
     }
     else
     {
-        history_buffer[ende][0] = timeinfo.tm_mday;
-        history_buffer[ende][1] = timeinfo.tm_mon;
-        history_buffer[ende][2] = timeinfo.tm_year;
-        history_buffer[ende][3] = timeinfo.tm_hour;
-        history_buffer[ende][4] = timeinfo.tm_min;
-        history_buffer[ende][5] = timeinfo.tm_sec;
+        now -= (esp_timer_get_time() - command.capture_time) / 1000000;
+        localtime_r(&now, &timeinfo);
+        record.day = timeinfo.tm_mday;
+        record.month = timeinfo.tm_mon;
+        record.year = timeinfo.tm_year;
+        record.hour = timeinfo.tm_hour;
+        record.minute = timeinfo.tm_min;
+        record.second = timeinfo.tm_sec;
     }
+    record.command = command;
 
-    history_buffer[ende][6] = type;
-    history_buffer[ende][7] = id1;
-    history_buffer[ende][8] = id2;
-    history_buffer[ende][9] = id3;
-    history_buffer[ende][10] = counter;
-    history_buffer[ende][11] = member;
-    history_buffer[ende][12] = group;
-    history_buffer[ende][13] = action;
-
-    ende < HISTORY_BUFFER_SIZE ? ende++ : ende = 0;
-    if (start >= ende)
-    {
-        start < HISTORY_BUFFER_SIZE ? start++ : start = 0;
-    }
+    // keep a copy in flash, the buffer is only for the web page
+    appendHistoryLog(command, now);
+    exportCommand(command, captureTime(command));
+    updateStats(command, now, now == 0 ? -1 : record.hour);
+
+    uint32_t number = history_count;
+    history_slot_t *slot = &history_buffer[number % HISTORY_BUFFER_SIZE];
+    record.number = number;
+
+    slot->sequence = slot->sequence + 1; // odd: slot is changing
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    slot->record = record;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    slot->sequence = slot->sequence + 1; // even: slot is consistent again
+
+    __atomic_store_n(&history_count, number + 1, __ATOMIC_RELEASE);
 }
 
 /**********************************************************************************
  *
- * read command history buffer and create html table string
+ * Copy command with running number from buffer, false if the slot was
+ * overwritten meanwhile or is busy
  *
  **********************************************************************************/
-String readHistory()
+bool readRecord(uint32_t number, history_record_t *record)
 {
+    history_slot_t *slot = &history_buffer[number % HISTORY_BUFFER_SIZE];
 
-    String table = "<table class='centered'>" + table_header;
-    int index = start;
-    do
+    for (int i = 0; i < HISTORY_READ_RETRIES; i++)
     {
-        String sDay = "";
-        if (history_buffer[index][0] < 10)
+        if (i > 0)
         {
-            sDay += '0';
+            vTaskDelay(1); // the writer has a lower priority, let it finish the slot
         }
-        sDay += String(history_buffer[index][0]);
-
-        String sMonth = "";
-        if (history_buffer[index][1] + 1 < 10)
+        uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1)
         {
-            sMonth += '0';
+            continue; // writer is busy
         }
-        sMonth += String(history_buffer[index][1] + 1);
-
-        String sHour = "";
-        if (history_buffer[index][3] < 10)
+        *record = slot->record;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) == sequence)
         {
-            sHour += '0';
+            return record->number == number;
         }
-        sHour += String(history_buffer[index][3]);
+    }
+    return false;
+}
 
-        String sMinute = "";
-        if (history_buffer[index][4] < 10)
-        {
-            sMinute += '0';
-        }
-        sMinute += String(history_buffer[index][4]);
+/**********************************************************************************
+ *
+ * Zero padded two digit number
+ *
+ **********************************************************************************/
+String twoDigits(uint8_t value)
+{
+    String digits = "";
+    if (value < 10)
+    {
+        digits += '0';
+    }
+    return digits + String(value);
+}
 
-        String sSecond = "";
-        if (history_buffer[index][5] < 10)
+/**********************************************************************************
+ *
+ * read command history buffer and create html table string
+ *
+ **********************************************************************************/
+String readHistory()
+{
+    String table = "<table class='centered'>" + table_header;
+    history_record_t record;
+
+    uint32_t end = __atomic_load_n(&history_count, __ATOMIC_ACQUIRE);
+    uint32_t number = end > HISTORY_BUFFER_SIZE ? end - HISTORY_BUFFER_SIZE : 0;
+
+    for (; number < end; number++)
+    {
+        if (!readRecord(number, &record))
         {
-            sSecond += '0';
+            continue; // already replaced by a newer command
         }
-        sSecond += String(history_buffer[index][5]);
 
         table += "<tr>";
-        table += "<td>" + sDay + "." + sMonth + "." + String(history_buffer[index][2] + 1900) + "</td>"; // date
-        table += "<td>" + sHour + ":" + sMinute + ":" + sSecond + "</td>";                               // time info
+        table += "<td>" + twoDigits(record.day) + "." + twoDigits(record.month + 1) + "." + String(record.year + 1900) + "</td>"; // date
+        table += "<td>" + twoDigits(record.hour) + ":" + twoDigits(record.minute) + ":" + twoDigits(record.second) + "</td>";  // time info
 
-        switch (history_buffer[index][6]) // type of sender
+        switch (record.command.type) // type of sender
         {
         case 1:
             table += "<td>plain - sender</td>";
@@ -146,13 +224,13 @@ String readHistory()
             break;
         }
 
-        table += "<td>0x" + String(history_buffer[index][7], HEX) + String(history_buffer[index][8], HEX) + String(history_buffer[index][9], HEX) +
+        table += "<td>0x" + String(record.command.id1, HEX) + String(record.command.id2, HEX) + String(record.command.id3, HEX) +
                  "</td>"; // id of sender
 
-        table += "<td>" + String(history_buffer[index][10]) + "</td>"; // counter
-        table += "<td>" + String(history_buffer[index][11]) + "</td>"; // member
-        table += "<td>" + String(history_buffer[index][12]) + "</td>"; // group
-        switch (history_buffer[index][13])                             // action
+        table += "<td>" + String(record.command.counter) + "</td>"; // counter
+        table += "<td>" + String(record.command.member) + "</td>";  // member
+        table += "<td>" + String(record.command.group) + "</td>";   // group
+        switch (record.command.action)                              // action
         {
         case 3:
             table += "<td>stop</td>";
@@ -179,8 +257,10 @@ String readHistory()
             table += "<td>not recognized</td>";
             break;
         }
+        table += "<td>" + String(record.command.rssi) + "</td>";                                                           // rssi at sync
+        table += "<td>" + String(record.command.timing) + " / " + String(record.command.max_timing) + " us</td>";           // average / max deviation
+        table += "<td>" + String(record.command.repaired) + "</td>";                                                       // bytes from second copy
         table += "</tr>";
-        index < HISTORY_BUFFER_SIZE ? index++ : index = 0;
-    } while (index != ende);
+    }
     return table + "</table>";
 }
@@ -0,0 +1,345 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: historylog.cpp
+ *
+ * Command history in flash that survives reboots and power cuts.
+ *
+ * Records are appended to the "history" partition, a sector at a time. For
+ * every sector a small index entry is kept in RAM: the time range of its
+ * records and a bit filter of the sender ids it contains. A query only reads
+ * the sectors whose time range and sender filter match.
+ *
+ * Erasing a sector takes about 45 ms with the flash cache disabled, on both
+ * cores no code outside of IRAM runs meanwhile and the receiver interrupts
+ * are not serviced. So the sector after the head is erased in advance while
+ * the receivers are quiet (prepareHistoryLog()), only if the head sector gets
+ * full before that, e.g. with a noisy receiver, it is erased on append.
+ *
+ * The log is written by the network task and queried by the web server. The
+ * index and the flash are protected by a mutex, a query takes it for every
+ * chunk it reads, so it never reads a sector while it is erased.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <esp32/rom/crc.h>
+#include <historylog.h>
+
+#define EMPTY 0xffffffff                                                    // erased flash
+#define RECORDS_PER_SECTOR (HISTORY_LOG_SECTOR_SIZE / HISTORY_LOG_RECORD_SIZE) // 128 records
+#define READ_CHUNK 16                                                       // records read at once
+
+// one command in flash
+typedef struct
+{
+  uint32_t sequence; // running record number, EMPTY if slot not written yet
+  uint32_t time;     // seconds since epoch, 0 if unknown
+  uint8_t type;
+  uint8_t id1;
+  uint8_t id2;
+  uint8_t id3;
+  uint8_t counter;
+  uint8_t group;
+  uint8_t member;
+  uint8_t action;
+  uint8_t reserved[12]; // 0xff, for later use
+  uint32_t crc;         // crc32 of all bytes before
+} log_record_t;
+
+static_assert(sizeof(log_record_t) == HISTORY_LOG_RECORD_SIZE, "history log record size");
+
+// index entry of one sector
+typedef struct
+{
+  uint32_t first_sequence; // first record in sector, EMPTY if sector is empty
+  uint16_t used;           // written record slots
+  uint32_t time_min;       // time range of records in sector
+  uint32_t time_max;       //
+  uint64_t senders;        // bit filter of sender ids in sector
+} log_sector_t;
+
+const esp_partition_t *log_partition = NULL;
+log_sector_t log_index[HISTORY_LOG_MAX_SECTORS];
+unsigned int log_sectors = 0;       // sectors used for log
+unsigned int head_sector = 0;       // sector to write next record to
+uint32_t next_sequence = 0;         // number of next record
+bool next_erased = false;           // sector after head_sector erased in advance
+unsigned long forced_erases = 0;    // erases on append, receivers not quiet before
+SemaphoreHandle_t log_mutex = NULL; // protects log_index and flash
+
+/**********************************************************************************
+ *
+ * Helpers
+ *
+ **********************************************************************************/
+
+uint32_t senderId(uint8_t id1, uint8_t id2, uint8_t id3)
+{
+  return ((uint32_t)id1 << 16) | ((uint32_t)id2 << 8) | id3;
+}
+
+// two bits per sender id, a sector may contain a sender if both are set
+uint64_t senderBits(uint32_t sender)
+{
+  uint32_t hash = sender * 2654435761u;
+  return (1ULL << (hash >> 26)) | (1ULL << ((hash >> 20) & 63));
+}
+
+uint32_t recordCrc(const log_record_t *record)
+{
+  return crc32_le(0, (const uint8_t *)record, offsetof(log_record_t, crc));
+}
+
+void clearSector(log_sector_t *sector)
+{
+  sector->first_sequence = EMPTY;
+  sector->used = 0;
+  sector->time_min = EMPTY;
+  sector->time_max = 0;
+  sector->senders = 0;
+}
+
+void addToSector(log_sector_t *sector, const log_record_t *record)
+{
+  if (sector->first_sequence == EMPTY)
+  {
+    sector->first_sequence = record->sequence;
+  }
+  sector->time_min = min(sector->time_min, record->time);
+  sector->time_max = max(sector->time_max, record->time);
+  sector->senders |= senderBits(senderId(record->id1, record->id2, record->id3));
+}
+
+/**********************************************************************************
+ *
+ * Open history log partition and rebuild the in memory index
+ *
+ **********************************************************************************/
+
+void HistoryLogInit()
+{
+  log_mutex = xSemaphoreCreateMutex();
+  log_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, HISTORY_LOG_PARTITION);
+  if (log_partition == NULL)
+  {
+    Serial.println("History log partition not found.");
+    return;
+  }
+  log_sectors = min(log_partition->size / HISTORY_LOG_SECTOR_SIZE, (uint32_t)HISTORY_LOG_MAX_SECTORS);
+
+  // scan all sectors, the head is the sector with the newest first record
+  log_record_t chunk[READ_CHUNK];
+  uint32_t newest = 0;
+  bool found = false;   // valid record found
+  bool written = false; // any slot not erased
+  for (unsigned int s = 0; s < log_sectors; s++)
+  {
+    log_sector_t *sector = &log_index[s];
+    clearSector(sector);
+    bool end = false;
+    for (unsigned int r = 0; r < RECORDS_PER_SECTOR && !end; r += READ_CHUNK)
+    {
+      esp_partition_read(log_partition, s * HISTORY_LOG_SECTOR_SIZE + r * HISTORY_LOG_RECORD_SIZE, chunk, sizeof(chunk));
+      for (unsigned int i = 0; i < READ_CHUNK; i++)
+      {
+        if (chunk[i].sequence == EMPTY)
+        {
+          end = true; // rest of sector is erased
+          break;
+        }
+        sector->used++; // a slot with a torn record is used, but not indexed
+        written = true;
+        if (chunk[i].crc == recordCrc(&chunk[i]))
+        {
+          addToSector(sector, &chunk[i]);
+          if (!found || chunk[i].sequence >= next_sequence)
+          {
+            next_sequence = chunk[i].sequence + 1;
+          }
+        }
+      }
+    }
+    if (sector->first_sequence != EMPTY && (!found || sector->first_sequence > newest))
+    {
+      newest = sector->first_sequence;
+      head_sector = s;
+      found = true;
+    }
+  }
+  // a fresh partition may contain data of another file system, start with an empty log
+  if (!found && written)
+  {
+    Serial.println("History log: formatting partition...");
+    esp_partition_erase_range(log_partition, 0, log_sectors * HISTORY_LOG_SECTOR_SIZE);
+    for (unsigned int s = 0; s < log_sectors; s++)
+    {
+      clearSector(&log_index[s]);
+    }
+  }
+  next_erased = log_index[(head_sector + 1) % log_sectors].used == 0; // slots are written in order
+  Serial.println("History log: " + String(log_sectors) + " sectors, next record " + String(next_sequence));
+}
+
+/**********************************************************************************
+ *
+ * Erase the sector after the head, its records are dropped from the index
+ * first, so a query never reads it half erased
+ *
+ **********************************************************************************/
+
+void eraseNextSector()
+{
+  unsigned int sector = (head_sector + 1) % log_sectors;
+  xSemaphoreTake(log_mutex, portMAX_DELAY);
+  clearSector(&log_index[sector]);
+  esp_partition_erase_range(log_partition, sector * HISTORY_LOG_SECTOR_SIZE, HISTORY_LOG_SECTOR_SIZE);
+  next_erased = true;
+  xSemaphoreGive(log_mutex);
+}
+
+void prepareHistoryLog()
+{
+  if (log_partition != NULL && !next_erased)
+  {
+    eraseNextSector();
+  }
+}
+
+/**********************************************************************************
+ *
+ * Append command to log, continue in the next sector if the head sector is
+ * full, it is erased now if that was not done in advance
+ *
+ **********************************************************************************/
+
+void appendHistoryLog(const command_t &command, uint32_t time)
+{
+  if (log_partition == NULL)
+  {
+    return;
+  }
+
+  if (log_index[head_sector].used == RECORDS_PER_SECTOR)
+  {
+    if (!next_erased)
+    {
+      forced_erases++;
+      Serial.println("History log: sector erased on append (" + String(forced_erases) + " times), receivers were not quiet");
+      eraseNextSector();
+    }
+    xSemaphoreTake(log_mutex, portMAX_DELAY);
+    head_sector = (head_sector + 1) % log_sectors;
+    next_erased = false;
+    xSemaphoreGive(log_mutex);
+  }
+
+  log_record_t record;
+  memset(&record, 0xff, sizeof(record));
+  record.sequence = next_sequence++;
+  record.time = time;
+  record.type = command.type;
+  record.id1 = command.id1;
+  record.id2 = command.id2;
+  record.id3 = command.id3;
+  record.counter = command.counter;
+  record.group = command.group;
+  record.member = command.member;
+  record.action = command.action;
+  record.crc = recordCrc(&record);
+
+  log_sector_t *sector = &log_index[head_sector];
+  xSemaphoreTake(log_mutex, portMAX_DELAY);
+  esp_partition_write(log_partition, head_sector * HISTORY_LOG_SECTOR_SIZE + sector->used * HISTORY_LOG_RECORD_SIZE, &record, sizeof(record));
+  sector->used++;
+  addToSector(sector, &record);
+  xSemaphoreGive(log_mutex);
+}
+
+/**********************************************************************************
+ *
+ * Find newest commands of a sender (or HISTORY_LOG_ANY_SENDER) in time range
+ * [from..to] and create JSON string
+ *
+ **********************************************************************************/
+
+String queryHistoryLog(long sender, uint32_t from, uint32_t to, unsigned int limit)
+{
+  if (log_partition == NULL)
+  {
+    return "[]";
+  }
+  limit = min(limit, (unsigned int)HISTORY_LOG_MAX_LIMIT);
+
+  // select matching sectors from newest to oldest
+  uint16_t candidates[HISTORY_LOG_MAX_SECTORS];
+  uint16_t used[HISTORY_LOG_MAX_SECTORS];
+  uint32_t first_sequences[HISTORY_LOG_MAX_SECTORS]; // changes if the sector is erased meanwhile
+  unsigned int count = 0;
+  uint64_t bits = sender == HISTORY_LOG_ANY_SENDER ? 0 : senderBits(sender);
+
+  xSemaphoreTake(log_mutex, portMAX_DELAY);
+  for (unsigned int i = 0; i < log_sectors; i++)
+  {
+    unsigned int s = (head_sector + log_sectors - i) % log_sectors;
+    log_sector_t *sector = &log_index[s];
+    if (sector->first_sequence != EMPTY && sector->time_max >= from && sector->time_min <= to &&
+        (sector->senders & bits) == bits)
+    {
+      candidates[count] = s;
+      used[count] = sector->used;
+      first_sequences[count] = sector->first_sequence;
+      count++;
+    }
+  }
+  xSemaphoreGive(log_mutex);
+
+  // read candidate sectors backwards in chunks
+  String result = "[";
+  unsigned int found = 0;
+  bool full = false; // no memory left for the result
+  log_record_t chunk[READ_CHUNK];
+  char line[160];
+
+  for (unsigned int c = 0; c < count && found < limit && !full; c++)
+  {
+    int r = used[c];
+    while (r > 0 && found < limit && !full)
+    {
+      int first = max(r - READ_CHUNK, 0);
+      xSemaphoreTake(log_mutex, portMAX_DELAY);
+      bool valid = log_index[candidates[c]].first_sequence == first_sequences[c];
+      if (valid)
+      {
+        esp_partition_read(log_partition, candidates[c] * HISTORY_LOG_SECTOR_SIZE + first * HISTORY_LOG_RECORD_SIZE, chunk, (r - first) * HISTORY_LOG_RECORD_SIZE);
+      }
+      xSemaphoreGive(log_mutex);
+      if (!valid)
+      {
+        break; // sector erased meanwhile
+      }
+      for (int i = r - first - 1; i >= 0 && found < limit && !full; i--)
+      {
+        log_record_t *record = &chunk[i];
+        if (record->crc != recordCrc(record) || record->time < from || record->time > to ||
+            (sender != HISTORY_LOG_ANY_SENDER && senderId(record->id1, record->id2, record->id3) != (uint32_t)sender))
+        {
+          continue;
+        }
+        snprintf(line, sizeof(line), "%s{\"Time\":%u,\"Type\":%u,\"Id\":\"%02x%02x%02x\",\"Counter\":%u,\"Group\":%u,\"Member\":%u,\"Action\":%u}",
+                 found == 0 ? "" : ",", (unsigned int)record->time, record->type, record->id1, record->id2, record->id3,
+                 record->counter, record->group, record->member, record->action);
+        full = !result.concat(line);
+        found += !full;
+      }
+      r = first;
+    }
+  }
+  return result + "]";
+}
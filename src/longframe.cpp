@@ -0,0 +1,192 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: longframe.cpp
+ *
+ * Long frames of a central unit (clock, timer and astro programming). The
+ * Fernotron decoder decodes them word by word while they are received and
+ * keeps only the bytes (see protocol.cpp), here they are queued for the
+ * network task and published as JSON with one hex string per line.
+ *
+ * A central unit repeats a long frame, and with several receivers every
+ * receiver decodes it. Frames with the same sender, counter and line count
+ * within LONG_FRAME_REPEAT_TIME are repeats: the copy with the fewest bad
+ * lines is kept and queued by the network task when the time is over.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <header.h>
+#include <mqttconnection.h>
+#include <history.h>
+#include <longframe.h>
+
+QueueHandle_t long_frame_queue = NULL; // decode task => network task
+long_frame_t last_long_frame;          // best copy of the last frame
+unsigned long last_long_frame_time = 0;
+bool long_frame_pending = false;       // last_long_frame not queued yet
+portMUX_TYPE long_frame_mux = portMUX_INITIALIZER_UNLOCKED; // last frame, decode and network task
+
+/**********************************************************************************
+ *
+ * Create the queue for long frames
+ *
+ **********************************************************************************/
+
+void LongFrameInit()
+{
+  long_frame_queue = xQueueCreate(LONG_FRAME_QUEUE_LENGTH, sizeof(long_frame_t));
+}
+
+/**********************************************************************************
+ *
+ * Pass a decoded long frame to the network task
+ *
+ **********************************************************************************/
+
+void sendLongFrame(const long_frame_t &frame)
+{
+  if (xQueueSend(long_frame_queue, &frame, 0) != pdTRUE)
+  {
+    Serial.println("Long frame queue full, frame dropped.");
+  }
+}
+
+void queueLongFrame(const long_frame_t &frame)
+{
+  long_frame_t previous;
+  bool flush = false;
+
+  portENTER_CRITICAL(&long_frame_mux);
+  const command_t &a = frame.command;
+  const command_t &b = last_long_frame.command;
+  if (millis() - last_long_frame_time < LONG_FRAME_REPEAT_TIME && a.id1 == b.id1 && a.id2 == b.id2 && a.id3 == b.id3 &&
+      a.counter == b.counter && frame.lines == last_long_frame.lines)
+  {
+    if (__builtin_popcount(frame.bad_lines) < __builtin_popcount(last_long_frame.bad_lines))
+    {
+      last_long_frame = frame; // better copy, queued instead of the first one
+    }
+    portEXIT_CRITICAL(&long_frame_mux);
+    return;
+  }
+  if (long_frame_pending)
+  {
+    previous = last_long_frame; // another frame before the network task queued it
+    flush = true;
+  }
+  last_long_frame = frame;
+  last_long_frame_time = millis();
+  long_frame_pending = true;
+  portEXIT_CRITICAL(&long_frame_mux);
+
+  if (flush)
+  {
+    sendLongFrame(previous);
+  }
+}
+
+/**********************************************************************************
+ *
+ * Queue the best copy of the last frame when its repeats are over (network task)
+ *
+ **********************************************************************************/
+
+void flushLongFrame()
+{
+  long_frame_t frame;
+  bool flush = false;
+
+  portENTER_CRITICAL(&long_frame_mux);
+  if (long_frame_pending && millis() - last_long_frame_time >= LONG_FRAME_REPEAT_TIME)
+  {
+    frame = last_long_frame;
+    long_frame_pending = false;
+    flush = true;
+  }
+  portEXIT_CRITICAL(&long_frame_mux);
+
+  if (flush)
+  {
+    sendLongFrame(frame);
+  }
+}
+
+/**********************************************************************************
+ *
+ * Long frame as JSON string
+ *
+ **********************************************************************************/
+
+String hexLine(const uint8_t *data)
+{
+  char text[2 * LONG_FRAME_LINE_BYTES + 1];
+  for (int i = 0; i < LONG_FRAME_LINE_BYTES; i++)
+  {
+    snprintf(text + 2 * i, 3, "%02x", data[i]);
+  }
+  return "\"" + String(text) + "\"";
+}
+
+String hexLines(const long_frame_t &frame, uint8_t first, uint8_t end)
+{
+  String lines = "[";
+  for (uint8_t i = first; i < end && i < frame.lines; i++)
+  {
+    lines += String(i == first ? "" : ",") + hexLine(frame.data[i]);
+  }
+  return lines + "]";
+}
+
+String longFrameJson(const long_frame_t &frame)
+{
+  char id[7];
+  char time[24];
+  snprintf(id, sizeof(id), "%02x%02x%02x", frame.command.id1, frame.command.id2, frame.command.id3);
+  snprintf(time, sizeof(time), "%lld", (long long)captureTime(frame.command));
+  String json = "{\"Id\":\"" + String(id) + "\",\"Group\":" + String(frame.command.group) + ",\"Member\":" +
+                String(frame.command.member) + ",\"Action\":" + String(frame.command.action) + ",\"Counter\":" +
+                String(frame.command.counter) + ",\"Lines\":" + String(frame.lines) + ",\"BadLines\":" +
+                String(__builtin_popcount(frame.bad_lines)) + ",\"Time\":" + time;
+  if (frame.lines > 0)
+  {
+    json += ",\"Clock\":" + hexLine(frame.data[0]);
+  }
+  if (frame.lines > LONG_FRAME_TIMER_LINE)
+  {
+    json += ",\"Timer\":" + hexLines(frame, LONG_FRAME_TIMER_LINE, LONG_FRAME_ASTRO_LINE);
+  }
+  if (frame.lines > LONG_FRAME_ASTRO_LINE)
+  {
+    json += ",\"Astro\":" + hexLines(frame, LONG_FRAME_ASTRO_LINE, LONG_FRAME_FLAG_LINE);
+  }
+  if (frame.lines > LONG_FRAME_FLAG_LINE)
+  {
+    json += ",\"Flags\":" + hexLine(frame.data[LONG_FRAME_FLAG_LINE]);
+  }
+  return json + "}";
+}
+
+/**********************************************************************************
+ *
+ * Publish queued long frames (network task)
+ *
+ **********************************************************************************/
+
+void publishLongFrames()
+{
+  flushLongFrame();
+  long_frame_t frame;
+  while (xQueueReceive(long_frame_queue, &frame, 0) == pdTRUE)
+  {
+    char id[7];
+    snprintf(id, sizeof(id), "%02x%02x%02x", frame.command.id1, frame.command.id2, frame.command.id3);
+    publishMQTT(String(MQTT_CLIENT_ID) + "/CentralUnit/ID_" + String(id) + LONG_FRAME_TOPIC, longFrameJson(frame));
+    Serial.println("Published long frame of 0x" + String(id) + " with " + String(frame.lines) + " lines");
+  }
+}
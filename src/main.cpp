@@ -33,7 +33,7 @@
  *            C1101     ESP32
  *     GND      1        GND
  *     VCC      2        3.3
- *     GDO0     3         2
+ *     GDO0     3         4
  *     CSN      4         5
  *     SCK      5        18
  *     MOSI     6        23
@@ -48,7 +48,7 @@
  *
  **********************************************************************************/
 
-#define CCGDO0 2
+#define CCGDO0 TRANSMIT
 #define CCGDO2 RECEIVE
 
 /**********************************************************************************
@@ -59,6 +59,9 @@
 #include <Arduino.h>
 #include <string>
 #include <WiFi.h>
+#include <esp_netif.h>
+#include <esp_netif_net_stack.h>
+#include <lwip/dhcp.h>
 #include <ELECHOUSE_CC1101_SRC_DRV.h>
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
@@ -70,6 +73,24 @@
 #include <f2sUtils.h>
 #include <protocol.h>
 #include <history.h>
+#include <historylog.h>
+#include <stats.h>
+#include <coalesce.h>
+#include <coordination.h>
+#include <receiver.h>
+#include <decoder.h>
+#include <merge.h>
+#include <mqttmessage.h>
+#include <tasks.h>
+#include <transmit.h>
+#include <rules.h>
+#include <heapmon.h>
+#include <longframe.h>
+#include <noise.h>
+#include <allowlist.h>
+#include <watchdog.h>
+#include <devicestate.h>
+#include <exporter.h>
 
 /**********************************************************************************
  *
@@ -94,13 +115,9 @@ String mqttPassword = MQTT_PASSWORD;
  * Shared variables
  *
  **********************************************************************************/
-volatile unsigned long ring_buffer[RING_BUFFER_SIZE]; // buffer to store timings and signal level
-volatile unsigned int ring_index = 0;                 // pointer in ring buffer
-volatile long pervious_time = 0;                      // previous interrupt time
-volatile unsigned int sync_start_index = 0;           // pointer to first sync block
-volatile unsigned int sync_block_count = 0;           // number of sync blocks found (1 - 10)
-volatile unsigned int sync_last_block_index = 0;      // pointer to start of last found block
-volatile uint8_t command_found = 0;                   // command detected
+TaskHandle_t decode_task_handle = NULL;  // woken by receiver interrupt
+TaskHandle_t network_task_handle = NULL; // publishes commands from command queue
+TaskHandle_t transmit_task_handle = NULL; // sends commands from COMMAND_TOPIC
 
 /**********************************************************************************
  *
@@ -108,6 +125,26 @@ volatile uint8_t command_found = 0;                   // command detected
  *
  **********************************************************************************/
 
+#define MARCSTATE_RX 0x0d     // CC1101 main state machine in RX
+#define MARCSTATE_RX_RST 0x0f // last of the RX states
+
+bool cc1101_error = false;          // shown by network task, do not delay the receiver
+SemaphoreHandle_t radio_mutex = NULL; // CC1101 SPI access by decode, network and transmit task
+volatile bool radio_transmitting = false;
+uint8_t radio_config = 0;           // PKTCTRL0 after init, reset to its default by a brownout
+
+void configureRadio()
+{
+  ELECHOUSE_cc1101.Init();
+  ELECHOUSE_cc1101.setGDO(CCGDO0, CCGDO2); // Wiring
+  ELECHOUSE_cc1101.setMHZ(433.92);         // Frequency
+  ELECHOUSE_cc1101.setModulation(2);       // 2 = ASK/OOK Modulation
+  ELECHOUSE_cc1101.setRxBW(420.50);        // Adjust Bandwidth
+  ELECHOUSE_cc1101.setPktFormat(3);        // 3 = Asynchronous serial mode
+  ELECHOUSE_cc1101.SetRx();                // Enable receive
+  radio_config = ELECHOUSE_cc1101.SpiReadReg(CC1101_PKTCTRL0);
+}
+
 void CCInit()
 {
 
@@ -118,15 +155,82 @@ void CCInit()
   else
   {
     Serial.println("C1101 Connection Error");
-    showError(C1101_SPI_ERROR);
+    cc1101_error = true;
   }
-  ELECHOUSE_cc1101.Init();
-  ELECHOUSE_cc1101.setGDO(CCGDO0, CCGDO2); // Wiring
-  ELECHOUSE_cc1101.setMHZ(433.92);         // Frequency
-  ELECHOUSE_cc1101.setModulation(2);       // 2 = ASK/OOK Modulation
-  ELECHOUSE_cc1101.setRxBW(420.50);        // Adjust Bandwidth
-  ELECHOUSE_cc1101.setPktFormat(3);        // 3 = Asynchronous serial mode
-  ELECHOUSE_cc1101.SetRx();                // Enable receive
+  configureRadio();
+  radio_mutex = xSemaphoreCreateMutex();
+}
+
+// watchdog: state registers of the CC1101, not while transmitting
+uint8_t checkRadio()
+{
+  uint8_t fault = WATCHDOG_OK;
+  if (radio_transmitting || xSemaphoreTake(radio_mutex, 0) != pdTRUE)
+  {
+    return fault; // checked next time
+  }
+  if (!ELECHOUSE_cc1101.getCC1101())
+  {
+    fault = WATCHDOG_RADIO_SPI;
+  }
+  else if (ELECHOUSE_cc1101.SpiReadReg(CC1101_PKTCTRL0) != radio_config)
+  {
+    fault = WATCHDOG_RADIO_RESET;
+  }
+  else
+  {
+    uint8_t state = ELECHOUSE_cc1101.SpiReadStatus(CC1101_MARCSTATE) & 0x1f;
+    if (state < MARCSTATE_RX || state > MARCSTATE_RX_RST)
+    {
+      fault = WATCHDOG_RADIO_IDLE;
+    }
+  }
+  xSemaphoreGive(radio_mutex);
+  return fault;
+}
+
+void recoverRadio(bool reset)
+{
+  xSemaphoreTake(radio_mutex, portMAX_DELAY);
+  if (!radio_transmitting) // back in RX after the transmission anyway
+  {
+    if (reset)
+    {
+      configureRadio();
+    }
+    else
+    {
+      ELECHOUSE_cc1101.SetRx();
+    }
+  }
+  xSemaphoreGive(radio_mutex);
+}
+
+int receiverRssi(uint8_t receiver)
+{
+  // only the CC1101 at the first receiver pin measures rssi, never wait for the transmitter
+  int rssi = RSSI_UNKNOWN;
+  if (receiver == 0 && !radio_transmitting && xSemaphoreTake(radio_mutex, 0) == pdTRUE)
+  {
+    rssi = ELECHOUSE_cc1101.getRssi();
+    xSemaphoreGive(radio_mutex);
+  }
+  return rssi;
+}
+
+void setRadioTransmit(bool transmit)
+{
+  xSemaphoreTake(radio_mutex, portMAX_DELAY);
+  if (transmit)
+  {
+    ELECHOUSE_cc1101.SetTx(); // data from GDO0
+  }
+  else
+  {
+    ELECHOUSE_cc1101.SetRx();
+  }
+  radio_transmitting = transmit;
+  xSemaphoreGive(radio_mutex);
 }
 
 /**********************************************************************************
@@ -135,34 +239,72 @@ void CCInit()
  *
  **********************************************************************************/
 
+// driver access of the reconnect manager (network task)
+void beginWifi(const uint8_t *bssid, int32_t channel)
+{
+  WiFi.begin(ssid.c_str(), password.c_str(), channel, bssid);
+}
+
+void configureWifi(const uint32_t *lease)
+{
+  if (lease == NULL)
+  {
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0)); // DHCP, clears a reused address until the lease is renewed
+  }
+  else
+  {
+    WiFi.config(IPAddress(lease[0]), IPAddress(lease[1]), IPAddress(lease[2]), IPAddress(lease[3]));
+  }
+}
+
+void disconnectWifi()
+{
+  WiFi.disconnect();
+}
+
+const wifi_hal_t esp_wifi_hal = {beginWifi, configureWifi, disconnectWifi};
+
 void WiFiStationConnected(WiFiEvent_t event, WiFiEventInfo_t info)
 {
-  Serial.println("WiFi Connection OK");
+  Serial.println("WiFi Connection OK, channel " + String(info.wifi_sta_connected.channel));
+  wifiAssociated(info.wifi_sta_connected.bssid, info.wifi_sta_connected.channel, millis());
+}
+
+// lease time the DHCP server gave the station in s, 0 for a static address
+uint32_t dhcpLeaseTime()
+{
+  esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+  struct netif *lwip_netif = netif == NULL ? NULL : (struct netif *)esp_netif_get_netif_impl(netif);
+  struct dhcp *dhcp = lwip_netif == NULL ? NULL : netif_dhcp_data(lwip_netif);
+  return dhcp == NULL || dhcp->state != DHCP_STATE_BOUND ? 0 : dhcp->offered_t0_lease;
 }
 
 void WiFiGotIP(WiFiEvent_t event, WiFiEventInfo_t info)
 {
+  uint32_t lease[4] = {WiFi.localIP(), WiFi.gatewayIP(), WiFi.subnetMask(), WiFi.dnsIP()};
+  wifiGotIp(lease, dhcpLeaseTime(), millis());
   Serial.print("IP address: ");
   Serial.println(WiFi.localIP());
+  recordBootTime(BOOT_WIFI);
+  TimeInit();
 }
 
 void WiFiStationDisconnected(WiFiEvent_t event, WiFiEventInfo_t info)
 {
-  Serial.println("Disconnected from WiFi");
+  wifiDisconnected(info.wifi_sta_disconnected.reason, millis()); // the network task reconnects
   Serial.print("WiFi lost connection. Reason: ");
   Serial.println(info.wifi_sta_disconnected.reason);
-  Serial.println("Trying to Reconnect...");
-  WiFi.begin(ssid, password);
 }
 
 void WifiInit()
 {
-  WiFi.disconnect(true);
-  delay(1000);
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(false); // reconnects are made by the reconnect manager
+  WiFi.mode(WIFI_STA);
   WiFi.onEvent(WiFiStationConnected, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_CONNECTED);
   WiFi.onEvent(WiFiGotIP, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_GOT_IP);
   WiFi.onEvent(WiFiStationDisconnected, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
-  WiFi.begin(ssid, password);
+  WifiManagerInit(&esp_wifi_hal, millis());
   Serial.println("Wait for WiFi...");
 }
 
@@ -174,25 +316,46 @@ void WifiInit()
 
 WiFiClient fernotronClient;
 PubSubClient client(fernotronClient);
+unsigned long mqtt_attempt = 0; // time of last connection attempt
+bool mqtt_attempted = false;
 
-void connectMQTT()
+bool connectMQTT()
 {
-  // Loop until we're reconnected
-  while (!client.connected())
+  // one attempt every MQTT_RETRY_INTERVAL ms, the network task must not block
+  if (client.connected())
+  {
+    return true;
+  }
+  if (WiFi.status() != WL_CONNECTED || (mqtt_attempted && millis() - mqtt_attempt < MQTT_RETRY_INTERVAL))
+  {
+    return false;
+  }
+  mqtt_attempted = true;
+  mqtt_attempt = millis();
+
+  Serial.print("Attempting MQTT connection...");
+  if (client.connect(clientId.c_str(), mqttUser.c_str(), mqttPassword.c_str()))
   {
-    Serial.print("Attempting MQTT connection...");
-    if (client.connect(clientId.c_str(), mqttUser.c_str(), mqttPassword.c_str()))
+    Serial.println("connected");
+    recordBootTime(BOOT_MQTT);
+    if (GATEWAY_COORDINATION)
     {
-      Serial.println("connected");
+      client.subscribe(COORDINATION_TOPIC);
     }
-    else
+    if (TRANSMIT_COMMANDS)
+    {
+      client.subscribe(COMMAND_TOPIC "#");
+    }
+    if (PUBLISH_STATE_TOPICS)
     {
-      Serial.print("failed, rc=");
-      Serial.print(client.state());
-      Serial.println(" try again in 2 seconds");
-      delay(2000);
+      requestStateSnapshot(); // the broker may have lost the retained states
     }
+    return true;
   }
+  Serial.print("failed, rc=");
+  Serial.print(client.state());
+  Serial.println(" try again in " + String(MQTT_RETRY_INTERVAL / 1000) + " seconds");
+  return false;
 }
 
 void publishMQTT(String topic, String payload)
@@ -205,10 +368,48 @@ void publishMQTT(String topic, String payload)
   client.publish(topic.c_str(), payload.c_str());
 }
 
+void publishMQTTBinary(const char *topic, const uint8_t *payload, unsigned int length)
+{
+  if (!client.connected())
+  {
+    connectMQTT();
+  }
+  client.publish(topic, payload, length);
+}
+
+void publishMQTTRetained(const char *topic, const String &payload)
+{
+  if (!client.connected())
+  {
+    connectMQTT();
+  }
+  client.publish(topic, payload.c_str(), true);
+}
+
+void receiveMQTT(char *topic, uint8_t *payload, unsigned int length)
+{
+  if (strcmp(topic, COORDINATION_TOPIC) == 0)
+  {
+    receiveAnnouncement((const char *)payload, length);
+  }
+  else if (TRANSMIT_COMMANDS && strncmp(topic, COMMAND_TOPIC, strlen(COMMAND_TOPIC)) == 0)
+  {
+    receiveTransmitCommand(topic);
+  }
+}
+
 void MQTTInit()
 {
+  if (GATEWAY_COORDINATION)
+  {
+    // every gateway needs its own client id at the broker
+    uint32_t gateway = (uint32_t)(ESP.getEfuseMac() >> 24) & 0xffffff;
+    CoordinationInit(gateway);
+    clientId = clientId + "-" + String(gateway, HEX);
+  }
   client.setServer(mqttServer.c_str(), MQTT_PORT);
-  connectMQTT();
+  client.setCallback(receiveMQTT);
+  client.setBufferSize(MQTT_BUFFER_SIZE);
 }
 
 /**********************************************************************************
@@ -221,127 +422,303 @@ AsyncWebServer server(80);
 
 #include <index_html.h>
 
+#define PAGE_MAX_AGE 3600 // s the browser keeps the page before it asks again with the ETag
+
 void notFound(AsyncWebServerRequest *request)
 {
   request->send(404, "text/plain", "Oops...");
 }
 
-String processor(const String &var)
+// static page, gzip compressed at build time, data comes from /api/status and /api/table
+void sendPage(AsyncWebServerRequest *request)
 {
-  if (var == "TABLE")
-    return readHistory();
-  if (var == "WIFIRSSI")
-    return String(WiFi.RSSI());
-  if (var == "C1101RSSI")
-    return String(ELECHOUSE_cc1101.getRssi());
-  return String();
+  if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == INDEX_HTML_ETAG)
+  {
+    request->send(304);
+    return;
+  }
+  AsyncWebServerResponse *response = request->beginResponse_P(200, "text/html", index_html_gz, index_html_gz_length);
+  response->addHeader("Content-Encoding", "gzip");
+  response->addHeader("Cache-Control", "max-age=" + String(PAGE_MAX_AGE));
+  response->addHeader("ETag", INDEX_HTML_ETAG);
+  request->send(response);
 }
 
 void WebServerInit()
 {
   // Route for root page
-  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
-            { request->send_P(200, "text/html", index_html, processor); });
+  server.on("/", HTTP_GET, sendPage);
+
+  // Routes for the data of the page
+  server.on("/api/status", HTTP_GET, [](AsyncWebServerRequest *request)
+            { request->send(200, "application/json", "{\"WifiRssi\":" + String(WiFi.RSSI()) + ",\"RadioRssi\":" + String(receiverRssi(0)) + "}"); });
+  server.on("/api/table", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              heap_mark_t mark = heapMark();
+              String table = readHistory();
+              heapStage(HEAP_PAGE, mark);
+              request->send(200, "text/html", table); });
+
+  // Route for history log query, e.g. /api/history?sender=8020df&from=1733000000&to=1734000000
+  server.on("/api/history", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              long sender = HISTORY_LOG_ANY_SENDER;
+              uint32_t from = 0;
+              uint32_t to = UINT32_MAX;
+              unsigned int limit = HISTORY_LOG_QUERY_LIMIT;
+              if (request->hasParam("sender"))
+                sender = strtol(request->getParam("sender")->value().c_str(), NULL, 16);
+              if (request->hasParam("from"))
+                from = strtoul(request->getParam("from")->value().c_str(), NULL, 10);
+              if (request->hasParam("to"))
+                to = strtoul(request->getParam("to")->value().c_str(), NULL, 10);
+              if (request->hasParam("limit"))
+                limit = strtoul(request->getParam("limit")->value().c_str(), NULL, 10);
+              request->send(200, "application/json", queryHistoryLog(sender, from, to, limit)); });
+
+  // Route for sender statistics
+  server.on("/api/stats", HTTP_GET, [](AsyncWebServerRequest *request)
+            { request->send(200, "application/json", statsReport()); });
+
+  // Route for decoder report
+  server.on("/api/decoders", HTTP_GET, [](AsyncWebServerRequest *request)
+            { request->send(200, "application/json", "{\"Merged\":" + String(mergedCommands()) + ",\"Receivers\":" + receiverReport() + "}"); });
+
+  // Route for rules, POST with form field "rules" replaces them
+  server.on("/api/rules", HTTP_GET, [](AsyncWebServerRequest *request)
+            { request->send(200, "text/plain", readRules()); });
+  server.on("/api/rules", HTTP_POST, [](AsyncWebServerRequest *request)
+            {
+              if (!request->hasParam("rules", true))
+              {
+                request->send(400, "text/plain", "missing rules");
+                return;
+              }
+              String errors = storeRules(request->getParam("rules", true)->value());
+              request->send(errors == "" ? 200 : 400, "text/plain", errors == "" ? String("ok") : errors);
+            });
+
+  // Route for sender allowlist, POST with form field "senders" replaces it, with "learn" (minutes) starts learning
+  server.on("/api/senders", HTTP_GET, [](AsyncWebServerRequest *request)
+            { request->send(200, "application/json", sendersReport()); });
+  server.on("/api/senders", HTTP_POST, [](AsyncWebServerRequest *request)
+            {
+              if (request->hasParam("learn", true))
+              {
+                String minutes = request->getParam("learn", true)->value();
+                learnSenders(minutes == "" ? LEARN_MINUTES : strtoul(minutes.c_str(), NULL, 10));
+                request->send(200, "text/plain", "ok");
+                return;
+              }
+              if (!request->hasParam("senders", true))
+              {
+                request->send(400, "text/plain", "missing senders or learn");
+                return;
+              }
+              String errors = storeSenders(request->getParam("senders", true)->value());
+              request->send(errors == "" ? 200 : 400, "text/plain", errors == "" ? String("ok") : errors);
+            });
+
+  // Route for Wi-Fi reconnect telemetry
+  server.on("/api/wifi", HTTP_GET, [](AsyncWebServerRequest *request)
+            { request->send(200, "application/json", wifiReport(millis())); });
+
+  // Route for receiver watchdog
+  server.on("/api/watchdog", HTTP_GET, [](AsyncWebServerRequest *request)
+            { request->send(200, "application/json", watchdogReport()); });
+
+  // Route for time series export
+  server.on("/api/export", HTTP_GET, [](AsyncWebServerRequest *request)
+            { request->send(200, "application/json", exportReport()); });
+
+  // Route for noise monitor
+  server.on("/api/noise", HTTP_GET, [](AsyncWebServerRequest *request)
+            { request->send(200, "application/json", noiseReport()); });
+
+  // Route for heap monitor
+  server.on("/api/heap", HTTP_GET, [](AsyncWebServerRequest *request)
+            { request->send(200, "application/json", heapReport()); });
+
+  // Route for task report
+  server.on("/api/tasks", HTTP_GET, [](AsyncWebServerRequest *request)
+            { request->send(200, "application/json", taskReport()); });
 
   server.onNotFound(notFound);
 
   // Start server
   server.begin();
+  registerTask(WEB_TASK, "async_tcp", xTaskGetHandle("async_tcp"));
   Serial.println("Web-Server started.");
+  recordBootTime(BOOT_WEB);
 }
 
 /**********************************************************************************
  *
- * Handle interrups of 433 Mhz receiver module connected to pin RECEIVE
+ * Decode task: wait for edges from the receivers and decode them
  *
  **********************************************************************************/
 
-void IRAM_ATTR handleInterrupt()
+void decodeTask(void *parameter)
 {
-  // if currently not processing a command message
-  if (command_found != 1)
+  uint32_t edges[EDGE_BATCH];
+  unsigned long timeout = EDGE_POLL_INTERVAL;
+
+  for (int i = 0; i < RECEIVER_COUNT; i++)
   {
-    // timing
-    int64_t isr_time = esp_timer_get_time();
-    unsigned long current_duration = isr_time - pervious_time;
+    ReceiverInit(&receivers[i], xTaskGetCurrentTaskHandle());
+  }
+  recordBootTime(BOOT_ARMED);
 
-    // does duration make sense?
-    if (current_duration > glitch)
-    {
-      pervious_time = isr_time; // remember time for next interrupt
-    }
-    else
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout));
+    int64_t begin = esp_timer_get_time();
+    for (int i = 0; i < RECEIVER_COUNT; i++)
     {
-      // glitch removal
-      ring_index = previousIndex(ring_index);                             // go back to last signal
-      current_duration = ring_buffer[ring_index] / 10 + current_duration; // get last duration and add glitch
+      checkStorm(&receivers[i]);
+
+      // pass edges in batches to the decoders of the receiver
+      unsigned int count = 0;
+      bool quiet = true;
+      do
+      {
+        count = readEdges(&receivers[i], edges, EDGE_BATCH);
+        if (count > 0)
+        {
+          feedDecoders(&receivers[i].decoders, edges, count);
+          quiet = false;
+        }
+      } while (count == EDGE_BATCH);
+      if (quiet)
+      {
+        flushDecoders(&receivers[i].decoders); // no edge since the last round, no glitch follows the held periods
+      }
     }
+    noiseSample();
+    decodeTaskAlive();
+    timeout = flushMergedCommands(EDGE_POLL_INTERVAL);
+    addTaskBusyTime(DECODE_TASK, esp_timer_get_time() - begin);
+  }
+}
 
-    // signal level
-    u_int8_t direction = digitalRead(RECEIVE);
-    direction == HIGH ? direction = 0 : direction = 1;
+/**********************************************************************************
+ *
+ * Network task: bring up Wi-Fi, web server and MQTT, then publish queued
+ * commands and keep the MQTT connection alive. Rules, history, flash log and
+ * export get every command at once, while the broker is unreachable the
+ * commands wait in the hold for publishing.
+ *
+ **********************************************************************************/
 
-    // store data in buffer
-    ring_buffer[ring_index] = current_duration * 10 + direction; // Store current duration and signal level in buffer
+// publish a command, or let the gateway with the best reception publish it
+void forwardCommand(const command_t &command)
+{
+  if (GATEWAY_COORDINATION)
+  {
+    electCommand(command); // published later by the gateway with the best reception
+  }
+  else
+  {
+    sendMessage(command);
+  }
+}
+
+void networkTask(void *parameter)
+{
+  command_t command;
+  bool web_started = false;
+
+  if (cc1101_error)
+  {
+    showError(C1101_SPI_ERROR);
+  }
+  HistoryLogInit();
+  WifiInit();
+  MQTTInit();
+
+  for (;;)
+  {
+    wifiRun(millis());
+    runRuleActions(); // also without broker, webhooks and gpio pulses do not need it
+    storeLearnedSenders();
+    watchdogCheck();
+    runExport(); // commands reach the exporter without broker
+    if (receiversQuietTime() >= HISTORY_LOG_QUIET)
+    {
+      prepareHistoryLog(); // erase stops the receiver interrupts
+    }
+    if (!web_started && WiFi.status() == WL_CONNECTED)
+    {
+      WebServerInit();
+      web_started = true;
+    }
+    bool online = connectMQTT();
+    if (online)
+    {
+      publishLongFrames();
+      publishStates();
+      while (releaseCommand(&command))
+      {
+        forwardCommand(command); // held while the broker was unreachable
+      }
+    }
 
-    if (direction == 0)
-    { // now check for sync block | |________
-      if (inRange(block_min_duration, block_max_duration, current_duration))
+    unsigned long timeout = online && GATEWAY_COORDINATION ? electionTimeout(NETWORK_TASK_CYCLE) : NETWORK_TASK_CYCLE;
+    if (receiveCommand(&command, pdMS_TO_TICKS(timeout)))
+    {
+      int64_t begin = esp_timer_get_time();
+      if (TRANSMIT_COMMANDS)
+      {
+        updateTransmitCounter(command);
+      }
+      if (coalesceCommand(command))
       {
-        // low 8 symbols found, check previous signal
-        unsigned long previous_duration = ring_buffer[previousIndex(ring_index)] / 10;
-        if (inRange(symbol_length - tolerance, symbol_length + tolerance, previous_duration))
+        applyRules(command);
+        storeCommand(command); // history, flash log and export do not wait for the broker
+        command_t dropped;
+        if (online)
         {
-          // low 8 symbols found with 1 symbol high before => sync
-          sync_block_count++;
-          if (sync_block_count == 1) // first block found
-          {
-            sync_start_index = nextIndex(ring_index); // initialize sync info, points to first data bit (next interrupt, high level)
-            sync_last_block_index = nextIndex(ring_index);
-          }
-          else
-          {                                                            // a following block found        _
-            if (distance(sync_last_block_index, ring_index) == 20 + 1) // 20 level changes + 1 for sync | |________
-            {                                                          // distance as expected
-              sync_last_block_index = nextIndex(ring_index);           // points to first data bit of new block (next interrupt, high level)
-            }
-            else
-            {
-              init(); // wrong bit count => reinitialize and search again
-            }
-          }
+          forwardCommand(command);
+        }
+        else if (holdCommand(command, &dropped) && PUBLISH_STATE_TOPICS)
+        {
+          updateState(dropped, captureTime(dropped), false); // the state snapshot after the connect has it
         }
       }
+      addTaskBusyTime(NETWORK_TASK, esp_timer_get_time() - begin);
     }
-    else
-    { // a high level found
-      if (sync_block_count == 10 && distance(sync_last_block_index, ring_index) == 20)
-      {                    // 10 sync blocks plus 20 level changes => message complete (omit further blocks)
-        command_found = 1; // set flag for command processing and stop interrupt processing
-        detachInterrupt(digitalPinToInterrupt(RECEIVE));
+    if (online)
+    {
+      client.loop();
+      if (GATEWAY_COORDINATION)
+      {
+        runElection();
       }
     }
-    ring_index = nextIndex(ring_index);
   }
 }
 
 /**********************************************************************************
  *
- * Reinitialize ring buffer after an error or after command processing
+ * Transmit task: send commands received on COMMAND_TOPIC
  *
  **********************************************************************************/
 
-void init()
+void transmitTask(void *parameter)
 {
-  ring_index = 0;
-  sync_block_count = 0;
-  sync_start_index = 0;
-  sync_last_block_index = 0;
+  command_t command;
+  for (;;)
+  {
+    if (nextTransmitCommand(&command, portMAX_DELAY))
+    {
+      addTaskBusyTime(TRANSMIT_TASK, transmitCommand(command));
+    }
+  }
 }
 
 /**********************************************************************************
  *
- * Setup interrupt, CC1101, Wifi, MQTT broker, Webserver and ring buffer
+ * Setup: arm receivers first, network is started by the network task
  *
  **********************************************************************************/
 
@@ -352,35 +729,40 @@ void setup()
   pinMode(INFO_LED, OUTPUT);
   digitalWrite(INFO_LED, LOW); // LED off
 
-  pinMode(RECEIVE, INPUT_PULLDOWN);
-  if (digitalPinToInterrupt(RECEIVE) == NOT_AN_INTERRUPT)
+  CCInit();
+  for (int i = 0; i < RECEIVER_COUNT; i++)
   {
-    Serial.println("Wrong interrupt pin");
+    receivers[i].id = i;
+    receivers[i].pin = receiver_pins[i];
+    registerDecoder(&receivers[i].decoders, createFernotronDecoder(i));
   }
-  attachInterrupt(digitalPinToInterrupt(RECEIVE), handleInterrupt, CHANGE);
-  CCInit();
-  WifiInit();
-  MQTTInit();
-  WebServerInit();
-  init();
+  RulesInit();
+  AllowlistInit();
+  LongFrameInit();
+  createCommandQueue();
+  xTaskCreatePinnedToCore(decodeTask, "decode", DECODE_TASK_STACK, NULL, DECODE_TASK_PRIORITY, &decode_task_handle, DECODE_TASK_CORE);
+  xTaskCreatePinnedToCore(networkTask, "network", NETWORK_TASK_STACK, NULL, NETWORK_TASK_PRIORITY, &network_task_handle, NETWORK_TASK_CORE);
+  registerTask(DECODE_TASK, "decode", decode_task_handle);
+  registerTask(NETWORK_TASK, "network", network_task_handle);
+  if (TRANSMIT_COMMANDS)
+  {
+    TransmitInit();
+    xTaskCreatePinnedToCore(transmitTask, "transmit", TRANSMIT_TASK_STACK, NULL, TRANSMIT_TASK_PRIORITY, &transmit_task_handle, TRANSMIT_TASK_CORE);
+    registerTask(TRANSMIT_TASK, "transmit", transmit_task_handle);
+  }
+  registerTask(LOOP_TASK, "loop", xTaskGetCurrentTaskHandle());
 }
 
 /**********************************************************************************
  *
- * Main loop: wait for command and process data
+ * Main loop: all work is done in decode and network task, just report them
  *
  **********************************************************************************/
 
 void loop()
 {
-  if (command_found == 1)
-  {
-    digitalWrite(INFO_LED, HIGH); // LED on
-    // process data and publish
-    processReceivedData(duration2TriBit(ring_buffer, sync_start_index, (sync_last_block_index + 20) % RING_BUFFER_SIZE));
-    init();            // for next command
-    command_found = 0; // command processing finished => start new cycle
-    attachInterrupt(digitalPinToInterrupt(RECEIVE), handleInterrupt, CHANGE);
-    digitalWrite(INFO_LED, LOW); // LED off
-  }
+  vTaskDelay(pdMS_TO_TICKS(TASK_REPORT_INTERVAL * 1000));
+  Serial.println("Tasks: " + taskReport());
+  heapSample();
+  Serial.println("Heap: " + heapReport());
 }
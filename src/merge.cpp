@@ -0,0 +1,144 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: merge.cpp
+ *
+ * Merge stage between the decoders and the command queue. If several receiver
+ * modules decode the same frame, only the copy with the fewest damaged words
+ * (then the best rssi) is published. Runs in the decode task only.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <header.h>
+#include <tasks.h>
+#include <merge.h>
+
+// frame waiting for copies from other receivers
+typedef struct
+{
+  bool used;                // slot in use
+  command_t command;        // best copy so far
+  unsigned long decide_at;  // end of merge window (ms)
+} merge_slot_t;
+
+merge_slot_t merge_slots[MERGE_SLOTS];
+unsigned long merged = 0; // copies dropped
+
+int last_counter = -1; // last queued central unit command
+uint32_t last_id = 0;
+
+/**********************************************************************************
+ *
+ * Helpers
+ *
+ **********************************************************************************/
+
+// same frame: same sender, counter and command
+bool sameCommand(const command_t &a, const command_t &b)
+{
+  return a.id1 == b.id1 && a.id2 == b.id2 && a.id3 == b.id3 && a.counter == b.counter &&
+         a.group == b.group && a.member == b.member && a.action == b.action;
+}
+
+// fewer damaged words first, then stronger signal
+bool betterCopy(const command_t &a, const command_t &b)
+{
+  return a.errors < b.errors || (a.errors == b.errors && a.rssi > b.rssi);
+}
+
+// drop repeated frames of a central unit, queue the others
+void queueIfNew(const command_t &command)
+{
+  uint32_t id = ((uint32_t)command.id1 << 16) | ((uint32_t)command.id2 << 8) | command.id3;
+  if (command.type == 8 && last_counter == command.counter && last_id == id)
+  {
+    Serial.println("no topic published (repeated frame)...");
+    Serial.println("");
+    return;
+  }
+  last_counter = command.counter;
+  last_id = id;
+  queueCommand(command);
+}
+
+/**********************************************************************************
+ *
+ * Pass a decoded command to the merge stage
+ *
+ **********************************************************************************/
+void mergeCommand(const command_t &command)
+{
+  if (RECEIVER_COUNT == 1)
+  {
+    queueIfNew(command); // nothing to merge, do not wait
+    return;
+  }
+
+  merge_slot_t *free_slot = NULL;
+  for (int i = 0; i < MERGE_SLOTS; i++)
+  {
+    merge_slot_t *slot = &merge_slots[i];
+    if (slot->used && sameCommand(slot->command, command))
+    {
+      if (betterCopy(command, slot->command))
+      {
+        slot->command = command;
+      }
+      merged++;
+      return;
+    }
+    if (!slot->used && free_slot == NULL)
+    {
+      free_slot = slot;
+    }
+  }
+
+  if (free_slot == NULL)
+  {
+    queueIfNew(command); // all slots busy, publish without merging
+    return;
+  }
+  free_slot->used = true;
+  free_slot->command = command;
+  free_slot->decide_at = millis() + MERGE_WINDOW;
+}
+
+/**********************************************************************************
+ *
+ * Queue merged commands whose merge window has ended
+ *
+ **********************************************************************************/
+unsigned long flushMergedCommands(unsigned long idle_timeout)
+{
+  unsigned long now = millis();
+  unsigned long timeout = idle_timeout;
+  for (int i = 0; i < MERGE_SLOTS; i++)
+  {
+    merge_slot_t *slot = &merge_slots[i];
+    if (!slot->used)
+    {
+      continue;
+    }
+    if ((long)(now - slot->decide_at) >= 0)
+    {
+      queueIfNew(slot->command);
+      slot->used = false;
+    }
+    else
+    {
+      timeout = min(timeout, slot->decide_at - now);
+    }
+  }
+  return timeout;
+}
+
+unsigned long mergedCommands()
+{
+  return merged;
+}
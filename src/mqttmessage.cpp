@@ -5,6 +5,11 @@
  *
  * Compile topic and payload for MQTT Message.
  *
+ * The payload is the original JSON with quoted values, compact JSON with
+ * typed values, time and rssi, or a fixed binary record (PAYLOAD_ENCODING).
+ * Compact and binary payloads are written into stack buffers, they cost no
+ * heap and parse in the consumer without a schema guess.
+ *
  */
 
 /**********************************************************************************
@@ -16,23 +21,97 @@
 #include <mqttconnection.h>
 #include <header.h>
 #include <history.h>
+#include <mqttmessage.h>
+#include <heapmon.h>
+#include <devicestate.h>
 
 /**********************************************************************************
  *
- * Create message, send it and write history
+ * Compact JSON payload with typed values
  *
  **********************************************************************************/
 
-void sendMessage(uint8_t type, uint8_t id1, uint8_t id2, uint8_t id3, uint8_t counter, uint8_t group, uint8_t member, uint8_t action)
+String compactPayload(const command_t &command, int64_t time)
 {
-    String sId = String(id1, HEX) + String(id2, HEX) + String(id3, HEX);
-    String sMember = String(member);
-    String sGroup = String(group);
+    char payload[160];
+    int length = snprintf(payload, sizeof(payload), "{\"t\":%u,\"id\":\"%02x%02x%02x\",\"g\":%u,\"m\":%u,\"a\":%u,\"c\":%u,\"r\":%d,\"ts\":%lld",
+                          command.type, command.id1, command.id2, command.id3, command.group, command.member, command.action,
+                          command.counter, command.rssi, (long long)time);
+    if (PUBLISH_SIGNAL_QUALITY)
+    {
+        length += snprintf(payload + length, sizeof(payload) - length, ",\"te\":%u,\"tm\":%u,\"rp\":%u,\"e\":%u",
+                           command.timing, command.max_timing, command.repaired, command.errors);
+    }
+    snprintf(payload + length, sizeof(payload) - length, "}");
+    return String(payload);
+}
+
+/**********************************************************************************
+ *
+ * Binary payload, layout in mqttmessage.h
+ *
+ **********************************************************************************/
+
+void binaryPayload(const command_t &command, int64_t time, uint8_t record[BINARY_RECORD_SIZE])
+{
+    record[0] = BINARY_RECORD_VERSION;
+    record[1] = command.type;
+    record[2] = command.id1;
+    record[3] = command.id2;
+    record[4] = command.id3;
+    record[5] = command.counter;
+    record[6] = command.group;
+    record[7] = command.member;
+    record[8] = command.action;
+    record[9] = (uint8_t)command.rssi;
+    record[10] = command.errors;
+    record[11] = command.receiver;
+    for (int i = 0; i < 8; i++)
+    {
+        record[12 + i] = (uint8_t)((uint64_t)time >> (8 * i));
+    }
+}
+
+/**********************************************************************************
+ *
+ * Publish command on a topic with the payload of PAYLOAD_ENCODING
+ *
+ **********************************************************************************/
+
+void publishCommand(const String &topic, const command_t &command, int64_t time, uint8_t encoding, const String &json)
+{
+    if (encoding == PAYLOAD_BINARY)
+    {
+        uint8_t record[BINARY_RECORD_SIZE];
+        binaryPayload(command, time, record);
+        publishMQTTBinary(topic.c_str(), record, BINARY_RECORD_SIZE);
+    }
+    else if (encoding == PAYLOAD_COMPACT)
+    {
+        publishMQTT(topic, compactPayload(command, time));
+    }
+    else
+    {
+        publishMQTT(topic, json);
+    }
+}
+
+/**********************************************************************************
+ *
+ * Create message and send it, the history is written by the network task
+ *
+ **********************************************************************************/
+
+void sendMessage(const command_t &command)
+{
+    heap_mark_t mark = heapMark();
+    String sId = String(command.id1, HEX) + String(command.id2, HEX) + String(command.id3, HEX);
+    String sMember = String(command.member);
+    String sGroup = String(command.group);
     String sAction = "NotRecognized";
     String sTopic = "";
-    String payLoad = "";
 
-    switch (action) // action
+    switch (command.action) // action
     {
     case 3:
         sAction = "stop";
@@ -57,7 +136,7 @@ void sendMessage(uint8_t type, uint8_t id1, uint8_t id2, uint8_t id3, uint8_t co
         break;
     }
 
-    switch (type) // type of sender
+    switch (command.type) // type of sender
     {
     case 1:
         sTopic = String(MQTT_CLIENT_ID) + String("/PlainSender/ID_") + String(sId) + "/" + String(sAction);
@@ -72,19 +151,42 @@ void sendMessage(uint8_t type, uint8_t id1, uint8_t id2, uint8_t id3, uint8_t co
 
     if (sTopic != "")
     {
-        // create payload as JSON
-        payLoad = "{\"Id\":\"" + sId + "\",\"Group\":\"" + sGroup + "\",\"Member\":\"" + sMember + "\",\"Action\":\"" + String(action) + "\",\"Counter\":\"" + String(counter) + "\"}";
+        int64_t time = captureTime(command);
+
+        // publish on the command topic
+        if (PUBLISH_COMMAND_TOPICS)
+        {
+            String payLoad;
+            if (PAYLOAD_ENCODING == PAYLOAD_JSON)
+            {
+                payLoad = "{\"Id\":\"" + sId + "\",\"Group\":\"" + sGroup + "\",\"Member\":\"" + sMember + "\",\"Action\":\"" + String(command.action) + "\",\"Counter\":\"" + String(command.counter) + "\"";
+                if (PUBLISH_SIGNAL_QUALITY)
+                {
+                    payLoad += ",\"Rssi\":\"" + String(command.rssi) + "\",\"Timing\":\"" + String(command.timing) + "\",\"MaxTiming\":\"" + String(command.max_timing) +
+                               "\",\"Repaired\":\"" + String(command.repaired) + "\",\"Errors\":\"" + String(command.errors) + "\"";
+                }
+                payLoad += "}";
+            }
+            publishCommand(sTopic, command, time, PAYLOAD_ENCODING, payLoad);
+        }
 
-        // publish
-        publishMQTT(sTopic, payLoad);
+        // the aggregate topic does not tell the sender, the payload must
+        if (PUBLISH_AGGREGATE_TOPIC)
+        {
+            publishCommand(AGGREGATE_TOPIC, command, time, PAYLOAD_ENCODING == PAYLOAD_BINARY ? PAYLOAD_BINARY : PAYLOAD_COMPACT, "");
+        }
 
-        // write command history
-        storeCommand(type, id1, id2, id3, counter, member, group, action);
+        // retained state of the shutter, only if it changed
+        if (PUBLISH_STATE_TOPICS)
+        {
+            updateState(command, time, true);
+        }
 
         Serial.println("");
         Serial.println("Published topic " + sTopic + " to " + MQTT_SERVER + ":" + MQTT_PORT);
         Serial.println("");
         Serial.println("");
     }
+    heapStage(HEAP_PUBLISH, mark);
     return;
 }
\ No newline at end of file
@@ -0,0 +1,211 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: noise.cpp
+ *
+ * Background noise monitor. Once per second the decode task takes the edge
+ * rate of every receiver from the edge counters of the interrupts and, if no
+ * frame was decoded since the last sample, the rssi of the CC1101 as noise
+ * floor. A receiver disabled by the storm protection counts in the highest
+ * rate bucket. The web server reads the histograms, a critical section keeps
+ * them consistent.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <header.h>
+#include <receiver.h>
+#include <noise.h>
+
+// one trend interval
+typedef struct
+{
+  uint32_t max_rate; // highest edge rate of all receivers, edges per second
+  int32_t rssi_sum;  // idle rssi, for average
+  uint32_t rssi_count;
+} noise_interval_t;
+
+uint32_t rate_histogram[RECEIVER_COUNT][NOISE_RATE_BUCKETS]; // samples per edge rate bucket
+uint32_t rssi_histogram[NOISE_RSSI_BUCKETS];                 // idle samples per rssi bucket
+uint32_t current_rate[RECEIVER_COUNT];                       // edges per second of last sample
+int current_rssi = RSSI_UNKNOWN;                             // last idle rssi
+
+noise_interval_t noise_trend[NOISE_TREND_SIZE];
+unsigned int noise_trend_count = 0; // intervals finished
+noise_interval_t noise_interval;    // current interval
+unsigned long noise_interval_start = 0;
+portMUX_TYPE noise_mux = portMUX_INITIALIZER_UNLOCKED;
+
+uint32_t last_edge_count[RECEIVER_COUNT];
+unsigned long last_frames = 0;
+unsigned long last_sample = 0; // ms, 0 before the first sample
+
+/**********************************************************************************
+ *
+ * Helpers
+ *
+ **********************************************************************************/
+
+unsigned int rateBucket(uint32_t rate)
+{
+  unsigned int bucket = 0;
+  for (uint32_t limit = NOISE_RATE_BUCKET_1; bucket < NOISE_RATE_BUCKETS - 1 && rate >= limit; limit *= 2)
+  {
+    bucket++;
+  }
+  return bucket;
+}
+
+unsigned int rssiBucket(int rssi)
+{
+  if (rssi < NOISE_RSSI_MIN)
+  {
+    return 0;
+  }
+  return min(1 + (rssi - NOISE_RSSI_MIN) / 5, NOISE_RSSI_BUCKETS - 1);
+}
+
+unsigned long decodedFrames()
+{
+  unsigned long frames = 0;
+  for (int i = 0; i < RECEIVER_COUNT; i++)
+  {
+    for (unsigned int d = 0; d < receivers[i].decoders.count; d++)
+    {
+      frames += receivers[i].decoders.decoders[d]->frames;
+    }
+  }
+  return frames;
+}
+
+/**********************************************************************************
+ *
+ * Take a sample (decode task)
+ *
+ **********************************************************************************/
+
+void noiseSample()
+{
+  unsigned long now = millis();
+  unsigned long elapsed = now - last_sample;
+  if (last_sample != 0 && elapsed < NOISE_SAMPLE_INTERVAL)
+  {
+    return;
+  }
+
+  uint32_t rates[RECEIVER_COUNT];
+  for (int i = 0; i < RECEIVER_COUNT; i++)
+  {
+    uint32_t count = receivers[i].edge_count;
+    rates[i] = (uint64_t)(count - last_edge_count[i]) * 1000 / max(elapsed, 1UL);
+    if (receivers[i].muted)
+    {
+      rates[i] = max(rates[i], (uint32_t)((uint64_t)STORM_WINDOW_EDGES * 1000000 / STORM_WINDOW)); // edges are not counted
+    }
+    last_edge_count[i] = count;
+  }
+  unsigned long frames = decodedFrames();
+  bool idle = frames == last_frames;
+  last_frames = frames;
+  if (last_sample == 0)
+  {
+    last_sample = now; // counters start now
+    noise_interval_start = now;
+    return;
+  }
+  last_sample = now;
+  int rssi = idle ? receiverRssi(0) : RSSI_UNKNOWN;
+
+  portENTER_CRITICAL(&noise_mux);
+  for (int i = 0; i < RECEIVER_COUNT; i++)
+  {
+    current_rate[i] = rates[i];
+    rate_histogram[i][rateBucket(rates[i])]++;
+    noise_interval.max_rate = max(noise_interval.max_rate, rates[i]);
+  }
+  if (rssi != RSSI_UNKNOWN)
+  {
+    current_rssi = rssi;
+    rssi_histogram[rssiBucket(rssi)]++;
+    noise_interval.rssi_sum += rssi;
+    noise_interval.rssi_count++;
+  }
+  if (now - noise_interval_start >= NOISE_TREND_INTERVAL * 1000UL)
+  {
+    noise_trend[noise_trend_count % NOISE_TREND_SIZE] = noise_interval;
+    noise_trend_count++;
+    memset(&noise_interval, 0, sizeof(noise_interval));
+    noise_interval_start = now;
+  }
+  portEXIT_CRITICAL(&noise_mux);
+}
+
+/**********************************************************************************
+ *
+ * Histograms and trend as JSON string
+ *
+ **********************************************************************************/
+
+String intervalJson(const noise_interval_t &interval)
+{
+  return "{\"MaxRate\":" + String(interval.max_rate) + ",\"Rssi\":" +
+         String(interval.rssi_count == 0 ? RSSI_UNKNOWN : (int)(interval.rssi_sum / (int32_t)interval.rssi_count)) + "}";
+}
+
+String noiseReport()
+{
+  portENTER_CRITICAL(&noise_mux);
+  uint32_t rates[RECEIVER_COUNT][NOISE_RATE_BUCKETS];
+  uint32_t rssis[NOISE_RSSI_BUCKETS];
+  uint32_t current[RECEIVER_COUNT];
+  noise_interval_t trend[NOISE_TREND_SIZE];
+  memcpy(rates, rate_histogram, sizeof(rates));
+  memcpy(rssis, rssi_histogram, sizeof(rssis));
+  memcpy(current, current_rate, sizeof(current));
+  memcpy(trend, noise_trend, sizeof(trend));
+  noise_interval_t interval = noise_interval;
+  unsigned int trend_count = noise_trend_count;
+  int rssi = current_rssi;
+  portEXIT_CRITICAL(&noise_mux);
+
+  String report = "{\"RateLimits\":[";
+  for (int b = 0; b < NOISE_RATE_BUCKETS - 1; b++)
+  {
+    report += String(b == 0 ? "" : ",") + String(NOISE_RATE_BUCKET_1 << b);
+  }
+  report += "],\"Receivers\":[";
+  for (int i = 0; i < RECEIVER_COUNT; i++)
+  {
+    report += String(i == 0 ? "" : ",") + "{\"Receiver\":" + String(i) + ",\"EdgeRate\":" + String(current[i]) + ",\"Rates\":[";
+    for (int b = 0; b < NOISE_RATE_BUCKETS; b++)
+    {
+      report += String(b == 0 ? "" : ",") + String(rates[i][b]);
+    }
+    report += "]}";
+  }
+
+  report += "],\"IdleRssi\":" + String(rssi) + ",\"RssiLimits\":[";
+  for (int b = 0; b < NOISE_RSSI_BUCKETS - 1; b++)
+  {
+    report += String(b == 0 ? "" : ",") + String(NOISE_RSSI_MIN + 5 * b);
+  }
+  report += "],\"Rssi\":[";
+  for (int b = 0; b < NOISE_RSSI_BUCKETS; b++)
+  {
+    report += String(b == 0 ? "" : ",") + String(rssis[b]);
+  }
+
+  // oldest interval first, current one last
+  report += "],\"Trend\":[";
+  unsigned int first = trend_count > NOISE_TREND_SIZE ? trend_count - NOISE_TREND_SIZE : 0;
+  for (unsigned int i = first; i < trend_count; i++)
+  {
+    report += intervalJson(trend[i % NOISE_TREND_SIZE]) + ",";
+  }
+  return report + intervalJson(interval) + "]}";
+}
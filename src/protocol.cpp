@@ -19,7 +19,11 @@
 #include <f2sutils.h>
 #include <header.h>
 #include <history.h>
-#include <mqttmessage.h>
+#include <protocol.h>
+#include <merge.h>
+#include <heapmon.h>
+#include <longframe.h>
+#include <allowlist.h>
 
 /**********************************************************************************
  *
@@ -27,7 +31,7 @@
  *
  **********************************************************************************/
 
-String duration2TriBit(volatile unsigned long *timings, int start, int end)
+String duration2TriBit(const unsigned long *timings, int start, int end)
 {
   String current_symbol = "0";
   String bits = "";
@@ -105,11 +109,18 @@ String getByteFromCandidates(String cand1, String cand2)
  *
  **********************************************************************************/
 
-int last_counter = -1;
-String last_id = "";
-
-void analyseCommand(String byte0, String byte1, String byte2, String byte3, String byte4)
+void analyseCommand(String byte0, String byte1, String byte2, String byte3, String byte4, command_t command)
 {
+  // get id of sender, frames of senders not in the allowlist end here
+  int id1 = valueOfBitString(byte0);
+  int id2 = valueOfBitString(byte1);
+  int id3 = valueOfBitString(byte2);
+  uint32_t sender = ((uint32_t)id1 << 16) | ((uint32_t)id2 << 8) | id3;
+  if (!senderAllowed(sender))
+  {
+    return;
+  }
+
   Serial.println("------- Message received -------");
   // get type of sender
   int type = valueOfBitString(byte0.substring(0, 5));
@@ -133,13 +144,7 @@ void analyseCommand(String byte0, String byte1, String byte2, String byte3, Stri
   Serial.print(type);
   Serial.println(" (" + sType + ")");
 
-  // get id of sender
-  int id1 = valueOfBitString(byte0);
-  String sId = String(id1, HEX);
-  int id2 = valueOfBitString(byte1);
-  sId = sId + String(id2, HEX);
-  int id3 = valueOfBitString(byte2);
-  sId = sId + String(id3, HEX);
+  String sId = String(id1, HEX) + String(id2, HEX) + String(id3, HEX);
   Serial.println("ID  : 0x" + sId);
 
   // get command counter
@@ -199,15 +204,20 @@ void analyseCommand(String byte0, String byte1, String byte2, String byte3, Stri
   }
   Serial.println(" (" + sAction + ")");
 
-  // valid command if type and action are known and counter or id changed or it is no central unit
-  if (type != 0 && action != 0 && (last_counter != counter || last_id != sId || type != 8))
+  // valid command if type and action are known
+  if (type != 0 && action != 0)
   {
-
-    // send MQTT message
-    sendMessage(type, id1, id2, id3, counter, group, member, action);
-
-    last_counter = counter;
-    last_id = sId;
+    // hand command over to merge stage, repeated frames are dropped there
+    command.type = type;
+    command.id1 = id1;
+    command.id2 = id2;
+    command.id3 = id3;
+    command.counter = counter;
+    command.group = group;
+    command.member = member;
+    command.action = action;
+    learnSender(sender);
+    mergeCommand(command);
   }
   else
   {
@@ -222,7 +232,7 @@ void analyseCommand(String byte0, String byte1, String byte2, String byte3, Stri
  *
  **********************************************************************************/
 
-void processReceivedData(String triBits)
+void processReceivedData(String triBits, command_t command)
 {
   // 10 blocks starting with first data bit in first block => 10 databits = 30 tri bits
   // next blocks: sync "1B" followed by 10 databits = 30 tri bits
@@ -238,6 +248,8 @@ void processReceivedData(String triBits)
   String byte2 = "";
   String byte3 = "";
   String byte4 = "";
+  unsigned int errors = 0;              // discarded words
+  unsigned int repaired = 0;            // bytes with one damaged copy
 
   unsigned int next = 0, end = 0;
 
@@ -245,7 +257,8 @@ void processReceivedData(String triBits)
   for (int i = 0; i < 10; i++)
   {
     next = end;
-    end = triBits.indexOf(sync, next);
+    int found = triBits.indexOf(sync, next);
+    end = found < 0 ? triBits.length() : found; // no sync follows the last word in the ring buffer
 
     // only 8 bits of 10 bit word
     data_tribyte[i] = triBits.substring(next, end - parity_tribit - check_tribit);
@@ -254,6 +267,7 @@ void processReceivedData(String triBits)
     if (data_tribyte[i].indexOf("E") != -1 || data_tribyte[i].length() != 24)
     {
       data_tribyte[i] = ""; // error in word detected, so discard word
+      errors++;
     }
 
     // convert tri bits to a one byte bit string
@@ -271,6 +285,7 @@ void processReceivedData(String triBits)
       {
         // garbage found
         data_byte[i] = ""; // discard byte
+        errors++;
         break;
       }
     }
@@ -286,6 +301,11 @@ void processReceivedData(String triBits)
     byte2 = reverseString(getByteFromCandidates(data_byte[3], data_byte[4]));
     byte3 = reverseString(getByteFromCandidates(data_byte[5], data_byte[6]));
     byte4 = reverseString(getByteFromCandidates(data_byte[7], data_byte[8]));
+    repaired = 1; // only one copy of byte 0
+    for (int i = 1; i < 9; i += 2)
+    {
+      repaired += (data_byte[i] == "") != (data_byte[i + 1] == "");
+    }
   }
   else
   {
@@ -295,8 +315,422 @@ void processReceivedData(String triBits)
     byte2 = reverseString(getByteFromCandidates(data_byte[4], data_byte[5]));
     byte3 = reverseString(getByteFromCandidates(data_byte[6], data_byte[7]));
     byte4 = reverseString(getByteFromCandidates(data_byte[8], data_byte[9]));
+    for (int i = 0; i < 10; i += 2)
+    {
+      repaired += (data_byte[i] == "") != (data_byte[i + 1] == "");
+    }
   }
 
   // we have found 5 bytes, so analyse them
-  analyseCommand(byte0, byte1, byte2, byte3, byte4);
+  command.errors = errors;
+  command.repaired = repaired;
+  analyseCommand(byte0, byte1, byte2, byte3, byte4, command);
+}
+
+/**********************************************************************************
+ *
+ * Encode command as Fernotron frame words
+ *
+ **********************************************************************************/
+
+// data byte and 2 check bits: even parity, inverted in the second copy of a byte
+uint16_t encodeWord(uint8_t data, unsigned int position)
+{
+  uint8_t ones = 0;
+  for (uint8_t bits = data; bits != 0; bits >>= 1)
+  {
+    ones += bits & 1;
+  }
+  uint16_t parity = ones & 1;
+  uint16_t check = parity ^ (position & 1);
+  return data | (parity << 8) | (check << 9);
+}
+
+void encodeCommand(const command_t &command, uint16_t words[FRAME_WORDS])
+{
+  uint8_t bytes[FRAME_BYTES];
+  uint8_t member = command.member;
+  if (member != 0 && command.type == 8)
+  {
+    member = member + 7; // see analyseCommand
+  }
+  bytes[0] = command.id1; // type is the high nibble of id1
+  bytes[1] = command.id2;
+  bytes[2] = command.id3;
+  bytes[3] = (command.counter << 4) | (member & 0x0f);
+  bytes[4] = (command.group << 4) | (command.action & 0x0f);
+  bytes[5] = bytes[0] + bytes[1] + bytes[2] + bytes[3] + bytes[4]; // checksum
+
+  for (int i = 0; i < FRAME_WORDS; i++)
+  {
+    words[i] = encodeWord(bytes[i / 2], i);
+  }
+}
+
+/**********************************************************************************
+ *
+ * Fernotron decoder: find sync blocks in the periods between edges, collect
+ * a frame in the ring buffer and process it
+ *
+ * Besides, every word is decoded while it comes in and kept as bytes only.
+ * Command frames are decoded from the ring buffer as before, the words after
+ * the command bytes of a long frame (central unit programming) would not fit
+ * into it. The stream ends at the gap after a frame or at a damaged period.
+ * After a damaged period in the lines of a long frame the words up to its gap
+ * are skipped, the rest of the lines must not be taken for commands.
+ *
+ **********************************************************************************/
+
+#define STREAM_IDLE 0xff                                                     // waiting for a sync block
+#define STREAM_BYTES (FRAME_BYTES + LONG_FRAME_LINES * LONG_FRAME_LINE_BYTES) // command and line bytes
+
+// words of the current frame, decoded period by period
+typedef struct
+{
+  uint8_t bits;               // bits of the current word, STREAM_IDLE before a sync
+  uint16_t word;              // current word, low bit first
+  unsigned long high;         // duration of the last high period
+  unsigned int words;         // complete words of the frame
+  uint16_t first_copy;        // first word of the current byte
+  bool bad_command;           // damaged command byte
+  uint32_t bad_lines;         // bit per line with a damaged byte or wrong checksum
+  int8_t rssi;                // rssi while the frame was received
+  uint8_t bytes[STREAM_BYTES];
+} frame_stream_t;
+
+typedef struct
+{
+  unsigned long ring_buffer[RING_BUFFER_SIZE]; // buffer to store timings and signal level
+  unsigned int ring_index;                     // pointer in ring buffer
+  unsigned int sync_start_index;               // pointer to first sync block
+  unsigned int sync_block_count;               // number of sync blocks found (1 - 10)
+  unsigned int sync_last_block_index;          // pointer to start of last found block
+  unsigned long holdoff;                       // signal time to skip after a frame
+  int8_t sync_rssi;                            // rssi at the first sync block
+  uint8_t receiver;                            // receiver the decoder is attached to
+  frame_stream_t stream;                       // word by word decoding of long frames
+  bool skip_long_frame;                        // rest of a damaged long frame, wait for its gap
+} fernotron_state_t;
+
+// reinitialize ring buffer after an error or after command processing
+void resetFernotron(fernotron_state_t *state)
+{
+  state->ring_index = 0;
+  state->sync_block_count = 0;
+  state->sync_start_index = 0;
+  state->sync_last_block_index = 0;
+}
+
+// deviation of the data periods of the frame from 1 or 2 symbol lengths
+void measureTiming(const fernotron_state_t *state, command_t *command)
+{
+  unsigned long sum = 0;
+  unsigned long largest = 0;
+  unsigned int count = 0;
+  unsigned int end = (state->sync_last_block_index + 20) % RING_BUFFER_SIZE;
+  for (unsigned int index = state->sync_start_index; index != end; index = nextIndex(index))
+  {
+    unsigned long duration = state->ring_buffer[index] / 10;
+    if (duration > symbol_length * 2 + tolerance)
+    {
+      continue; // sync block
+    }
+    unsigned long nominal = duration < symbol_length * 3 / 2 ? symbol_length : symbol_length * 2;
+    unsigned long deviation = duration > nominal ? duration - nominal : nominal - duration;
+    sum += deviation;
+    largest = max(largest, deviation);
+    count++;
+  }
+  command->timing = count == 0 ? 0 : sum / count;
+  command->max_timing = largest;
+}
+
+// decode frame, called when 10 sync blocks have been found
+void processFernotronFrame(fernotron_state_t *state)
+{
+  command_t command;
+  command.receiver = state->receiver;
+  command.rssi = state->sync_rssi;
+  command.capture_time = esp_timer_get_time();
+  measureTiming(state, &command);
+  digitalWrite(INFO_LED, HIGH); // LED on
+  heap_mark_t mark = heapMark();
+  processReceivedData(duration2TriBit(state->ring_buffer, state->sync_start_index, (state->sync_last_block_index + 20) % RING_BUFFER_SIZE), command);
+  heapStage(HEAP_FRAME, mark);
+  digitalWrite(INFO_LED, LOW); // LED off
+}
+
+// even parity of the data bits in bit 8
+bool validWord(uint16_t word)
+{
+  return ((word >> 8) & 1) == (__builtin_popcount(word & 0xff) & 1);
+}
+
+// both copies of a byte are complete, keep a valid one
+void streamByte(frame_stream_t *stream, uint16_t second_copy)
+{
+  unsigned int index = stream->words / 2 - 1;
+  bool first_valid = validWord(stream->first_copy);
+  bool second_valid = validWord(second_copy);
+  bool damaged = (!first_valid && !second_valid) || (first_valid && second_valid && (stream->first_copy & 0xff) != (second_copy & 0xff));
+  stream->bytes[index] = first_valid ? stream->first_copy : second_copy;
+  if (!damaged)
+  {
+    return;
+  }
+  if (index < FRAME_BYTES)
+  {
+    stream->bad_command = true;
+  }
+  else
+  {
+    stream->bad_lines |= 1UL << ((index - FRAME_BYTES) / LONG_FRAME_LINE_BYTES);
+  }
+}
+
+// line checksums: the sum of the data bytes continues from the checksum before
+// (command checksum for line 0), mark lines where it does not match
+void checkLines(frame_stream_t *stream, unsigned int lines)
+{
+  for (unsigned int line = 0; line < lines; line++)
+  {
+    const uint8_t *bytes = stream->bytes + FRAME_BYTES + line * LONG_FRAME_LINE_BYTES;
+    uint8_t sum = bytes[-1];
+    for (int i = 0; i < LONG_FRAME_LINE_BYTES - 1; i++)
+    {
+      sum += bytes[i];
+    }
+    if (sum != bytes[LONG_FRAME_LINE_BYTES - 1])
+    {
+      stream->bad_lines |= 1UL << line;
+    }
+  }
+}
+
+// hand a long frame over to the network task, false if the command bytes are damaged
+bool processLongFrame(fernotron_state_t *state)
+{
+  frame_stream_t *stream = &state->stream;
+  const uint8_t *bytes = stream->bytes;
+  if (stream->bad_command || (uint8_t)(bytes[0] + bytes[1] + bytes[2] + bytes[3] + bytes[4]) != bytes[5])
+  {
+    Serial.println("Long frame with damaged command bytes dropped.");
+    return false;
+  }
+  if (!senderAllowed(((uint32_t)bytes[0] << 16) | ((uint32_t)bytes[1] << 8) | bytes[2]))
+  {
+    return true; // long frame of a foreign central unit
+  }
+
+  long_frame_t frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.lines = min(stream->words / 2 - FRAME_BYTES, (unsigned int)(STREAM_BYTES - FRAME_BYTES)) / LONG_FRAME_LINE_BYTES;
+  checkLines(stream, frame.lines);
+  frame.bad_lines = stream->bad_lines & ((1UL << frame.lines) - 1);
+
+  command_t *command = &frame.command;
+  command->type = bytes[0] >> 4;
+  command->id1 = bytes[0];
+  command->id2 = bytes[1];
+  command->id3 = bytes[2];
+  command->counter = bytes[3] >> 4;
+  command->member = bytes[3] & 0x0f;
+  if (command->member != 0 && command->type == 8)
+  {
+    command->member = command->member - 7; // see analyseCommand
+  }
+  command->group = bytes[4] >> 4;
+  command->action = bytes[4] & 0x0f;
+  command->rssi = stream->rssi;
+  command->errors = __builtin_popcount(frame.bad_lines);
+  command->receiver = state->receiver;
+  command->capture_time = esp_timer_get_time();
+
+  memcpy(frame.data, bytes + FRAME_BYTES, frame.lines * LONG_FRAME_LINE_BYTES);
+  queueLongFrame(frame);
+  return true;
+}
+
+// end of the words of a frame, true if it was a long frame
+bool endStream(fernotron_state_t *state)
+{
+  frame_stream_t *stream = &state->stream;
+  bool found = stream->words / 2 >= FRAME_BYTES + LONG_FRAME_LINE_BYTES && processLongFrame(state);
+  stream->bits = STREAM_IDLE;
+  stream->words = 0;
+  stream->bad_command = false;
+  stream->bad_lines = 0;
+  return found;
+}
+
+// a word is complete, combine it with its copy
+bool streamWord(fernotron_state_t *state)
+{
+  frame_stream_t *stream = &state->stream;
+  stream->words++;
+  if (stream->words == FRAME_WORDS + 1)
+  {
+    stream->rssi = receiverRssi(state->receiver); // a long frame, the signal is still there
+  }
+  if (stream->words % 2 == 1)
+  {
+    stream->first_copy = stream->word;
+  }
+  else
+  {
+    streamByte(stream, stream->word);
+    if (stream->words / 2 == STREAM_BYTES)
+    {
+      return endStream(state); // longest frame we know
+    }
+  }
+  return false;
+}
+
+// decode one period into the stream, true if a long frame is complete
+bool streamPeriod(fernotron_state_t *state, unsigned long duration, uint8_t level)
+{
+  frame_stream_t *stream = &state->stream;
+  if (level == 1)
+  {
+    stream->high = duration;
+    return false;
+  }
+
+  bool single_high = inRange(symbol_length - tolerance, symbol_length + tolerance, stream->high);
+  bool double_high = inRange(symbol_length * 2 - tolerance, symbol_length * 2 + tolerance, stream->high);
+  bool single_low = inRange(symbol_length - tolerance, symbol_length + tolerance, duration);
+  bool double_low = inRange(symbol_length * 2 - tolerance, symbol_length * 2 + tolerance, duration);
+
+  if (single_high && inRange(block_min_duration, block_max_duration, duration))
+  {
+    // sync block, the previous word must be complete
+    bool found = false;
+    if (stream->bits != STREAM_IDLE && stream->bits != 10)
+    {
+      state->skip_long_frame = stream->words > FRAME_WORDS;
+      found = endStream(state);
+    }
+    stream->bits = 0;
+    stream->word = 0;
+    return found;
+  }
+  if (stream->bits < 10 && ((single_high && double_low) || (double_high && single_low)))
+  {
+    // data bit, "100" is 1, "110" is 0
+    stream->word |= (uint16_t)single_high << stream->bits;
+    stream->bits++;
+    return stream->bits == 10 && streamWord(state);
+  }
+  if (stream->bits == STREAM_IDLE)
+  {
+    return false;
+  }
+
+  // gap or damaged period: the last low of a frame merges with the gap, so the
+  // last word lacks its check bit, which is not needed
+  bool found = false;
+  bool gap = duration > block_max_duration;
+  if (stream->bits == 9 && gap && (single_high || double_high))
+  {
+    stream->word |= (uint16_t)single_high << 9;
+    found = streamWord(state);
+  }
+  state->skip_long_frame = !gap && stream->words > FRAME_WORDS;
+  return endStream(state) || found;
+}
+
+bool fernotronFeed(void *decoder_state, unsigned long duration, uint8_t level)
+{
+  fernotron_state_t *state = (fernotron_state_t *)decoder_state;
+
+  // rest of a damaged long frame, neither commands nor a new long frame
+  if (state->skip_long_frame)
+  {
+    if (level == 0 && duration > block_max_duration)
+    {
+      state->skip_long_frame = false;
+      resetFernotron(state);
+      state->holdoff = 0;
+    }
+    return false;
+  }
+
+  // word by word decoding, a long frame is complete or in progress
+  if (streamPeriod(state, duration, level))
+  {
+    return true;
+  }
+  if (state->stream.words > FRAME_WORDS)
+  {
+    resetFernotron(state); // the command bytes were decoded from the ring buffer already
+    state->holdoff = 0;
+    return false;
+  }
+
+  // skip the rest of a decoded frame (check words)
+  if (state->holdoff > 0)
+  {
+    state->holdoff = duration < state->holdoff ? state->holdoff - duration : 0;
+    return false;
+  }
+
+  // store data in buffer, glitches were removed by the glitch filter
+  unsigned long current_duration = duration;
+  state->ring_buffer[state->ring_index] = current_duration * 10 + level; // Store current duration and signal level in buffer
+
+  if (level == 0)
+  { // now check for sync block | |________
+    if (inRange(block_min_duration, block_max_duration, current_duration))
+    {
+      // low 8 symbols found, check previous signal
+      unsigned long previous_duration = state->ring_buffer[previousIndex(state->ring_index)] / 10;
+      if (inRange(symbol_length - tolerance, symbol_length + tolerance, previous_duration))
+      {
+        // low 8 symbols found with 1 symbol high before => sync
+        state->sync_block_count++;
+        if (state->sync_block_count == 1) // first block found
+        {
+          state->sync_rssi = receiverRssi(state->receiver);         // rssi of this frame, not of the next one
+          state->sync_start_index = nextIndex(state->ring_index); // initialize sync info, points to first data bit (next period, high level)
+          state->sync_last_block_index = nextIndex(state->ring_index);
+        }
+        else
+        {                                                                          // a following block found        _
+          if (distance(state->sync_last_block_index, state->ring_index) == 20 + 1) // 20 level changes + 1 for sync | |________
+          {                                                                        // distance as expected
+            state->sync_last_block_index = nextIndex(state->ring_index);           // points to first data bit of new block (next period, high level)
+          }
+          else
+          {
+            resetFernotron(state); // wrong bit count => reinitialize and search again
+          }
+        }
+      }
+    }
+  }
+  else
+  { // a high level found
+    if (state->sync_block_count == 10 && distance(state->sync_last_block_index, state->ring_index) == 20)
+    { // 10 sync blocks plus 20 level changes => message complete (omit further blocks)
+      processFernotronFrame(state);
+      resetFernotron(state); // for next command
+      state->holdoff = frame_holdoff;
+      return true;
+    }
+  }
+  state->ring_index = nextIndex(state->ring_index);
+  return false;
+}
+
+decoder_t *createFernotronDecoder(uint8_t receiver)
+{
+  fernotron_state_t *state = (fernotron_state_t *)calloc(1, sizeof(fernotron_state_t));
+  state->receiver = receiver;
+  state->stream.bits = STREAM_IDLE;
+  decoder_t *decoder = (decoder_t *)calloc(1, sizeof(decoder_t));
+  decoder->name = "fernotron";
+  decoder->state = state;
+  decoder->feed = fernotronFeed;
+  return decoder;
 }
@@ -0,0 +1,227 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: receiver.cpp
+ *
+ * Interrupts of the 433 Mhz receiver modules connected to receiver_pins. Edges
+ * are passed to the decode task through a single producer / single consumer
+ * ring buffer per receiver. Interrupts and decode task run on the same core.
+ *
+ * The interrupt is the CAPTURE_GPIO backend, CAPTURE_RMT times the pulses in
+ * hardware instead (rmtcapture.cpp). Both deliver the same edges to readEdges().
+ *
+ * Noise can fire an interrupt tens of thousands of times per second. The edge
+ * rate is limited per STORM_WINDOW: above the limit the interrupt only counts
+ * and wakes the decode task, which disables the interrupt for a while. So a
+ * storm costs a few interrupts, not the cpu time of the Wi-Fi stack.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <header.h>
+#include <receiver.h>
+#include <rmtcapture.h>
+
+receiver_t receivers[RECEIVER_COUNT];
+uint32_t quiet_edges = 0;      // edges of all receivers at the last look
+unsigned long quiet_since = 0; // ms
+
+/**********************************************************************************
+ *
+ * Handle interrups of a 433 Mhz receiver module
+ *
+ **********************************************************************************/
+
+void IRAM_ATTR handleInterrupt(void *arg)
+{
+  receiver_t *receiver = (receiver_t *)arg;
+  uint32_t time = (uint32_t)esp_timer_get_time();
+
+  receiver->edge_count++;
+
+  // edge rate limit, far above anything a Fernotron sender produces
+  if (time - receiver->window_start >= STORM_WINDOW)
+  {
+    receiver->window_start = time;
+    receiver->window_edges = 0;
+  }
+  if (++receiver->window_edges > STORM_WINDOW_EDGES)
+  {
+    if (!receiver->storm)
+    {
+      receiver->storm = true; // decode task disables the interrupt
+      BaseType_t higher_priority_task_woken = pdFALSE;
+      vTaskNotifyGiveFromISR(receiver->task, &higher_priority_task_woken);
+      if (higher_priority_task_woken == pdTRUE)
+      {
+        portYIELD_FROM_ISR();
+      }
+    }
+    return;
+  }
+
+  // signal level before the edge
+  uint8_t level = digitalRead(receiver->pin) == HIGH ? 0 : 1;
+
+  unsigned int next = (receiver->head + 1) % EDGE_BUFFER_SIZE;
+  if (next == receiver->tail)
+  {
+    receiver->overflow++; // decode task is too slow
+  }
+  else
+  {
+    receiver->edges[receiver->head] = (time << 1) | level;
+    receiver->head = next;
+  }
+
+  // wake decode task at a gap or if enough edges are waiting
+  if (time - receiver->last_edge_time > EDGE_NOTIFY_GAP || ++receiver->edges_since_notify >= EDGE_NOTIFY_COUNT)
+  {
+    receiver->edges_since_notify = 0;
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(receiver->task, &higher_priority_task_woken);
+    if (higher_priority_task_woken == pdTRUE)
+    {
+      portYIELD_FROM_ISR();
+    }
+  }
+  receiver->last_edge_time = time;
+}
+
+/**********************************************************************************
+ *
+ * GPIO backend: attach interrupt of receiver. It is serviced on the core that
+ * attaches it, so call this from the decode task.
+ *
+ **********************************************************************************/
+
+void startGpio(receiver_t *receiver)
+{
+  pinMode(receiver->pin, INPUT_PULLDOWN);
+  if (digitalPinToInterrupt(receiver->pin) == NOT_AN_INTERRUPT)
+  {
+    Serial.println("Wrong interrupt pin " + String(receiver->pin));
+  }
+  attachInterruptArg(digitalPinToInterrupt(receiver->pin), handleInterrupt, receiver, CHANGE);
+}
+
+/**********************************************************************************
+ *
+ * GPIO backend: get edges stored by the interrupt
+ *
+ **********************************************************************************/
+
+unsigned int readGpio(receiver_t *receiver, uint32_t *edges, unsigned int count)
+{
+  unsigned int read = 0;
+  while (read < count && receiver->tail != receiver->head)
+  {
+    edges[read++] = receiver->edges[receiver->tail];
+    receiver->tail = (receiver->tail + 1) % EDGE_BUFFER_SIZE;
+  }
+  return read;
+}
+
+const edge_source_t gpio_edge_source = {"GPIO", startGpio, readGpio};
+
+/**********************************************************************************
+ *
+ * Start capture of receiver with CAPTURE_BACKEND
+ *
+ **********************************************************************************/
+
+void ReceiverInit(receiver_t *receiver, TaskHandle_t task)
+{
+  receiver->task = task;
+  receiver->source = CAPTURE_BACKEND == CAPTURE_RMT ? &rmt_edge_source : &gpio_edge_source;
+  receiver->source->start(receiver);
+}
+
+/**********************************************************************************
+ *
+ * Get up to count edges of receiver, 0 if there are none
+ *
+ **********************************************************************************/
+
+unsigned int readEdges(receiver_t *receiver, uint32_t *edges, unsigned int count)
+{
+  return receiver->source->read(receiver, edges, count);
+}
+
+/**********************************************************************************
+ *
+ * Disable interrupt in a storm, enable it again after the backoff time
+ *
+ **********************************************************************************/
+
+void checkStorm(receiver_t *receiver)
+{
+  unsigned long now = millis();
+  if (receiver->storm && !receiver->muted)
+  {
+    gpio_intr_disable((gpio_num_t)receiver->pin);
+    bool again = receiver->storms > 0 && now - receiver->unmuted_at < STORM_BACKOFF_MAX;
+    receiver->backoff = again ? min(receiver->backoff * 2, (unsigned long)STORM_BACKOFF_MAX) : STORM_BACKOFF;
+    receiver->muted = true;
+    receiver->muted_at = now;
+    receiver->storms++;
+    Serial.println("Receiver " + String(receiver->id) + ": interrupt storm, disabled for " + String(receiver->backoff) + " ms");
+  }
+  else if (receiver->muted && now - receiver->muted_at >= receiver->backoff)
+  {
+    receiver->muted_time += now - receiver->muted_at;
+    receiver->muted = false;
+    receiver->unmuted_at = now;
+    receiver->window_edges = 0;
+    receiver->storm = false;
+    gpio_intr_enable((gpio_num_t)receiver->pin);
+  }
+}
+
+/**********************************************************************************
+ *
+ * Time since the last edge of any receiver
+ *
+ **********************************************************************************/
+
+unsigned long receiversQuietTime()
+{
+  uint32_t edges = 0;
+  for (int i = 0; i < RECEIVER_COUNT; i++)
+  {
+    edges += receivers[i].edge_count; // counted by both backends
+  }
+  unsigned long now = millis();
+  if (edges != quiet_edges)
+  {
+    quiet_edges = edges;
+    quiet_since = now;
+  }
+  return now - quiet_since;
+}
+
+/**********************************************************************************
+ *
+ * Create report of all receivers and their decoders as JSON string
+ *
+ **********************************************************************************/
+
+String receiverReport()
+{
+  String report = "[";
+  for (int i = 0; i < RECEIVER_COUNT; i++)
+  {
+    receiver_t *receiver = &receivers[i];
+    report += String(i == 0 ? "" : ",") + "{\"Receiver\":" + String(i) + ",\"Pin\":" + String(receiver->pin) +
+              ",\"Capture\":\"" + String(receiver->source->name) + "\",\"LostEdges\":" + String(receiver->overflow) +
+              ",\"Storms\":" + String(receiver->storms) +
+              ",\"MutedTime\":" + String(receiver->muted_time + (receiver->muted ? millis() - receiver->muted_at : 0)) +
+              ",\"Filter\":" + glitchFilterReport(&receiver->decoders.filter) + ",\"Decoders\":" + decoderReport(&receiver->decoders) + "}";
+  }
+  return report + "]";
+}
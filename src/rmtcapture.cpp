@@ -0,0 +1,155 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: rmtcapture.cpp
+ *
+ * CAPTURE_RMT backend. The RMT peripheral times the pulses of the receiver in
+ * hardware, the driver hands complete blocks to a ring buffer. There is no
+ * interrupt per edge, so the timing does not depend on Wi-Fi interrupts and
+ * the cpu time per edge is the conversion below.
+ *
+ * The decode task turns every pulse (level, duration) into the edge at its
+ * end, with the level before the edge like the receiver interrupt stores it.
+ * The RMT has no time of day: a block ended RMT_IDLE_THRESHOLD after its last
+ * edge, shortly before the decode task took it from the ring buffer. Its
+ * first edge is placed accordingly, but at least RMT_IDLE_THRESHOLD after the
+ * last edge of the previous block.
+ *
+ * tools/decode runs this file on Linux with a simulated RMT driver.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <header.h>
+#include <receiver.h>
+#include <rmtcapture.h>
+
+/**********************************************************************************
+ *
+ * Configure RMT channel of receiver as receiver and start it
+ *
+ **********************************************************************************/
+
+void startRmt(receiver_t *receiver)
+{
+  rmt_capture_t *capture = (rmt_capture_t *)calloc(1, sizeof(rmt_capture_t));
+  capture->channel = (rmt_channel_t)(RMT_RECEIVE_CHANNEL + receiver->id * RMT_RECEIVE_BLOCKS);
+
+  rmt_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.rmt_mode = RMT_MODE_RX;
+  config.channel = capture->channel;
+  config.gpio_num = (gpio_num_t)receiver->pin;
+  config.clk_div = 80; // 80 MHz APB clock => 1 us ticks
+  config.mem_block_num = RMT_RECEIVE_BLOCKS;
+  config.rx_config.filter_en = true;
+  config.rx_config.filter_ticks_thresh = RMT_FILTER_TICKS;
+  config.rx_config.idle_threshold = RMT_IDLE_THRESHOLD;
+
+  pinMode(receiver->pin, INPUT_PULLDOWN);
+  if (RMT_RECEIVE_BLOCKS == 0 || capture->channel + RMT_RECEIVE_BLOCKS > RMT_CHANNEL_MAX || rmt_config(&config) != ESP_OK ||
+      rmt_driver_install(capture->channel, RMT_RING_BUFFER_SIZE, 0) != ESP_OK ||
+      rmt_get_ringbuf_handle(capture->channel, &capture->ring_buffer) != ESP_OK)
+  {
+    Serial.println("No RMT channel for receiver " + String(receiver->id));
+    free(capture);
+    return;
+  }
+  rmt_rx_start(capture->channel, true);
+  receiver->source_state = capture;
+}
+
+/**********************************************************************************
+ *
+ * Take next block from ring buffer, place its first edge in time
+ *
+ **********************************************************************************/
+
+bool nextBlock(rmt_capture_t *capture, uint32_t *edge)
+{
+  size_t size = 0;
+  capture->items = (rmt_item32_t *)xRingbufferReceive(capture->ring_buffer, &size, 0);
+  if (capture->items == NULL)
+  {
+    return false;
+  }
+  capture->item_count = size / sizeof(rmt_item32_t);
+  capture->next = 0;
+
+  // length of the block up to the end marker (duration 0)
+  uint32_t length = 0;
+  for (size_t i = 0; i < capture->item_count && capture->items[i].duration0 != 0; i++)
+  {
+    length += capture->items[i].duration0 + capture->items[i].duration1;
+    if (capture->items[i].duration1 == 0)
+    {
+      break;
+    }
+  }
+  uint32_t start = (uint32_t)esp_timer_get_time() - RMT_IDLE_THRESHOLD - length;
+  if ((int32_t)(start - (capture->time + RMT_IDLE_THRESHOLD)) < 0)
+  {
+    start = capture->time + RMT_IDLE_THRESHOLD;
+  }
+  capture->time = start;
+
+  // the block starts with an edge from the idle level
+  *edge = (start << 1) | (capture->item_count > 0 && capture->items[0].level0 == 0 ? 1 : 0);
+  return true;
+}
+
+/**********************************************************************************
+ *
+ * Convert pulses of the received blocks into edges
+ *
+ **********************************************************************************/
+
+unsigned int readRmt(receiver_t *receiver, uint32_t *edges, unsigned int count)
+{
+  rmt_capture_t *capture = (rmt_capture_t *)receiver->source_state;
+  if (capture == NULL)
+  {
+    return 0;
+  }
+
+  unsigned int read = 0;
+  while (read < count)
+  {
+    if (capture->items == NULL)
+    {
+      if (!nextBlock(capture, &edges[read]))
+      {
+        break;
+      }
+      read++;
+      continue;
+    }
+
+    uint32_t duration = 0;
+    uint8_t level = 0;
+    if (capture->next < 2 * capture->item_count)
+    {
+      const rmt_item32_t &item = capture->items[capture->next / 2];
+      duration = capture->next % 2 == 0 ? item.duration0 : item.duration1;
+      level = capture->next % 2 == 0 ? item.level0 : item.level1;
+    }
+    if (duration == 0)
+    {
+      vRingbufferReturnItem(capture->ring_buffer, capture->items); // end of block
+      capture->items = NULL;
+      continue;
+    }
+    capture->next++;
+    capture->time += duration;
+    edges[read++] = (capture->time << 1) | level; // level of the pulse is the level before the edge
+  }
+  receiver->edge_count += read;
+  return read;
+}
+
+const edge_source_t rmt_edge_source = {"RMT", startRmt, readRmt};
@@ -0,0 +1,491 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: rules.cpp
+ *
+ * Rule engine for reactions that do not need the home automation server.
+ *
+ * The rule text is compiled into a hash table keyed by sender, group, member
+ * and action, where each of them may be a wildcard. A command is looked up
+ * once for every wildcard combination used by the rules (at most 16), so the
+ * cost per frame does not depend on the number of rules.
+ *
+ * Rules are matched in the network task once a command has passed the
+ * coalescing of repeated sun sensor frames, so a rule fires once per state
+ * change. Gpio rules switch their pin right there, the other actions are
+ * queued and done in the next cycle. The table is replaced by the web server,
+ * a mutex keeps the network task from reading it meanwhile.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include <Preferences.h>
+#include <header.h>
+#include <f2sutils.h>
+#include <mqttconnection.h>
+#include <transmit.h>
+#include <rules.h>
+
+#define RULE_SLOTS 64                 // hash table slots, twice MAX_RULES
+#define ANY_VALUE 16                  // wildcard for group, member and action
+#define ANY_SENDER 0x1000000          // wildcard for sender
+#define RULES_NAMESPACE "rules"       // NVS namespace and key of rule text
+#define RULES_KEY "text"
+
+#define RULE_PUBLISH 1
+#define RULE_WEBHOOK 2
+#define RULE_GPIO 3
+#define RULE_SEND 4
+
+#define GPIO_OFF 0
+#define GPIO_ON 1
+#define GPIO_TOGGLE 2
+#define GPIO_PULSE 3
+
+// one compiled rule
+typedef struct
+{
+  uint64_t key;             // sender, group, member and action to match
+  int8_t next;              // next rule with the same key, -1 if none
+  uint8_t kind;             // RULE_PUBLISH, RULE_WEBHOOK, RULE_GPIO or RULE_SEND
+  uint8_t pin;              // gpio pin
+  uint8_t mode;             // GPIO_OFF, GPIO_ON, GPIO_TOGGLE or GPIO_PULSE
+  uint16_t pulse;           // pulse length in ms
+  char target[RULE_TEXT];   // topic, url or command path
+  char payload[RULE_TEXT];  // payload to publish
+} rule_t;
+
+typedef struct
+{
+  rule_t rules[MAX_RULES];
+  unsigned int count;
+  int8_t slots[RULE_SLOTS]; // first rule of a key, -1 if empty
+  uint16_t masks;           // bit n set if wildcard combination n is used (8 sender, 4 group, 2 member, 1 action)
+} rule_table_t;
+
+// fired rule waiting for the network task
+typedef struct
+{
+  rule_t rule;
+  command_t command;
+} rule_action_t;
+
+// running gpio pulse
+typedef struct
+{
+  bool used;
+  uint8_t pin;
+  unsigned long end; // ms
+} rule_pulse_t;
+
+rule_table_t rule_table;                 // used by network task
+rule_table_t compiled_rules;             // new rules, web server and setup only
+SemaphoreHandle_t rules_mutex = NULL;    // protects rule_table
+QueueHandle_t rule_queue = NULL;         // fired publish, webhook and send actions, network task only
+rule_pulse_t rule_pulses[RULE_PULSES];   // network task only
+
+/**********************************************************************************
+ *
+ * Helpers
+ *
+ **********************************************************************************/
+
+uint64_t ruleKey(uint32_t sender, uint8_t group, uint8_t member, uint8_t action)
+{
+  return ((uint64_t)sender << 15) | ((uint64_t)group << 10) | ((uint64_t)member << 5) | action;
+}
+
+unsigned int ruleSlot(uint64_t key)
+{
+  return (key * 0x9E3779B97F4A7C15ULL) >> 58; // 6 bits for 64 slots
+}
+
+// pin a gpio rule may switch: an output pin of the ESP32 not used by the gateway
+bool rulePinAllowed(unsigned int pin)
+{
+  if (pin >= 34 || pin == 20 || pin == 24 || (pin >= 28 && pin <= 31))
+  {
+    return false; // input only or not present
+  }
+  for (unsigned int i = 0; i < sizeof(reserved_pins); i++)
+  {
+    if (reserved_pins[i] == pin)
+    {
+      return false;
+    }
+  }
+  for (int i = 0; i < RECEIVER_COUNT; i++)
+  {
+    if (receiver_pins[i] == pin)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// first rule with key, -1 if none
+int findRule(const rule_table_t *table, uint64_t key)
+{
+  for (unsigned int i = 0, slot = ruleSlot(key); i < RULE_SLOTS; i++, slot = (slot + 1) % RULE_SLOTS)
+  {
+    int rule = table->slots[slot];
+    if (rule < 0 || table->rules[rule].key == key)
+    {
+      return rule;
+    }
+  }
+  return -1;
+}
+
+// "*" or a number up to max, base 16 or 10
+bool parseField(const char *text, uint32_t any, uint32_t max, int base, uint32_t *value)
+{
+  if (strcmp(text, "*") == 0)
+  {
+    *value = any;
+    return true;
+  }
+  char *end;
+  *value = strtoul(text, &end, base);
+  return *end == 0 && *value <= max;
+}
+
+/**********************************************************************************
+ *
+ * Compile one rule line into table, returns error text or ""
+ *
+ **********************************************************************************/
+
+String compileRule(rule_table_t *table, const String &line)
+{
+  char sender_text[16], group_text[16], member_text[16], action_text[16], kind_text[16];
+  int rest = 0;
+  if (sscanf(line.c_str(), "%15s %15s %15s %15s %15s %n", sender_text, group_text, member_text, action_text, kind_text, &rest) < 5 || rest == 0)
+  {
+    return "incomplete rule";
+  }
+  if (table->count == MAX_RULES)
+  {
+    return "too many rules";
+  }
+
+  uint32_t sender, group, member, action;
+  if (!parseField(sender_text, ANY_SENDER, 0xffffff, 16, &sender) ||
+      !parseField(group_text, ANY_VALUE, 15, 10, &group) ||
+      !parseField(member_text, ANY_VALUE, 15, 10, &member))
+  {
+    return "bad sender, group or member";
+  }
+  action = strcmp(action_text, "*") == 0 ? ANY_VALUE : actionNumber(action_text);
+  if (action == 0)
+  {
+    return "unknown action";
+  }
+
+  rule_t *rule = &table->rules[table->count];
+  memset(rule, 0, sizeof(rule_t));
+  rule->key = ruleKey(sender, group, member, action);
+  const char *args = line.c_str() + rest;
+  int length = 0;
+  unsigned int pin = 0;
+  char mode_text[16];
+
+  if (strcmp(kind_text, "publish") == 0 && sscanf(args, "%63s %n", rule->target, &length) == 1)
+  {
+    rule->kind = RULE_PUBLISH;
+    strncpy(rule->payload, args + length, RULE_TEXT - 1);
+  }
+  else if (strcmp(kind_text, "webhook") == 0 && sscanf(args, "%63s", rule->target) == 1)
+  {
+    rule->kind = RULE_WEBHOOK;
+  }
+  else if (strcmp(kind_text, "send") == 0 && sscanf(args, "%63s", rule->target) == 1)
+  {
+    if (!TRANSMIT_COMMANDS)
+    {
+      return "send rules need TRANSMIT_COMMANDS 1 in mqttconnection.h";
+    }
+    rule->kind = RULE_SEND;
+  }
+  else if (strcmp(kind_text, "gpio") == 0 && sscanf(args, "%u %15s", &pin, mode_text) == 2)
+  {
+    if (!rulePinAllowed(pin))
+    {
+      return "gpio pin " + String(pin) + " is used by the gateway or input only";
+    }
+    rule->kind = RULE_GPIO;
+    rule->pin = pin;
+    if (strcmp(mode_text, "on") == 0)
+      rule->mode = GPIO_ON;
+    else if (strcmp(mode_text, "off") == 0)
+      rule->mode = GPIO_OFF;
+    else if (strcmp(mode_text, "toggle") == 0)
+      rule->mode = GPIO_TOGGLE;
+    else if ((rule->pulse = atoi(mode_text)) > 0)
+      rule->mode = GPIO_PULSE;
+    else
+      return "bad gpio mode";
+  }
+  else
+  {
+    return "bad action";
+  }
+
+  // append to the rules with the same key
+  int first = findRule(table, rule->key);
+  rule->next = -1;
+  if (first < 0)
+  {
+    unsigned int slot = ruleSlot(rule->key);
+    while (table->slots[slot] >= 0)
+    {
+      slot = (slot + 1) % RULE_SLOTS;
+    }
+    table->slots[slot] = table->count;
+  }
+  else
+  {
+    while (table->rules[first].next >= 0)
+    {
+      first = table->rules[first].next;
+    }
+    table->rules[first].next = table->count;
+  }
+  table->masks |= 1 << ((sender == ANY_SENDER) << 3 | (group == ANY_VALUE) << 2 | (member == ANY_VALUE) << 1 | (action == ANY_VALUE));
+  table->count++;
+  return "";
+}
+
+/**********************************************************************************
+ *
+ * Compile rule text into compiled_rules, returns errors with line numbers
+ *
+ **********************************************************************************/
+
+String compileRules(const String &text)
+{
+  memset(&compiled_rules, 0, sizeof(compiled_rules));
+  memset(compiled_rules.slots, -1, sizeof(compiled_rules.slots));
+
+  String errors = "";
+  int start = 0, number = 1;
+  while (start < (int)text.length())
+  {
+    int end = text.indexOf('\n', start);
+    if (end < 0)
+    {
+      end = text.length();
+    }
+    String line = text.substring(start, end);
+    line.trim();
+    if (line.length() > 0 && line.charAt(0) != '#')
+    {
+      String error = compileRule(&compiled_rules, line);
+      if (error != "")
+      {
+        errors += "line " + String(number) + ": " + error + "\n";
+      }
+    }
+    start = end + 1;
+    number++;
+  }
+  return errors;
+}
+
+// make compiled rules active
+void activateRules()
+{
+  for (unsigned int i = 0; i < compiled_rules.count; i++)
+  {
+    if (compiled_rules.rules[i].kind == RULE_GPIO)
+    {
+      pinMode(compiled_rules.rules[i].pin, OUTPUT);
+    }
+  }
+  xSemaphoreTake(rules_mutex, portMAX_DELAY);
+  memcpy(&rule_table, &compiled_rules, sizeof(rule_table));
+  xSemaphoreGive(rules_mutex);
+  Serial.println("Rules: " + String(rule_table.count) + " rules active");
+}
+
+/**********************************************************************************
+ *
+ * Load rules from flash and compile them into the rule table
+ *
+ **********************************************************************************/
+
+void RulesInit()
+{
+  rules_mutex = xSemaphoreCreateMutex();
+  rule_queue = xQueueCreate(RULE_QUEUE_LENGTH, sizeof(rule_action_t));
+  String errors = compileRules(readRules());
+  if (errors != "")
+  {
+    Serial.print("Rule errors:\n" + errors); // keep the valid rules
+  }
+  activateRules();
+}
+
+String readRules()
+{
+  Preferences preferences;
+  preferences.begin(RULES_NAMESPACE, true);
+  String text = preferences.getString(RULES_KEY, DEFAULT_RULES);
+  preferences.end();
+  return text;
+}
+
+String storeRules(const String &text)
+{
+  if (text.length() > RULES_TEXT_MAX)
+  {
+    return "rules too long";
+  }
+  String errors = compileRules(text);
+  if (errors != "")
+  {
+    return errors;
+  }
+  Preferences preferences;
+  preferences.begin(RULES_NAMESPACE, false);
+  preferences.putString(RULES_KEY, text);
+  preferences.end();
+  activateRules();
+  return "";
+}
+
+/**********************************************************************************
+ *
+ * Apply rules to a command (network task)
+ *
+ **********************************************************************************/
+
+void startPulse(uint8_t pin, uint16_t length)
+{
+  rule_pulse_t *pulse = &rule_pulses[0];
+  for (int i = 0; i < RULE_PULSES; i++)
+  {
+    if (!rule_pulses[i].used || rule_pulses[i].pin == pin)
+    {
+      pulse = &rule_pulses[i];
+      break;
+    }
+  }
+  if (pulse->used && pulse->pin != pin)
+  {
+    digitalWrite(pulse->pin, LOW); // no slot left, end oldest pulse early
+  }
+  pulse->used = true;
+  pulse->pin = pin;
+  pulse->end = millis() + length;
+}
+
+void fireRule(const rule_t *rule, const command_t &command)
+{
+  if (rule->kind == RULE_GPIO && rule->mode != GPIO_PULSE)
+  {
+    bool level = rule->mode == GPIO_TOGGLE ? !digitalRead(rule->pin) : rule->mode == GPIO_ON;
+    digitalWrite(rule->pin, level);
+    return;
+  }
+  if (rule->kind == RULE_GPIO)
+  {
+    digitalWrite(rule->pin, HIGH);
+    startPulse(rule->pin, rule->pulse); // ended by runRuleActions(), not queued, so it always ends
+    return;
+  }
+  rule_action_t action;
+  action.rule = *rule;
+  action.command = command;
+  if (xQueueSend(rule_queue, &action, 0) != pdTRUE)
+  {
+    Serial.println("Rule queue full, action dropped.");
+  }
+}
+
+void applyRules(const command_t &command)
+{
+  uint32_t sender = ((uint32_t)command.id1 << 16) | ((uint32_t)command.id2 << 8) | command.id3;
+
+  xSemaphoreTake(rules_mutex, portMAX_DELAY);
+  for (int mask = 0; mask < 16; mask++)
+  {
+    if ((rule_table.masks & (1 << mask)) == 0)
+    {
+      continue; // no rule with these wildcards
+    }
+    uint64_t key = ruleKey(mask & 8 ? ANY_SENDER : sender, mask & 4 ? ANY_VALUE : command.group,
+                           mask & 2 ? ANY_VALUE : command.member, mask & 1 ? ANY_VALUE : command.action);
+    for (int rule = findRule(&rule_table, key); rule >= 0; rule = rule_table.rules[rule].next)
+    {
+      fireRule(&rule_table.rules[rule], command);
+    }
+  }
+  xSemaphoreGive(rules_mutex);
+}
+
+/**********************************************************************************
+ *
+ * End gpio pulses and do queued rule actions (network task). A webhook may
+ * take up to two RULE_WEBHOOK_TIMEOUT, so only one is called per cycle.
+ *
+ **********************************************************************************/
+
+void runRuleActions()
+{
+  unsigned long now = millis();
+  for (int i = 0; i < RULE_PULSES; i++)
+  {
+    if (rule_pulses[i].used && (long)(now - rule_pulses[i].end) >= 0)
+    {
+      digitalWrite(rule_pulses[i].pin, LOW);
+      rule_pulses[i].used = false;
+    }
+  }
+
+  rule_action_t action;
+  bool webhook = false;
+  while (!webhook && xQueueReceive(rule_queue, &action, 0) == pdTRUE)
+  {
+    const rule_t *rule = &action.rule;
+    switch (rule->kind)
+    {
+    case RULE_PUBLISH:
+      if (connectMQTT())
+      {
+        publishMQTT(rule->target, rule->payload);
+      }
+      break;
+    case RULE_WEBHOOK:
+      webhook = true;
+      if (WiFi.status() == WL_CONNECTED)
+      {
+        HTTPClient http;
+        http.setConnectTimeout(RULE_WEBHOOK_TIMEOUT);
+        http.setTimeout(RULE_WEBHOOK_TIMEOUT);
+        http.begin(rule->target);
+        int code = http.GET();
+        http.end();
+        if (code != 200)
+        {
+          Serial.println("Webhook " + String(rule->target) + " failed: " + String(code));
+        }
+      }
+      break;
+    case RULE_SEND:
+      if (TRANSMIT_COMMANDS)
+      {
+        receiveTransmitCommand((String(COMMAND_TOPIC) + rule->target).c_str());
+      }
+      break;
+    }
+  }
+}
@@ -0,0 +1,187 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: stats.cpp
+ *
+ * Statistics per sender, updated with every stored command. The senders are
+ * kept in a small hash table, so an update never scans anything.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <f2sutils.h>
+#include <stats.h>
+
+// statistics of one sender
+typedef struct
+{
+  bool used;                        // table slot in use
+  uint8_t type;                     // type of sender
+  uint32_t sender;                  // 24 bit sender id
+  uint32_t commands;                // number of commands
+  uint32_t actions[STATS_ACTIONS];  // commands per action
+  uint32_t hours[STATS_HOURS];      // commands per hour of day
+  uint32_t last_seen;               // time of last command, seconds since epoch
+  int8_t rssi_min;                  // rssi range in dBm
+  int8_t rssi_max;                  //
+  int32_t rssi_sum;                 // for average
+  uint32_t errors;                  // discarded data words
+  uint32_t repaired;                // bytes taken from their second copy
+  uint32_t timing_sum;              // sum of the timing deviations, for average
+  uint16_t timing_max;              // largest timing deviation in us
+  uint32_t suppressed;              // repeated commands not published
+} sender_stats_t;
+
+sender_stats_t sender_stats[STATS_SENDERS];
+unsigned long stats_overflow = 0; // commands of senders that did not fit into the table
+portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**********************************************************************************
+ *
+ * Find slot of sender or a free slot (linear probing), NULL if table is full
+ *
+ **********************************************************************************/
+sender_stats_t *findSender(uint32_t sender)
+{
+  unsigned int index = (sender * 2654435761u) >> 26; // 6 bit hash for 64 slots
+  for (unsigned int i = 0; i < STATS_SENDERS; i++)
+  {
+    sender_stats_t *stats = &sender_stats[(index + i) % STATS_SENDERS];
+    if (!stats->used || stats->sender == sender)
+    {
+      return stats;
+    }
+  }
+  return NULL;
+}
+
+/**********************************************************************************
+ *
+ * Find or add slot of the command's sender, NULL if table is full
+ *
+ **********************************************************************************/
+sender_stats_t *findCommandSender(const command_t &command)
+{
+  uint32_t sender = ((uint32_t)command.id1 << 16) | ((uint32_t)command.id2 << 8) | command.id3;
+  sender_stats_t *stats = findSender(sender);
+  if (stats == NULL)
+  {
+    stats_overflow++;
+  }
+  else if (!stats->used)
+  {
+    stats->used = true;
+    stats->sender = sender;
+    stats->type = command.type;
+    stats->rssi_min = command.rssi;
+    stats->rssi_max = command.rssi;
+  }
+  return stats;
+}
+
+/**********************************************************************************
+ *
+ * Update statistics of the command's sender
+ *
+ **********************************************************************************/
+void updateStats(const command_t &command, uint32_t time, int hour)
+{
+  portENTER_CRITICAL(&stats_mux);
+  sender_stats_t *stats = findCommandSender(command);
+  if (stats != NULL)
+  {
+    stats->type = command.type;
+    stats->commands++;
+    stats->actions[command.action % STATS_ACTIONS]++;
+    if (hour >= 0 && hour < STATS_HOURS)
+    {
+      stats->hours[hour]++;
+    }
+    stats->last_seen = time;
+    stats->rssi_min = min(stats->rssi_min, command.rssi);
+    stats->rssi_max = max(stats->rssi_max, command.rssi);
+    stats->rssi_sum += command.rssi;
+    stats->errors += command.errors;
+    stats->repaired += command.repaired;
+    stats->timing_sum += command.timing;
+    stats->timing_max = max(stats->timing_max, command.max_timing);
+  }
+  portEXIT_CRITICAL(&stats_mux);
+}
+
+/**********************************************************************************
+ *
+ * Count a command of the sender that was not published
+ *
+ **********************************************************************************/
+void countSuppressed(const command_t &command)
+{
+  portENTER_CRITICAL(&stats_mux);
+  sender_stats_t *stats = findCommandSender(command);
+  if (stats != NULL)
+  {
+    stats->suppressed++;
+  }
+  portEXIT_CRITICAL(&stats_mux);
+}
+
+/**********************************************************************************
+ *
+ * Create statistics of all senders as JSON string
+ *
+ **********************************************************************************/
+String statsReport()
+{
+  String report = "{\"Senders\":[";
+  bool first = true;
+  char id[7];
+
+  for (int i = 0; i < STATS_SENDERS; i++)
+  {
+    portENTER_CRITICAL(&stats_mux);
+    sender_stats_t stats = sender_stats[i];
+    portEXIT_CRITICAL(&stats_mux);
+
+    if (!stats.used)
+    {
+      continue;
+    }
+    if (!first)
+    {
+      report += ",";
+    }
+    first = false;
+
+    snprintf(id, sizeof(id), "%06x", (unsigned int)stats.sender);
+    report += "{\"Id\":\"" + String(id) + "\",\"Type\":" + String(stats.type) + ",\"Commands\":" + String(stats.commands);
+
+    report += ",\"Actions\":{";
+    bool first_action = true;
+    for (int a = 0; a < STATS_ACTIONS; a++)
+    {
+      if (stats.actions[a] != 0)
+      {
+        report += String(first_action ? "" : ",") + "\"" + actionName(a) + "\":" + String(stats.actions[a]);
+        first_action = false;
+      }
+    }
+
+    report += "},\"LastSeen\":" + String(stats.last_seen) + ",\"Hours\":[";
+    for (int h = 0; h < STATS_HOURS; h++)
+    {
+      report += String(h == 0 ? "" : ",") + String(stats.hours[h]);
+    }
+
+    report += "],\"Rssi\":{\"Min\":" + String(stats.rssi_min) + ",\"Avg\":" + String(stats.commands == 0 ? 0.0f : (float)stats.rssi_sum / stats.commands, 1U) +
+              ",\"Max\":" + String(stats.rssi_max) + "},\"Timing\":{\"Avg\":" +
+              String(stats.commands == 0 ? 0.0f : (float)stats.timing_sum / stats.commands, 1U) + ",\"Max\":" + String(stats.timing_max) +
+              "},\"Errors\":" + String(stats.errors) + ",\"Repaired\":" + String(stats.repaired) +
+              ",\"Suppressed\":" + String(stats.suppressed) + "}";
+  }
+  return report + "],\"Overflow\":" + String(stats_overflow) + "}";
+}
@@ -0,0 +1,193 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: tasks.cpp
+ *
+ * Command queue between decode and network task, hold of the commands
+ * waiting for the broker and task statistics.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <tasks.h>
+
+// command queue, written by the decode task, read by the network task
+QueueHandle_t command_queue = NULL;
+unsigned long dropped_commands = 0; // commands lost because the queue was full
+
+// commands stored locally, waiting for the broker (network task only)
+command_t held_commands[COMMAND_HOLD_LENGTH];
+unsigned int held_head = 0;          // oldest command
+unsigned int held_count = 0;         // commands waiting
+unsigned long unpublished_commands = 0; // commands dropped from the hold
+
+// task statistics
+typedef struct
+{
+  const char *name;       // task name for report
+  TaskHandle_t handle;    // for stack high water mark
+  int64_t busy_time;      // accumulated processing time in us
+  int64_t max_busy_time;  // longest single activation in us
+  unsigned long activity; // number of activations
+} task_info_t;
+
+task_info_t task_info[TASK_COUNT];
+portMUX_TYPE task_info_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// ms since boot when a startup stage was reached, 0 = not yet
+const char *boot_stage_names[BOOT_STAGES] = {"Armed", "WiFi", "Web", "MQTT"};
+volatile unsigned long boot_times[BOOT_STAGES];
+
+/**********************************************************************************
+ *
+ * Command queue
+ *
+ **********************************************************************************/
+
+void createCommandQueue()
+{
+  command_queue = xQueueCreate(COMMAND_QUEUE_LENGTH, sizeof(command_t));
+}
+
+void queueCommand(const command_t &command)
+{
+  // never block the decode task, a full queue means the network is stuck
+  if (xQueueSend(command_queue, &command, 0) != pdTRUE)
+  {
+    dropped_commands++;
+    Serial.println("Command queue full, command dropped.");
+  }
+}
+
+bool receiveCommand(command_t *command, TickType_t timeout)
+{
+  return xQueueReceive(command_queue, command, timeout) == pdTRUE;
+}
+
+/**********************************************************************************
+ *
+ * Hold of commands waiting for the broker
+ *
+ **********************************************************************************/
+
+bool holdCommand(const command_t &command, command_t *dropped)
+{
+  bool full = held_count == COMMAND_HOLD_LENGTH;
+  if (full)
+  {
+    *dropped = held_commands[held_head]; // stored locally already
+    held_head = (held_head + 1) % COMMAND_HOLD_LENGTH;
+    held_count--;
+    unpublished_commands++;
+  }
+  held_commands[(held_head + held_count) % COMMAND_HOLD_LENGTH] = command;
+  held_count++;
+  return full;
+}
+
+bool releaseCommand(command_t *command)
+{
+  if (held_count == 0)
+  {
+    return false;
+  }
+  *command = held_commands[held_head];
+  held_head = (held_head + 1) % COMMAND_HOLD_LENGTH;
+  held_count--;
+  return true;
+}
+
+/**********************************************************************************
+ *
+ * Task statistics
+ *
+ **********************************************************************************/
+
+void registerTask(uint8_t task, const char *name, TaskHandle_t handle)
+{
+  portENTER_CRITICAL(&task_info_mux);
+  task_info[task].name = name;
+  task_info[task].handle = handle;
+  portEXIT_CRITICAL(&task_info_mux);
+}
+
+void addTaskBusyTime(uint8_t task, int64_t busy_time)
+{
+  portENTER_CRITICAL(&task_info_mux);
+  task_info[task].busy_time += busy_time;
+  task_info[task].activity++;
+  if (busy_time > task_info[task].max_busy_time)
+  {
+    task_info[task].max_busy_time = busy_time;
+  }
+  portEXIT_CRITICAL(&task_info_mux);
+}
+
+/**********************************************************************************
+ *
+ * Remember time since boot when a startup stage was reached
+ *
+ **********************************************************************************/
+
+void recordBootTime(uint8_t stage)
+{
+  if (boot_times[stage] == 0)
+  {
+    boot_times[stage] = max(esp_timer_get_time() / 1000, (int64_t)1);
+    Serial.println("Boot: " + String(boot_stage_names[stage]) + " after " + String(boot_times[stage]) + " ms");
+  }
+}
+
+/**********************************************************************************
+ *
+ * Create task report as JSON string. CPU usage is the share of processing time
+ * since boot, tasks we do not measure (web server) report stack only.
+ *
+ **********************************************************************************/
+
+String taskReport()
+{
+  int64_t uptime = esp_timer_get_time();
+  String report = "{\"Uptime\":" + String((unsigned long)(uptime / 1000000)) +
+                  ",\"QueuedCommands\":" + String((unsigned int)uxQueueMessagesWaiting(command_queue)) +
+                  ",\"DroppedCommands\":" + String(dropped_commands) + ",\"HeldCommands\":" + String(held_count) +
+                  ",\"UnpublishedCommands\":" + String(unpublished_commands) + ",\"Boot\":{";
+  for (int i = 0; i < BOOT_STAGES; i++)
+  {
+    report += String(i == 0 ? "" : ",") + "\"" + boot_stage_names[i] + "\":" + String(boot_times[i]);
+  }
+  report += "},\"Tasks\":[";
+
+  bool first = true;
+  for (int i = 0; i < TASK_COUNT; i++)
+  {
+    portENTER_CRITICAL(&task_info_mux);
+    task_info_t info = task_info[i];
+    portEXIT_CRITICAL(&task_info_mux);
+
+    if (info.handle == NULL)
+    {
+      continue; // task not started (yet)
+    }
+    if (!first)
+    {
+      report += ",";
+    }
+    first = false;
+
+    report += "{\"Name\":\"" + String(info.name) + "\"";
+    if (info.activity > 0)
+    {
+      report += ",\"Cpu\":" + String(100.0 * info.busy_time / uptime, 3U);
+      report += ",\"Activations\":" + String(info.activity);
+      report += ",\"MaxBusy\":" + String((unsigned long)info.max_busy_time);
+    }
+    report += ",\"StackFree\":" + String((unsigned int)uxTaskGetStackHighWaterMark(info.handle)) + "}";
+  }
+  return report + "]}";
+}
@@ -0,0 +1,309 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: transmit.cpp
+ *
+ * Send Fernotron commands received on COMMAND_TOPIC with the CC1101.
+ *
+ * A frame is played by the RMT peripheral from a table of pulses (one high and
+ * one low period each). The tables of recently sent commands are kept in a
+ * cache; only the counter and checksum words change from one press to the
+ * next, so a cached command is ready after rewriting 4 of its 12 words.
+ *
+ * Commands are parsed and numbered by the network task (MQTT callback) and
+ * played by the transmit task, the cache belongs to the transmit task.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <driver/rmt.h>
+#include <header.h>
+#include <f2sutils.h>
+#include <mqttconnection.h>
+#include <protocol.h>
+#include <transmit.h>
+
+#define TRANSMIT_CHANNEL RMT_CHANNEL_0
+#define PREAMBLE_PULSES 7                                  // short pulses before the first sync
+#define WORD_PULSES 11                                     // sync "1B" and 10 bits
+#define FRAME_PULSES (PREAMBLE_PULSES + FRAME_WORDS * WORD_PULSES) // pulses of a frame
+
+// frame of one command, ready to play
+typedef struct
+{
+  bool used;                          // cache slot in use
+  command_t command;                  // sender, group, member and action of the frame
+  unsigned long last_use;             // for replacing the least recently used slot
+  rmt_item32_t pulses[FRAME_PULSES]; // RMT table, 1 tick = 1 us
+} waveform_t;
+
+// command counter of a sender
+typedef struct
+{
+  uint32_t sender; // 0 = slot not used
+  uint8_t counter; // last counter sent or received
+} sender_counter_t;
+
+QueueHandle_t transmit_queue = NULL;
+waveform_t waveforms[TRANSMIT_CACHE_SIZE]; // transmit task only
+unsigned long waveform_uses = 0;
+sender_counter_t sender_counters[TRANSMIT_SENDERS]; // network task only
+
+/**********************************************************************************
+ *
+ * Set up RMT channel for the transmit pin and the transmit queue
+ *
+ **********************************************************************************/
+
+void TransmitInit()
+{
+  rmt_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.rmt_mode = RMT_MODE_TX;
+  config.channel = TRANSMIT_CHANNEL;
+  config.gpio_num = TRANSMIT;
+  config.clk_div = 80; // 80 MHz APB clock => 1 us ticks
+  config.mem_block_num = 1;
+  config.tx_config.carrier_en = false; // OOK is done by the CC1101
+  config.tx_config.idle_output_en = true;
+  config.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
+  rmt_config(&config);
+  rmt_driver_install(TRANSMIT_CHANNEL, 0, 0);
+
+  transmit_queue = xQueueCreate(TRANSMIT_QUEUE_LENGTH, sizeof(command_t));
+}
+
+/**********************************************************************************
+ *
+ * Command counters (network task)
+ *
+ **********************************************************************************/
+
+uint32_t transmitSender(const command_t &command)
+{
+  return ((uint32_t)command.id1 << 16) | ((uint32_t)command.id2 << 8) | command.id3;
+}
+
+sender_counter_t *findSenderCounter(uint32_t sender)
+{
+  for (int i = 0; i < TRANSMIT_SENDERS; i++)
+  {
+    if (sender_counters[i].sender == sender)
+    {
+      return &sender_counters[i];
+    }
+  }
+  return NULL;
+}
+
+void updateTransmitCounter(const command_t &command)
+{
+  sender_counter_t *entry = findSenderCounter(transmitSender(command));
+  if (entry != NULL)
+  {
+    entry->counter = command.counter; // the real sender was used, continue after it
+  }
+}
+
+uint8_t nextCounter(uint32_t sender)
+{
+  sender_counter_t *entry = findSenderCounter(sender);
+  if (entry == NULL)
+  {
+    entry = findSenderCounter(0);
+    if (entry == NULL)
+    {
+      entry = &sender_counters[sender % TRANSMIT_SENDERS]; // table full, forget one
+    }
+    entry->sender = sender;
+    entry->counter = 0;
+  }
+  entry->counter = (entry->counter + 1) & 0x0f;
+  return entry->counter;
+}
+
+/**********************************************************************************
+ *
+ * Handle a message on COMMAND_TOPIC: "PlainSender/ID_<id>/<action>",
+ * "SunSensor/ID_<id>/<action>" or "CentralUnit/ID_<id>/Group_<g>/Member_<m>/<action>"
+ *
+ **********************************************************************************/
+
+bool receiveTransmitCommand(const char *topic)
+{
+  const char *path = topic + strlen(COMMAND_TOPIC);
+  unsigned int sender = 0, group = 0, member = 0;
+  char action[16];
+  uint8_t type;
+
+  if (sscanf(path, "PlainSender/ID_%x/%15s", &sender, action) == 2)
+  {
+    type = 1;
+  }
+  else if (sscanf(path, "SunSensor/ID_%x/%15s", &sender, action) == 2)
+  {
+    type = 2;
+  }
+  else if (sscanf(path, "CentralUnit/ID_%x/Group_%u/Member_%u/%15s", &sender, &group, &member, action) == 4)
+  {
+    type = 8;
+  }
+  else
+  {
+    Serial.println("Unknown command topic " + String(topic));
+    return false;
+  }
+
+  command_t command;
+  memset(&command, 0, sizeof(command));
+  command.type = type;
+  command.id1 = sender >> 16;
+  command.id2 = sender >> 8;
+  command.id3 = sender;
+  command.group = group;
+  command.member = member;
+  command.action = actionNumber(action);
+  if (command.id1 >> 4 != type || group > 15 || member > 7 || command.action == 0)
+  {
+    Serial.println("Invalid command topic " + String(topic));
+    return false;
+  }
+  command.counter = nextCounter(sender);
+  command.rssi = RSSI_UNKNOWN;
+  command.capture_time = esp_timer_get_time(); // for latency report
+
+  if (xQueueSend(transmit_queue, &command, 0) != pdTRUE)
+  {
+    Serial.println("Transmit queue full, command dropped.");
+    return false;
+  }
+  return true;
+}
+
+bool nextTransmitCommand(command_t *command, TickType_t timeout)
+{
+  return xQueueReceive(transmit_queue, command, timeout) == pdTRUE;
+}
+
+/**********************************************************************************
+ *
+ * Waveform cache (transmit task)
+ *
+ **********************************************************************************/
+
+rmt_item32_t pulse(unsigned int high, unsigned int low)
+{
+  rmt_item32_t item;
+  item.level0 = 1;
+  item.duration0 = high;
+  item.level1 = 0;
+  item.duration1 = low;
+  return item;
+}
+
+// sync "1B" and the 10 bits of a word, low bit first: "110" = 0, "100" = 1
+void renderWord(rmt_item32_t *pulses, uint16_t word)
+{
+  pulses[0] = pulse(symbol_length, 8 * symbol_length);
+  for (int bit = 0; bit < 10; bit++)
+  {
+    pulses[1 + bit] = (word >> bit) & 1 ? pulse(symbol_length, 2 * symbol_length) : pulse(2 * symbol_length, symbol_length);
+  }
+}
+
+bool sameWaveform(const command_t &a, const command_t &b)
+{
+  return a.id1 == b.id1 && a.id2 == b.id2 && a.id3 == b.id3 && a.group == b.group &&
+         a.member == b.member && a.action == b.action;
+}
+
+// cached frame of the command, only the counter words are rendered again
+waveform_t *prepareWaveform(const command_t &command)
+{
+  uint16_t words[FRAME_WORDS];
+  encodeCommand(command, words);
+
+  waveform_t *waveform = NULL;
+  for (int i = 0; i < TRANSMIT_CACHE_SIZE; i++)
+  {
+    if (waveforms[i].used && sameWaveform(waveforms[i].command, command))
+    {
+      waveform = &waveforms[i];
+      break;
+    }
+  }
+
+  if (waveform != NULL)
+  {
+    if (waveform->command.counter != command.counter)
+    {
+      for (int w = COUNTER_WORD; w < COUNTER_WORD + 2; w++)
+      {
+        renderWord(&waveform->pulses[PREAMBLE_PULSES + w * WORD_PULSES], words[w]);
+      }
+      for (int w = CHECKSUM_WORD; w < CHECKSUM_WORD + 2; w++)
+      {
+        renderWord(&waveform->pulses[PREAMBLE_PULSES + w * WORD_PULSES], words[w]);
+      }
+    }
+  }
+  else
+  {
+    // not cached, replace least recently used frame
+    waveform = &waveforms[0];
+    for (int i = 0; i < TRANSMIT_CACHE_SIZE && waveform->used; i++)
+    {
+      if (!waveforms[i].used || waveforms[i].last_use < waveform->last_use)
+      {
+        waveform = &waveforms[i];
+      }
+    }
+    waveform->used = true;
+    for (int p = 0; p < PREAMBLE_PULSES; p++)
+    {
+      waveform->pulses[p] = pulse(symbol_length, symbol_length);
+    }
+    for (int w = 0; w < FRAME_WORDS; w++)
+    {
+      renderWord(&waveform->pulses[PREAMBLE_PULSES + w * WORD_PULSES], words[w]);
+    }
+  }
+  waveform->command = command;
+  waveform->last_use = ++waveform_uses;
+  return waveform;
+}
+
+/**********************************************************************************
+ *
+ * Send command as Fernotron frame
+ *
+ **********************************************************************************/
+
+int64_t transmitCommand(const command_t &command)
+{
+  int64_t begin = esp_timer_get_time();
+  waveform_t *waveform = prepareWaveform(command);
+  int64_t ready = esp_timer_get_time();
+
+  setRadioTransmit(true);
+  int64_t start = esp_timer_get_time();
+  for (int r = 0; r < TRANSMIT_REPEATS; r++)
+  {
+    if (r > 0)
+    {
+      vTaskDelay(pdMS_TO_TICKS(TRANSMIT_FRAME_GAP));
+    }
+    rmt_write_items(TRANSMIT_CHANNEL, waveform->pulses, FRAME_PULSES, true);
+  }
+  setRadioTransmit(false);
+
+  Serial.printf("Transmitted %02x%02x%02x group %u member %u %s counter %u, on air %lu us after MQTT message\n",
+                command.id1, command.id2, command.id3, command.group, command.member, actionName(command.action).c_str(),
+                command.counter, (unsigned long)(start - command.capture_time));
+  return ready - begin;
+}
@@ -0,0 +1,302 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: watchdog.cpp
+ *
+ * Receiver watchdog. Reception can stop without any error message: the CC1101
+ * drops out of RX or loses its registers after a brownout, a receiver goes
+ * quiet or the decode task hangs. The network task looks at the edge and
+ * frame counters of the receivers, at a round counter of the decode task and
+ * at the state registers of the CC1101 and repairs what it finds.
+ *
+ * One fault is handled at a time, the most severe one. Each check that still
+ * finds a fault takes the next recovery step, at the latest after the fault
+ * specific waiting time. Radio faults are checked again after
+ * WATCHDOG_INTERVAL, so a CC1101 that fell out of RX is back within seconds.
+ * The events are queued until the broker is reachable. A reboot is noted in
+ * memory that survives it and published after the restart.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <esp_attr.h>
+#include <header.h>
+#include <mqttconnection.h>
+#include <receiver.h>
+#include <watchdog.h>
+
+#define WATCHDOG_REBOOT_MAGIC 0x57444f47 // marks watchdog_reboot_fault as valid
+
+#define ACTION_NONE 0
+#define ACTION_SETRX 1
+#define ACTION_CCINIT 2
+#define ACTION_REBOOT 3
+#define ACTION_RECOVERED 4
+#define ACTION_REBOOTED 5
+
+// recovery of a fault
+typedef struct
+{
+  const char *name;
+  uint8_t first_action; // first recovery step
+  uint8_t last_action;  // last recovery step
+  unsigned long wait;   // s between the steps, 0 for every check
+} watchdog_fault_t;
+
+const watchdog_fault_t watchdog_faults[] = {
+    {"ok", ACTION_NONE, ACTION_NONE, 0},
+    {"decode task stalled", ACTION_REBOOT, ACTION_REBOOT, 0},
+    {"no spi", ACTION_CCINIT, ACTION_REBOOT, 0},
+    {"registers lost", ACTION_CCINIT, ACTION_REBOOT, 0},
+    {"not in rx", ACTION_SETRX, ACTION_REBOOT, 0},
+    {"no edges", ACTION_SETRX, ACTION_CCINIT, WATCHDOG_SILENCE_TIMEOUT},
+    {"no frames", ACTION_SETRX, ACTION_CCINIT, WATCHDOG_FRAME_TIMEOUT},
+};
+
+const char *action_names[] = {"", "SetRx", "CCInit", "Reboot", "Recovered", "Rebooted"};
+
+// event waiting for the broker
+typedef struct
+{
+  uint8_t fault;
+  uint8_t action;
+  int8_t receiver;    // -1 if not a receiver fault
+  unsigned long down; // s since the fault was found
+} watchdog_event_t;
+
+// counters of a receiver
+typedef struct
+{
+  uint32_t edge_count;
+  unsigned long frames;
+  unsigned long last_edge;  // ms
+  unsigned long last_frame; // ms
+} receiver_watch_t;
+
+volatile uint32_t decode_rounds = 0; // counted by decode task
+
+// network task only
+receiver_watch_t receiver_watch[RECEIVER_COUNT];
+uint32_t last_decode_rounds = 0;
+unsigned long last_decode_round = 0; // ms
+unsigned long last_check = 0;        // ms
+watchdog_event_t watchdog_events[WATCHDOG_EVENTS];
+unsigned int event_count = 0;
+
+// read by web server as well
+uint8_t current_fault = WATCHDOG_OK;
+int8_t fault_receiver = -1;
+uint8_t last_action = ACTION_NONE;   // last recovery step of current fault
+unsigned long fault_since = 0;       // ms
+unsigned long last_action_time = 0;  // ms
+unsigned long action_counts[ACTION_REBOOTED + 1];
+unsigned long total_down_time = 0;   // s of recovered faults
+
+RTC_NOINIT_ATTR uint32_t watchdog_reboot_magic;
+RTC_NOINIT_ATTR uint32_t watchdog_reboot_fault;
+
+/**********************************************************************************
+ *
+ * Events
+ *
+ **********************************************************************************/
+
+void addEvent(uint8_t fault, uint8_t action, int8_t receiver, unsigned long down)
+{
+  if (event_count == WATCHDOG_EVENTS)
+  {
+    memmove(&watchdog_events[0], &watchdog_events[1], sizeof(watchdog_event_t) * (WATCHDOG_EVENTS - 1)); // drop oldest
+    event_count--;
+  }
+  watchdog_events[event_count++] = {fault, action, receiver, down};
+  action_counts[action]++;
+  Serial.println("Watchdog: " + String(watchdog_faults[fault].name) + ", " + action_names[action]);
+}
+
+void publishEvents()
+{
+  while (event_count > 0 && connectMQTT())
+  {
+    const watchdog_event_t *event = &watchdog_events[0];
+    String payload = "{\"Fault\":\"" + String(watchdog_faults[event->fault].name) + "\",\"Action\":\"" +
+                     action_names[event->action] + "\",\"Receiver\":" + String(event->receiver) +
+                     ",\"Down\":" + String(event->down) + "}";
+    publishMQTT(WATCHDOG_TOPIC, payload);
+    memmove(&watchdog_events[0], &watchdog_events[1], sizeof(watchdog_event_t) * (event_count - 1));
+    event_count--;
+  }
+}
+
+/**********************************************************************************
+ *
+ * Decode task round counter
+ *
+ **********************************************************************************/
+
+void decodeTaskAlive()
+{
+  decode_rounds++;
+}
+
+/**********************************************************************************
+ *
+ * Find the most severe fault
+ *
+ **********************************************************************************/
+
+uint8_t findFault(unsigned long now, int8_t *receiver)
+{
+  *receiver = -1;
+  uint32_t rounds = decode_rounds;
+  if (rounds != last_decode_rounds || last_decode_round == 0)
+  {
+    last_decode_rounds = rounds;
+    last_decode_round = now;
+  }
+  if (now - last_decode_round > WATCHDOG_STALL_TIMEOUT * 1000UL)
+  {
+    return WATCHDOG_STALLED;
+  }
+
+  uint8_t fault = checkRadio();
+  if (fault != WATCHDOG_OK)
+  {
+    return fault;
+  }
+
+  for (int i = 0; i < RECEIVER_COUNT; i++)
+  {
+    receiver_watch_t *watch = &receiver_watch[i];
+    uint32_t edge_count = receivers[i].edge_count;
+    unsigned long frames = 0;
+    for (unsigned int d = 0; d < receivers[i].decoders.count; d++)
+    {
+      frames += receivers[i].decoders.decoders[d]->frames;
+    }
+    if (edge_count != watch->edge_count || watch->last_edge == 0)
+    {
+      watch->edge_count = edge_count;
+      watch->last_edge = now;
+    }
+    if (frames != watch->frames || watch->last_frame == 0)
+    {
+      watch->frames = frames;
+      watch->last_frame = now;
+    }
+    if (now - watch->last_edge > WATCHDOG_SILENCE_TIMEOUT * 1000UL)
+    {
+      *receiver = i;
+      return WATCHDOG_SILENT;
+    }
+    if (WATCHDOG_FRAME_TIMEOUT > 0 && now - watch->last_frame > WATCHDOG_FRAME_TIMEOUT * 1000UL)
+    {
+      *receiver = i;
+      fault = WATCHDOG_NO_FRAMES; // a silent receiver after this one is more severe
+    }
+  }
+  return fault;
+}
+
+/**********************************************************************************
+ *
+ * Take the next recovery step
+ *
+ **********************************************************************************/
+
+void recover(uint8_t action, unsigned long now)
+{
+  addEvent(current_fault, action, fault_receiver, (now - fault_since) / 1000);
+  last_action = action;
+  last_action_time = now;
+  switch (action)
+  {
+  case ACTION_SETRX:
+    recoverRadio(false);
+    break;
+  case ACTION_CCINIT:
+    recoverRadio(true);
+    break;
+  case ACTION_REBOOT:
+    watchdog_reboot_magic = WATCHDOG_REBOOT_MAGIC;
+    watchdog_reboot_fault = current_fault;
+    publishEvents();
+    delay(200); // let the event leave
+    ESP.restart();
+    break;
+  }
+}
+
+void watchdogCheck()
+{
+  unsigned long now = millis();
+  if (last_check == 0 && watchdog_reboot_magic == WATCHDOG_REBOOT_MAGIC)
+  {
+    watchdog_reboot_magic = 0;
+    addEvent(min(watchdog_reboot_fault, (uint32_t)WATCHDOG_NO_FRAMES), ACTION_REBOOTED, -1, 0);
+  }
+  if (last_check != 0 && now - last_check < WATCHDOG_INTERVAL)
+  {
+    publishEvents();
+    return;
+  }
+  last_check = now;
+
+  int8_t receiver;
+  uint8_t fault = findFault(now, &receiver);
+  if (fault == WATCHDOG_OK)
+  {
+    if (current_fault != WATCHDOG_OK)
+    {
+      unsigned long down = (now - fault_since) / 1000;
+      total_down_time += down;
+      addEvent(current_fault, ACTION_RECOVERED, fault_receiver, down);
+      current_fault = WATCHDOG_OK;
+    }
+  }
+  else
+  {
+    const watchdog_fault_t *kind = &watchdog_faults[fault];
+    if (current_fault == WATCHDOG_OK)
+    {
+      fault_since = now;
+      last_action = ACTION_NONE;
+    }
+    current_fault = fault;
+    fault_receiver = receiver;
+    if (last_action < kind->last_action && (last_action == ACTION_NONE || now - last_action_time >= kind->wait * 1000UL))
+    {
+      recover(max(last_action + 1, (int)kind->first_action), now);
+    }
+  }
+  publishEvents();
+}
+
+/**********************************************************************************
+ *
+ * Create watchdog report as JSON string
+ *
+ **********************************************************************************/
+
+String watchdogReport()
+{
+  unsigned long now = millis();
+  String edges = "";
+  String frames = "";
+  for (int i = 0; i < RECEIVER_COUNT; i++)
+  {
+    edges += String(i == 0 ? "" : ",") + String((now - receiver_watch[i].last_edge) / 1000);
+    frames += String(i == 0 ? "" : ",") + String((now - receiver_watch[i].last_frame) / 1000);
+  }
+  unsigned long recoveries = action_counts[ACTION_RECOVERED];
+  return "{\"Fault\":\"" + String(watchdog_faults[current_fault].name) + "\",\"Receiver\":" + String(fault_receiver) +
+         ",\"Since\":" + String(current_fault == WATCHDOG_OK ? 0 : (now - fault_since) / 1000) +
+         ",\"SetRx\":" + String(action_counts[ACTION_SETRX]) + ",\"CCInit\":" + String(action_counts[ACTION_CCINIT]) +
+         ",\"Reboots\":" + String(action_counts[ACTION_REBOOTED]) + ",\"Recoveries\":" + String(recoveries) +
+         ",\"MeanRecovery\":" + String(recoveries == 0 ? 0 : total_down_time / recoveries) +
+         ",\"LastEdge\":[" + edges + "],\"LastFrame\":[" + frames + "]}";
+}
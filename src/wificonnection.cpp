@@ -0,0 +1,317 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: wificonnection.cpp
+ *
+ * Wi-Fi reconnect manager. A full reconnect scans all channels and waits for
+ * DHCP, several seconds in which no command can be published. A mesh drops
+ * the gateway for a moment when it moves it to another access point, mostly
+ * the same one is still there: associating with the cached BSSID and channel
+ * and the cached lease takes a few hundred milliseconds. The static address
+ * is only a bridge: starting DHCP again clears the address and with it every
+ * TCP connection, so the gateway stays on the cached lease while it may be
+ * reused and starts DHCP when the reuse time is over.
+ *
+ * The driver events only change the state, under a critical section. The
+ * network task calls wifiRun(), which starts attempts and ends timed out ones
+ * outside of it, so the event task never waits for the driver. The driver is
+ * reached through a wifi_hal_t, tools/decode/wifisim.cpp runs the state
+ * machine against a simulated mesh on Linux.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+#include <wificonnection.h>
+
+#define WIFI_WAITING 0    // for the next attempt
+#define WIFI_CONNECTING 1 // attempt started
+#define WIFI_ASSOCIATED 2 // waiting for the IP address
+#define WIFI_ONLINE 3
+
+typedef struct
+{
+  uint8_t reason;
+  unsigned long count;
+} wifi_reason_t;
+
+const char *wifi_state_names[] = {"waiting", "connecting", "associated", "online"};
+const unsigned long wifi_duration_limits[WIFI_DURATION_BUCKETS - 1] = {500, 1000, 2000, 5000, 10000, 30000, 60000};
+
+const wifi_hal_t *wifi_hal = NULL;
+portMUX_TYPE wifi_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// state, protected by wifi_mux
+uint8_t wifi_state = WIFI_WAITING;
+bool attempt_fast = false;          // current attempt uses the cache
+bool attempt_lease = false;         // current attempt reuses the lease
+unsigned long attempt_start = 0;    // ms
+unsigned long next_attempt = 0;     // ms
+unsigned long wifi_backoff = 0;     // ms, 0 after a success
+unsigned long offline_since = 0;    // ms
+
+// cache of the last connection
+bool ap_cached = false;
+uint8_t cached_bssid[6];
+int32_t cached_channel = 0;
+uint8_t associated_bssid[6];        // of current attempt
+int32_t associated_channel = 0;
+bool lease_cached = false;
+uint32_t cached_lease[4];           // ip, gateway, subnet, dns
+unsigned long lease_time = 0;       // ms when DHCP gave the lease
+uint32_t lease_duration = 0;        // s the lease is valid, 0 if unknown
+bool lease_static = false;          // online with the cached lease, DHCP not started yet
+
+// telemetry
+unsigned long fast_attempts = 0;
+unsigned long fast_connects = 0;
+unsigned long full_attempts = 0;
+unsigned long full_connects = 0;
+unsigned long timeouts = 0;
+unsigned long drops = 0;
+unsigned long dhcp_restarts = 0;    // DHCP started after a connect with the cached lease
+wifi_reason_t wifi_reasons[WIFI_REASONS];
+unsigned long wifi_durations[WIFI_DURATION_BUCKETS];
+unsigned long last_duration = 0;    // ms offline before the last connect
+
+/**********************************************************************************
+ *
+ * Start the reconnect manager
+ *
+ **********************************************************************************/
+
+void WifiManagerInit(const wifi_hal_t *hal, unsigned long now)
+{
+  wifi_hal = hal;
+  wifi_state = WIFI_WAITING;
+  next_attempt = now;
+  offline_since = now;
+}
+
+/**********************************************************************************
+ *
+ * State changes, called with wifi_mux taken
+ *
+ **********************************************************************************/
+
+void countReason(uint8_t reason)
+{
+  for (int i = 0; i < WIFI_REASONS - 1; i++)
+  {
+    if (wifi_reasons[i].count == 0 || wifi_reasons[i].reason == reason)
+    {
+      wifi_reasons[i].reason = reason;
+      wifi_reasons[i].count++;
+      return;
+    }
+  }
+  wifi_reasons[WIFI_REASONS - 1].count++; // others
+}
+
+void failAttempt(unsigned long now)
+{
+  wifi_state = WIFI_WAITING;
+  if (attempt_fast)
+  {
+    ap_cached = false; // access point gone or moved, scan right away
+    next_attempt = now;
+    return;
+  }
+  wifi_backoff = wifi_backoff == 0 ? WIFI_BACKOFF : min(2 * wifi_backoff, (unsigned long)WIFI_BACKOFF_MAX);
+  next_attempt = now + wifi_backoff;
+}
+
+// cached lease may still be used without DHCP, called with wifi_mux taken
+bool leaseReusable(unsigned long now)
+{
+  return lease_cached && now - lease_time < (uint64_t)lease_duration * 10 * WIFI_LEASE_REUSE;
+}
+
+/**********************************************************************************
+ *
+ * Driver events
+ *
+ **********************************************************************************/
+
+void wifiAssociated(const uint8_t *bssid, int32_t channel, unsigned long now)
+{
+  portENTER_CRITICAL(&wifi_mux);
+  if (wifi_state == WIFI_CONNECTING)
+  {
+    memcpy(associated_bssid, bssid, sizeof(associated_bssid));
+    associated_channel = channel;
+    wifi_state = WIFI_ASSOCIATED;
+  }
+  portEXIT_CRITICAL(&wifi_mux);
+}
+
+// new lease from DHCP, called with wifi_mux taken
+void cacheLease(const uint32_t lease[4], uint32_t duration, unsigned long now)
+{
+  memcpy(cached_lease, lease, sizeof(cached_lease));
+  lease_cached = true;
+  lease_time = now;
+  lease_duration = duration;
+}
+
+void wifiGotIp(const uint32_t lease[4], uint32_t duration, unsigned long now)
+{
+  portENTER_CRITICAL(&wifi_mux);
+  if (wifi_state == WIFI_ONLINE && !lease_static)
+  {
+    cacheLease(lease, duration, now); // DHCP started again after a connect with the cached lease
+  }
+  else if (wifi_state == WIFI_ASSOCIATED)
+  {
+    wifi_state = WIFI_ONLINE;
+    memcpy(cached_bssid, associated_bssid, sizeof(cached_bssid));
+    cached_channel = associated_channel;
+    ap_cached = true;
+    lease_static = attempt_lease;
+    if (!attempt_lease)
+    {
+      cacheLease(lease, duration, now);
+    }
+    (attempt_fast ? fast_connects : full_connects)++;
+    wifi_backoff = 0;
+
+    last_duration = now - offline_since;
+    int bucket = 0;
+    while (bucket < WIFI_DURATION_BUCKETS - 1 && last_duration >= wifi_duration_limits[bucket])
+    {
+      bucket++;
+    }
+    wifi_durations[bucket]++;
+  }
+  portEXIT_CRITICAL(&wifi_mux);
+}
+
+void wifiDisconnected(uint8_t reason, unsigned long now)
+{
+  portENTER_CRITICAL(&wifi_mux);
+  if (wifi_state == WIFI_ONLINE)
+  {
+    countReason(reason);
+    drops++;
+    offline_since = now;
+    wifi_state = WIFI_WAITING;
+    next_attempt = now; // short drop, try the cache right away
+  }
+  else if ((wifi_state == WIFI_CONNECTING || wifi_state == WIFI_ASSOCIATED) && reason != WIFI_REASON_ASSOC_LEAVE)
+  {
+    countReason(reason);
+    failAttempt(now);
+  }
+  portEXIT_CRITICAL(&wifi_mux);
+}
+
+/**********************************************************************************
+ *
+ * Start the next attempt or end a timed out one
+ *
+ **********************************************************************************/
+
+void wifiRun(unsigned long now)
+{
+  bool begin = false;
+  bool disconnect = false;
+  bool dhcp = false;
+  const uint32_t *lease = NULL;
+  const uint8_t *bssid = NULL;
+  int32_t channel = 0;
+
+  portENTER_CRITICAL(&wifi_mux);
+  if (wifi_state == WIFI_WAITING && (long)(now - next_attempt) >= 0)
+  {
+    begin = true;
+    wifi_state = WIFI_CONNECTING;
+    attempt_start = now;
+    lease_static = false;
+    attempt_fast = ap_cached;
+    attempt_lease = attempt_fast && leaseReusable(now);
+    (attempt_fast ? fast_attempts : full_attempts)++;
+    if (attempt_fast)
+    {
+      bssid = cached_bssid; // only changed by a successful attempt, not before this one ends
+      channel = cached_channel;
+    }
+    if (attempt_lease)
+    {
+      lease = cached_lease;
+    }
+  }
+  else if ((wifi_state == WIFI_CONNECTING || wifi_state == WIFI_ASSOCIATED) && now - attempt_start > WIFI_CONNECT_TIMEOUT)
+  {
+    disconnect = true;
+    timeouts++;
+    failAttempt(now);
+  }
+  else if (wifi_state == WIFI_ONLINE && lease_static && !leaseReusable(now))
+  {
+    dhcp = true; // reuse time of the cached lease over, let DHCP renew it
+    lease_static = false;
+    dhcp_restarts++;
+  }
+  portEXIT_CRITICAL(&wifi_mux);
+
+  if (begin)
+  {
+    wifi_hal->configure(lease);
+    wifi_hal->begin(bssid, channel);
+  }
+  if (disconnect)
+  {
+    wifi_hal->disconnect();
+  }
+  if (dhcp)
+  {
+    wifi_hal->configure(NULL);
+  }
+}
+
+/**********************************************************************************
+ *
+ * Create reconnect report as JSON string
+ *
+ **********************************************************************************/
+
+String wifiReport(unsigned long now)
+{
+  portENTER_CRITICAL(&wifi_mux);
+  uint8_t state = wifi_state;
+  unsigned long counters[] = {fast_attempts, fast_connects, full_attempts, full_connects, timeouts, drops,
+                              last_duration, wifi_backoff, ap_cached ? (unsigned long)cached_channel : 0, dhcp_restarts,
+                              lease_cached ? lease_duration : 0};
+  wifi_reason_t reasons[WIFI_REASONS];
+  memcpy(reasons, wifi_reasons, sizeof(reasons));
+  unsigned long durations[WIFI_DURATION_BUCKETS];
+  memcpy(durations, wifi_durations, sizeof(durations));
+  unsigned long offline = state == WIFI_ONLINE ? 0 : now - offline_since;
+  portEXIT_CRITICAL(&wifi_mux);
+
+  String report = "{\"State\":\"" + String(wifi_state_names[state]) + "\",\"Offline\":" + String(offline) +
+                  ",\"FastAttempts\":" + String(counters[0]) + ",\"FastConnects\":" + String(counters[1]) +
+                  ",\"FullAttempts\":" + String(counters[2]) + ",\"FullConnects\":" + String(counters[3]) +
+                  ",\"Timeouts\":" + String(counters[4]) + ",\"Drops\":" + String(counters[5]) +
+                  ",\"LastReconnect\":" + String(counters[6]) + ",\"Backoff\":" + String(counters[7]) +
+                  ",\"Channel\":" + String(counters[8]) + ",\"DhcpRestarts\":" + String(counters[9]) +
+                  ",\"LeaseTime\":" + String(counters[10]) + ",\"Reasons\":{";
+  for (int i = 0; i < WIFI_REASONS; i++)
+  {
+    if (reasons[i].count > 0)
+    {
+      report += String(report.charAt(report.length() - 1) == '{' ? "\"" : ",\"") +
+                (i == WIFI_REASONS - 1 ? String("other") : String(reasons[i].reason)) + "\":" + String(reasons[i].count);
+    }
+  }
+  report += "},\"Reconnect\":[";
+  for (int i = 0; i < WIFI_DURATION_BUCKETS; i++)
+  {
+    report += String(i == 0 ? "" : ",") + String(durations[i]);
+  }
+  return report + "]}";
+}
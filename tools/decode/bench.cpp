@@ -0,0 +1,317 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: bench.cpp
+ *
+ * Glitch filter benchmark on Linux. A waveform generator renders synthetic
+ * frames with timing jitter, noise between the frames and bursts of short
+ * spikes, a quarter of them right next to an edge (e.g. at the end of a sync
+ * gap). The same signal is decoded with several glitch filter settings, the
+ * table shows the frames decoded correctly, the periods removed and merged by
+ * the filter and the cpu time per edge.
+ *
+ * -o writes every frame as capture file into a directory, to decode it with
+ * fernotron-decode (e.g. with another decoder version).
+ *
+ * Usage: fernotron-bench [-n frames] [-j jitter] [-g glitch percent] [-b burst] [-w width] [-s seed] [-o directory]
+ *
+ */
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+#include <header.h>
+#include <protocol.h>
+#include <merge.h>
+#include <heapmon.h>
+#include <longframe.h>
+#include <allowlist.h>
+
+#define BENCH_FRAMES 2000  // default number of frames
+#define BENCH_JITTER 60    // us, largest timing deviation of a period
+#define BENCH_GLITCHES 3   // percent of periods with a burst of spikes
+#define BENCH_BURST 3      // most spikes in a burst
+#define BENCH_WIDTH 45     // us, widest spike
+#define BENCH_NOISE_EDGES 20 // noise edges between frames
+
+// filter settings compared
+typedef struct
+{
+  const char *name;
+  unsigned int widths[MAX_GLITCH_STAGES];
+  unsigned int stage_count;
+} bench_setting_t;
+
+const bench_setting_t settings[] = {
+    {"none", {}, 0},
+    {"25", {25}, 1},
+    {"50", {50}, 1},
+    {"100", {100}, 1},
+    {"25,50", {25, 50}, 2},
+    {"50,100", {50, 100}, 2},
+};
+
+command_t expected;          // command of the frame being decoded
+unsigned long correct = 0;   // frames decoded with the expected command
+unsigned long wrong = 0;     // frames decoded with another command
+
+/**********************************************************************************
+ *
+ * Firmware functions used by the decoders
+ *
+ **********************************************************************************/
+
+void mergeCommand(const command_t &command)
+{
+  if (command.id1 == expected.id1 && command.id2 == expected.id2 && command.id3 == expected.id3 &&
+      command.counter == expected.counter && command.group == expected.group && command.member == expected.member &&
+      command.action == expected.action)
+  {
+    correct++;
+  }
+  else
+  {
+    wrong++;
+  }
+}
+
+void queueLongFrame(const long_frame_t &frame)
+{
+}
+
+bool senderAllowed(uint32_t sender)
+{
+  return true;
+}
+
+void learnSender(uint32_t sender)
+{
+}
+
+int receiverRssi(uint8_t receiver)
+{
+  return RSSI_UNKNOWN;
+}
+
+heap_mark_t heapMark()
+{
+  heap_mark_t mark;
+  memset(&mark, 0, sizeof(mark));
+  return mark;
+}
+
+void heapStage(uint8_t stage, const heap_mark_t &begin)
+{
+}
+
+/**********************************************************************************
+ *
+ * Waveform generator
+ *
+ **********************************************************************************/
+
+unsigned int jitter = BENCH_JITTER;
+unsigned int glitch_percent = BENCH_GLITCHES;
+unsigned int burst = BENCH_BURST;
+unsigned int width = BENCH_WIDTH;
+
+int randomRange(int low, int high)
+{
+  return low + rand() % (high - low + 1);
+}
+
+void addEdge(std::vector<uint32_t> *edges, uint32_t *time, uint8_t level, unsigned int duration)
+{
+  *time += duration;
+  edges->push_back((*time << 1) | level);
+}
+
+// one period with jitter, maybe split by a burst of spikes of the other level
+void addPeriod(std::vector<uint32_t> *edges, uint32_t *time, uint8_t level, unsigned int duration)
+{
+  duration = max(duration + randomRange(-(int)jitter, jitter), 2 * width);
+  if ((unsigned int)randomRange(0, 99) >= glitch_percent)
+  {
+    addEdge(edges, time, level, duration);
+    return;
+  }
+
+  unsigned int spikes = randomRange(1, burst);
+  unsigned int burst_length = 0;
+  unsigned int widths[2 * BENCH_BURST];
+  for (unsigned int i = 0; i < 2 * spikes - 1; i++)
+  {
+    widths[i] = randomRange(5, i % 2 == 0 ? width : 30); // spike, then gap to the next spike
+    burst_length += widths[i];
+  }
+  if (burst_length + 10 > duration)
+  {
+    addEdge(edges, time, level, duration);
+    return;
+  }
+  unsigned int free_time = duration - burst_length - 10;
+  unsigned int position;
+  switch (randomRange(0, 7))
+  {
+  case 0:
+    position = 5 + randomRange(0, min(free_time, 100u)); // right after the edge
+    break;
+  case 1:
+    position = 5 + free_time - randomRange(0, min(free_time, 100u)); // right before the edge
+    break;
+  default:
+    position = 5 + randomRange(0, free_time);
+  }
+  addEdge(edges, time, level, position);
+  for (unsigned int i = 0; i < 2 * spikes - 1; i++)
+  {
+    addEdge(edges, time, i % 2 == 0 ? level ^ 1 : level, widths[i]);
+  }
+  addEdge(edges, time, level, duration - position - burst_length);
+}
+
+void frameEdges(const command_t &command, std::vector<uint32_t> *edges, uint32_t *time)
+{
+  // noise, then the gap before the frame
+  for (int i = 0; i < BENCH_NOISE_EDGES; i++)
+  {
+    addEdge(edges, time, i % 2, randomRange(60, 3000));
+  }
+  addEdge(edges, time, 0, 20000);
+
+  uint16_t words[FRAME_WORDS];
+  encodeCommand(command, words);
+  for (int i = 0; i < 7; i++)
+  {
+    addPeriod(edges, time, 1, symbol_length);
+    addPeriod(edges, time, 0, symbol_length);
+  }
+  for (int w = 0; w < FRAME_WORDS; w++)
+  {
+    addPeriod(edges, time, 1, symbol_length);
+    addPeriod(edges, time, 0, 8 * symbol_length);
+    for (int bit = 0; bit < 10; bit++)
+    {
+      bool one = (words[w] >> bit) & 1;
+      addPeriod(edges, time, 1, one ? symbol_length : 2 * symbol_length);
+      addPeriod(edges, time, 0, one ? 2 * symbol_length : symbol_length);
+    }
+  }
+  addPeriod(edges, time, 1, symbol_length); // ends the last word
+  addEdge(edges, time, 0, 20000);
+}
+
+/**********************************************************************************
+ *
+ * Main
+ *
+ **********************************************************************************/
+
+int main(int argc, char **argv)
+{
+  unsigned long frames = BENCH_FRAMES;
+  unsigned int seed = 1;
+  const char *directory = NULL;
+  int option;
+  while ((option = getopt(argc, argv, "n:j:g:b:w:s:o:")) != -1)
+  {
+    switch (option)
+    {
+    case 'n':
+      frames = strtoul(optarg, NULL, 10);
+      break;
+    case 'j':
+      jitter = atoi(optarg);
+      break;
+    case 'g':
+      glitch_percent = atoi(optarg);
+      break;
+    case 'b':
+      burst = max(1, min(atoi(optarg), BENCH_BURST));
+      break;
+    case 'w':
+      width = max(5, atoi(optarg));
+      break;
+    case 's':
+      seed = atoi(optarg);
+      break;
+    case 'o':
+      directory = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n frames] [-j jitter] [-g glitch percent] [-b burst] [-w width] [-s seed] [-o directory]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  // render all frames once
+  srand(seed);
+  std::vector<command_t> commands(frames);
+  std::vector<std::vector<uint32_t>> signals(frames);
+  uint32_t time = 1000;
+  unsigned long edge_count = 0;
+  for (unsigned long n = 0; n < frames; n++)
+  {
+    command_t &command = commands[n];
+    memset(&command, 0, sizeof(command));
+    uint32_t sender = 0x800000 + n % 0x10000;
+    command.type = 8;
+    command.id1 = sender >> 16;
+    command.id2 = (sender >> 8) & 0xff;
+    command.id3 = sender & 0xff;
+    command.counter = rand() % 16;
+    command.group = rand() % 8;
+    command.member = rand() % 8;
+    command.action = 3 + rand() % 3;
+    frameEdges(command, &signals[n], &time);
+    edge_count += signals[n].size();
+
+    if (directory != NULL)
+    {
+      char path[256];
+      snprintf(path, sizeof(path), "%s/bench%05lu.bin", directory, n);
+      FILE *file = fopen(path, "wb");
+      if (file == NULL)
+      {
+        fprintf(stderr, "cannot write %s\n", path);
+        return 1;
+      }
+      fwrite(signals[n].data(), sizeof(uint32_t), signals[n].size(), file);
+      fclose(file);
+    }
+  }
+  printf("%lu frames, %lu edges, jitter %u us, glitches in %u %% of the periods, bursts up to %u spikes of up to %u us\n\n",
+         frames, edge_count, jitter, glitch_percent, burst, width);
+
+  printf("%-10s %10s %10s %10s %10s %12s\n", "stages", "decoded", "wrong", "glitches", "merged", "ns/edge");
+  for (const bench_setting_t &setting : settings)
+  {
+    decoder_registry_t registry;
+    memset(&registry, 0, sizeof(registry));
+    setGlitchStages(&registry.filter, setting.widths, setting.stage_count);
+    decoder_t *decoder = createFernotronDecoder(0);
+    registerDecoder(&registry, decoder);
+    registry.previous_edge_time = signals[0][0] >> 1;
+    correct = 0;
+    wrong = 0;
+
+    int64_t busy_time = 0;
+    for (unsigned long n = 0; n < frames; n++)
+    {
+      expected = commands[n];
+      const std::vector<uint32_t> &edges = signals[n];
+      int64_t begin = esp_timer_get_time();
+      for (size_t i = 0; i < edges.size(); i += EDGE_BATCH)
+      {
+        feedDecoders(&registry, edges.data() + i, min(edges.size() - i, (size_t)EDGE_BATCH));
+      }
+      busy_time += esp_timer_get_time() - begin;
+    }
+    printf("%-10s %9.1f%% %10lu %10lu %10lu %12.1f\n", setting.name, 100.0 * correct / max(frames, 1UL), wrong,
+           registry.filter.glitches, registry.filter.merged, 1000.0 * busy_time / max(edge_count, 1UL));
+    free(decoder->state);
+    free(decoder);
+  }
+  return 0;
+}
@@ -0,0 +1,460 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: coordsim.cpp
+ *
+ * Gateway coordination (coordination.cpp) of two gateways through a real MQTT
+ * broker on Linux. Each gateway runs in a process of its own, so each has its
+ * own election table. Both receive the same frames a few ms apart and with
+ * different rssi, like two gateways in one building, announce them on
+ * COORDINATION_TOPIC and publish them or keep only their state. sendMessage()
+ * and updateState() without publish report on RESULT_TOPIC, the parent process
+ * collects the reports and checks them:
+ *
+ *  - a frame received by both gateways is published exactly once, by the one
+ *    with the better rssi (the lower id at a tie), the other keeps the state
+ *  - a frame received by one gateway only is published by it
+ *  - in a burst of more frames than ELECTION_SLOTS no frame is lost
+ *
+ * Needs a broker without authentication, e.g. mosquitto on this computer.
+ *
+ * Usage: fernotron-coordsim [-h host] [-p port] [-s seed]
+ *
+ */
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <header.h>
+#include <mqttconnection.h>
+#include <mqttmessage.h>
+#include <history.h>
+#include <coordination.h>
+
+#define RESULT_TOPIC MQTT_CLIENT_ID "/CoordSim/Results" // "P" published or "S" state kept, gateway, sender
+#define SIM_FRAMES 200        // single frames
+#define SIM_FRAME_SPACING 50  // ms between single frames
+#define SIM_ONE_GATEWAY 10    // percent of single frames received by one gateway only
+#define SIM_JITTER 20         // ms between the decodes of the two gateways at most
+#define SIM_BURSTS 5          // bursts of frames
+#define SIM_BURST_FRAMES 12   // frames per burst, more than ELECTION_SLOTS
+#define SIM_BURST_SPACING 2   // ms between frames of a burst
+#define SIM_BURST_PAUSE 500   // ms between bursts
+#define SIM_START 1000        // ms until the gateways are connected
+#define SIM_SETTLE 1000       // ms after the last frame until the elections are over
+
+#define FRAME_BOTH 0
+#define FRAME_ONE 1
+#define FRAME_BURST 2
+
+typedef struct
+{
+  int kind;
+  uint32_t sender;     // unique per frame
+  bool received[2];    // by gateway 1 and 2
+  int8_t rssi[2];
+  unsigned long at[2]; // ms after start
+} sim_frame_t;
+
+typedef struct
+{
+  int socket;
+  std::string input; // received bytes not parsed yet
+} mqtt_t;
+
+typedef void (*mqtt_handler_t)(const std::string &topic, const std::string &payload);
+
+mqtt_t gateway_mqtt; // of the gateway process
+uint32_t gateway = 0;
+
+/**********************************************************************************
+ *
+ * Minimal MQTT 3.1.1 client, QoS 0 only
+ *
+ **********************************************************************************/
+
+std::string mqttString(const std::string &text)
+{
+  return std::string(1, (char)(text.size() >> 8)) + std::string(1, (char)(text.size() & 0xff)) + text;
+}
+
+void mqttSend(mqtt_t *mqtt, uint8_t header, const std::string &body)
+{
+  std::string packet(1, (char)header);
+  size_t length = body.size();
+  do
+  {
+    uint8_t digit = length % 128;
+    length /= 128;
+    packet += (char)(length > 0 ? digit | 0x80 : digit);
+  } while (length > 0);
+  packet += body;
+  if (send(mqtt->socket, packet.data(), packet.size(), MSG_NOSIGNAL) != (ssize_t)packet.size())
+  {
+    perror("send");
+    exit(2);
+  }
+}
+
+// wait up to timeout ms for data, handle complete packets, returns the type of the last one or 0
+int mqttRead(mqtt_t *mqtt, int timeout, mqtt_handler_t handler)
+{
+  struct pollfd ready = {mqtt->socket, POLLIN, 0};
+  if (poll(&ready, 1, timeout) > 0)
+  {
+    char buffer[4096];
+    ssize_t count = recv(mqtt->socket, buffer, sizeof(buffer), 0);
+    if (count <= 0)
+    {
+      fprintf(stderr, "broker closed the connection\n");
+      exit(2);
+    }
+    mqtt->input.append(buffer, count);
+  }
+
+  int type = 0;
+  for (;;)
+  {
+    size_t length = 0, position = 1;
+    unsigned int shift = 0;
+    do
+    {
+      if (position >= mqtt->input.size())
+      {
+        return type; // incomplete
+      }
+      length |= (size_t)(mqtt->input[position] & 0x7f) << shift;
+      shift += 7;
+    } while (mqtt->input[position++] & 0x80);
+    if (mqtt->input.size() < position + length)
+    {
+      return type;
+    }
+    uint8_t header = mqtt->input[0];
+    std::string body = mqtt->input.substr(position, length);
+    mqtt->input.erase(0, position + length);
+    type = header >> 4;
+    if (type == 3 && handler != NULL) // PUBLISH
+    {
+      size_t topic_length = ((uint8_t)body[0] << 8) | (uint8_t)body[1];
+      size_t start = 2 + topic_length + ((header >> 1) & 3 ? 2 : 0); // packet id if QoS > 0
+      handler(body.substr(2, topic_length), body.substr(start));
+    }
+  }
+}
+
+void mqttConnect(mqtt_t *mqtt, const char *host, const char *port, const std::string &client_id)
+{
+  struct addrinfo hints, *address;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &address) != 0)
+  {
+    fprintf(stderr, "unknown broker %s\n", host);
+    exit(2);
+  }
+  mqtt->socket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+  if (connect(mqtt->socket, address->ai_addr, address->ai_addrlen) != 0)
+  {
+    fprintf(stderr, "no broker at %s:%s\n", host, port);
+    exit(2);
+  }
+  freeaddrinfo(address);
+  int on = 1;
+  setsockopt(mqtt->socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+  // protocol level 4, clean session, keep alive 60 s
+  mqttSend(mqtt, 0x10, mqttString("MQTT") + std::string("\x04\x02\x00\x3c", 4) + mqttString(client_id));
+  while (mqttRead(mqtt, 5000, NULL) != 2) // CONNACK
+  {
+  }
+}
+
+void mqttSubscribe(mqtt_t *mqtt, const char *topic)
+{
+  mqttSend(mqtt, 0x82, std::string("\x00\x01", 2) + mqttString(topic) + std::string(1, 0));
+  while (mqttRead(mqtt, 5000, NULL) != 9) // SUBACK
+  {
+  }
+}
+
+void mqttPublish(mqtt_t *mqtt, const char *topic, const char *payload)
+{
+  mqttSend(mqtt, 0x30, mqttString(topic) + payload);
+}
+
+/**********************************************************************************
+ *
+ * Gateway functions used by coordination.cpp
+ *
+ **********************************************************************************/
+
+void publishMQTT(String topic, String payload)
+{
+  mqttPublish(&gateway_mqtt, topic.c_str(), payload.c_str());
+}
+
+void reportResult(char result, const command_t &command)
+{
+  char payload[32];
+  snprintf(payload, sizeof(payload), "%c,%u,%02x%02x%02x", result, (unsigned int)gateway, command.id1, command.id2, command.id3);
+  mqttPublish(&gateway_mqtt, RESULT_TOPIC, payload);
+}
+
+void sendMessage(const command_t &command)
+{
+  reportResult('P', command);
+}
+
+void updateState(const command_t &command, int64_t time, bool publish)
+{
+  if (!publish)
+  {
+    reportResult('S', command);
+  }
+}
+
+int64_t captureTime(const command_t &command)
+{
+  return command.capture_time / 1000;
+}
+
+/**********************************************************************************
+ *
+ * Gateway process: decode the frames at their time, run the election
+ *
+ **********************************************************************************/
+
+void handleAnnouncement(const std::string &topic, const std::string &payload)
+{
+  if (topic == COORDINATION_TOPIC)
+  {
+    receiveAnnouncement(payload.data(), payload.size());
+  }
+}
+
+void runGateway(int index, const std::vector<sim_frame_t> &frames, int64_t start, const char *host, const char *port)
+{
+  gateway = index + 1;
+  CoordinationInit(gateway);
+  mqttConnect(&gateway_mqtt, host, port, "coordsim-" + std::to_string(getpid()));
+  mqttSubscribe(&gateway_mqtt, COORDINATION_TOPIC);
+
+  // frames received by this gateway in the order of decoding
+  std::vector<std::pair<unsigned long, size_t>> decodes;
+  for (size_t i = 0; i < frames.size(); i++)
+  {
+    if (frames[i].received[index])
+    {
+      decodes.push_back({frames[i].at[index], i});
+    }
+  }
+  std::sort(decodes.begin(), decodes.end());
+  unsigned long end = decodes.empty() ? 0 : decodes.back().first + SIM_SETTLE;
+
+  size_t next = 0;
+  for (;;)
+  {
+    int64_t now = (esp_timer_get_time() - start) / 1000;
+    if (now > (int64_t)end)
+    {
+      break;
+    }
+    while (next < decodes.size() && (int64_t)decodes[next].first <= now)
+    {
+      const sim_frame_t &frame = frames[decodes[next++].second];
+      command_t command;
+      memset(&command, 0, sizeof(command));
+      command.type = 1;
+      command.id1 = frame.sender >> 16;
+      command.id2 = frame.sender >> 8;
+      command.id3 = frame.sender;
+      command.action = 2;
+      command.rssi = frame.rssi[index];
+      command.capture_time = esp_timer_get_time();
+      electCommand(command);
+    }
+    mqttRead(&gateway_mqtt, 1, handleAnnouncement);
+    runElection();
+  }
+  close(gateway_mqtt.socket);
+}
+
+/**********************************************************************************
+ *
+ * Main: create the frames, start the gateways and check their results
+ *
+ **********************************************************************************/
+
+std::vector<std::vector<unsigned int>> published; // gateways per frame
+std::vector<std::vector<unsigned int>> stored;
+uint32_t first_sender = 0x80a000;
+unsigned long announcements = 0;
+
+void handleResult(const std::string &topic, const std::string &payload)
+{
+  if (topic == COORDINATION_TOPIC)
+  {
+    announcements++;
+    return;
+  }
+  char result;
+  unsigned int gateway, sender;
+  if (topic != RESULT_TOPIC || sscanf(payload.c_str(), "%c,%u,%x", &result, &gateway, &sender) != 3 ||
+      sender < first_sender || sender - first_sender >= published.size())
+  {
+    return;
+  }
+  (result == 'P' ? published : stored)[sender - first_sender].push_back(gateway);
+}
+
+int8_t randomRssi()
+{
+  return -95 + rand() % 61;
+}
+
+int main(int argc, char **argv)
+{
+  const char *host = "localhost";
+  const char *port = "1883";
+  unsigned int seed = 1;
+  int option;
+  while ((option = getopt(argc, argv, "h:p:s:")) != -1)
+  {
+    switch (option)
+    {
+    case 'h':
+      host = optarg;
+      break;
+    case 'p':
+      port = optarg;
+      break;
+    case 's':
+      seed = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-h host] [-p port] [-s seed]\n", argv[0]);
+      return 2;
+    }
+  }
+  srand(seed);
+
+  // single frames, then bursts, senders unique so the results can be matched
+  std::vector<sim_frame_t> frames;
+  unsigned long at = 0;
+  for (int i = 0; i < SIM_FRAMES + SIM_BURSTS * SIM_BURST_FRAMES; i++)
+  {
+    sim_frame_t frame;
+    bool burst = i >= SIM_FRAMES;
+    frame.kind = burst ? FRAME_BURST : rand() % 100 < SIM_ONE_GATEWAY ? FRAME_ONE : FRAME_BOTH;
+    frame.sender = first_sender + i;
+    int only = rand() % 2;
+    for (int g = 0; g < 2; g++)
+    {
+      frame.received[g] = frame.kind != FRAME_ONE || g == only;
+      frame.rssi[g] = randomRssi();
+    }
+    if (burst)
+    {
+      int position = (i - SIM_FRAMES) % SIM_BURST_FRAMES;
+      at += position == 0 ? SIM_BURST_PAUSE : SIM_BURST_SPACING;
+    }
+    else
+    {
+      at += SIM_FRAME_SPACING;
+    }
+    unsigned long jitter = rand() % (SIM_JITTER + 1);
+    int later = rand() % 2;
+    frame.at[later] = at + jitter;
+    frame.at[1 - later] = at;
+    frames.push_back(frame);
+  }
+  published.resize(frames.size());
+  stored.resize(frames.size());
+
+  mqtt_t observer;
+  mqttConnect(&observer, host, port, "coordsim-" + std::to_string(getpid()));
+  mqttSubscribe(&observer, RESULT_TOPIC);
+  mqttSubscribe(&observer, COORDINATION_TOPIC);
+
+  int64_t start = esp_timer_get_time() + SIM_START * 1000;
+  pid_t gateways[2];
+  for (int g = 0; g < 2; g++)
+  {
+    gateways[g] = fork();
+    if (gateways[g] == 0)
+    {
+      close(observer.socket);
+      runGateway(g, frames, start, host, port);
+      _exit(0);
+    }
+  }
+
+  int running = 2, failed = 0;
+  int64_t done = 0;
+  while (running > 0 || esp_timer_get_time() - done < 500000)
+  {
+    mqttRead(&observer, 10, handleResult);
+    int status;
+    pid_t pid = waitpid(-1, &status, WNOHANG);
+    if (pid > 0)
+    {
+      running--;
+      failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+      done = esp_timer_get_time();
+    }
+  }
+
+  // check the results per kind of frame
+  unsigned long counts[3] = {0, 0, 0}, wrong[3] = {0, 0, 0}, lost = 0, duplicates = 0;
+  for (size_t i = 0; i < frames.size(); i++)
+  {
+    const sim_frame_t &frame = frames[i];
+    counts[frame.kind]++;
+    lost += published[i].empty();
+    duplicates += published[i].size() > 1 ? published[i].size() - 1 : 0;
+    bool ok = published[i].size() >= 1;
+    if (frame.kind == FRAME_BOTH)
+    {
+      unsigned int best = frame.rssi[0] >= frame.rssi[1] ? 1 : 2;
+      ok = published[i].size() == 1 && published[i][0] == best && stored[i].size() == 1 && stored[i][0] == 3 - best;
+    }
+    else if (frame.kind == FRAME_ONE)
+    {
+      ok = published[i].size() == 1 && published[i][0] == (frame.received[0] ? 1u : 2u) && stored[i].empty();
+    }
+    if (!ok)
+    {
+      wrong[frame.kind]++;
+      printf("frame %06x (kind %d, rssi %d/%d): published by", (unsigned int)frame.sender, frame.kind, frame.rssi[0], frame.rssi[1]);
+      for (unsigned int g : published[i])
+      {
+        printf(" %u", g);
+      }
+      printf(", state kept by");
+      for (unsigned int g : stored[i])
+      {
+        printf(" %u", g);
+      }
+      printf("\n");
+    }
+  }
+
+  printf("both gateways   %4lu frames, %lu wrong\n", counts[FRAME_BOTH], wrong[FRAME_BOTH]);
+  printf("one gateway     %4lu frames, %lu wrong\n", counts[FRAME_ONE], wrong[FRAME_ONE]);
+  printf("bursts          %4lu frames, %lu lost\n", counts[FRAME_BURST], wrong[FRAME_BURST]);
+  printf("lost %lu, published twice %lu, %.2f announcements per frame\n", lost, duplicates, (double)announcements / frames.size());
+
+  bool pass = failed == 0 && wrong[FRAME_BOTH] == 0 && wrong[FRAME_ONE] == 0 && lost == 0;
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,485 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: decode.cpp
+ *
+ * Batch decoder for capture files on Linux. Runs the firmware decoders
+ * (decoder.cpp, protocol.cpp) on many captures in parallel to check a decoder
+ * change against a corpus of field recordings.
+ *
+ * A capture file holds the edges as the receiver interrupt stores them: 32 bit
+ * little endian words, time in us << 1 | level. Files are memory mapped and
+ * fed to a fresh decoder registry in EDGE_BATCH chunks, like the decode task
+ * does. Files are spread over the worker threads, a worker that runs out of
+ * files steals from the others.
+ *
+ * With -r the edges pass the RMT capture backend (rmtcapture.cpp) and a
+ * simulated RMT receiver first, to see what CAPTURE_RMT would decode.
+ *
+ * Usage: fernotron-decode [-j threads] [-r] [-o results] [-d previous] files or directories
+ *
+ * Results have one line per file: path, frame count and the decoded commands
+ * (type:id:counter:group:member:action:errors), long frames as
+ * Ltype:id:counter:lines:bad lines. -d compares the results with the output of
+ * a previous decoder version.
+ *
+ */
+
+#include <Arduino.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <header.h>
+#include <protocol.h>
+#include <merge.h>
+#include <heapmon.h>
+#include <longframe.h>
+#include <allowlist.h>
+#include <rmtcapture.h>
+
+// result of one capture file
+typedef struct
+{
+  std::string path;
+  bool readable;
+  unsigned long edges;
+  unsigned long frames;
+  int64_t decode_time; // us
+  unsigned long lost_blocks; // RMT memory full
+  unsigned long glitches;    // removed by the glitch filter
+  unsigned long merged;      // periods joined by the glitch filter
+  std::string commands;
+} file_result_t;
+
+// files of one worker, the owner takes from the back, thieves from the front
+typedef struct
+{
+  std::mutex mutex;
+  std::deque<unsigned int> files;
+} work_queue_t;
+
+std::vector<file_result_t> results;
+std::vector<work_queue_t> work_queues;
+thread_local file_result_t *current_result = NULL; // result of the file decoded by this thread
+bool rmt_capture = false;                          // decode through the simulated RMT receiver
+
+/**********************************************************************************
+ *
+ * Firmware functions used by the decoders
+ *
+ **********************************************************************************/
+
+void mergeCommand(const command_t &command)
+{
+  char text[48];
+  snprintf(text, sizeof(text), "%s%u:%02x%02x%02x:%u:%u:%u:%u:%u", current_result->commands.empty() ? "" : " ",
+           command.type, command.id1, command.id2, command.id3, command.counter, command.group, command.member,
+           command.action, command.errors);
+  current_result->commands += text;
+}
+
+void queueLongFrame(const long_frame_t &frame)
+{
+  char text[64];
+  snprintf(text, sizeof(text), "%sL%u:%02x%02x%02x:%u:%u:%u", current_result->commands.empty() ? "" : " ",
+           frame.command.type, frame.command.id1, frame.command.id2, frame.command.id3, frame.command.counter,
+           frame.lines, __builtin_popcount(frame.bad_lines));
+  current_result->commands += text;
+}
+
+bool senderAllowed(uint32_t sender)
+{
+  return true;
+}
+
+void learnSender(uint32_t sender)
+{
+}
+
+int receiverRssi(uint8_t receiver)
+{
+  return RSSI_UNKNOWN;
+}
+
+heap_mark_t heapMark()
+{
+  heap_mark_t mark;
+  memset(&mark, 0, sizeof(mark));
+  return mark;
+}
+
+void heapStage(uint8_t stage, const heap_mark_t &begin)
+{
+}
+
+/**********************************************************************************
+ *
+ * Decode edges through the RMT capture backend, the simulated RMT receiver
+ * gets them in EDGE_BATCH chunks and the backend is read after each chunk
+ *
+ **********************************************************************************/
+
+void feedRmtEdges(receiver_t *receiver, decoder_registry_t *registry)
+{
+  uint32_t edges[EDGE_BATCH];
+  unsigned int count;
+  while ((count = receiver->source->read(receiver, edges, EDGE_BATCH)) > 0)
+  {
+    feedDecoders(registry, edges, count);
+  }
+}
+
+void decodeRmt(file_result_t *result, decoder_registry_t *registry, const uint32_t *edges, size_t count)
+{
+  receiver_t *receiver = (receiver_t *)calloc(1, sizeof(receiver_t));
+  receiver->pin = RECEIVE;
+  receiver->source = &rmt_edge_source;
+  receiver->source->start(receiver);
+  rmt_capture_t *capture = (rmt_capture_t *)receiver->source_state;
+  if (capture == NULL)
+  {
+    free(receiver);
+    return;
+  }
+
+  for (size_t i = 0; i < count; i += EDGE_BATCH)
+  {
+    simulateRmtEdges(capture->channel, edges + i, min(count - i, (size_t)EDGE_BATCH));
+    feedRmtEdges(receiver, registry);
+  }
+  simulateRmtEnd(capture->channel);
+  feedRmtEdges(receiver, registry);
+
+  result->lost_blocks = simulatedRmtOverflows(capture->channel);
+  rmt_driver_uninstall(capture->channel);
+  free(capture);
+  free(receiver);
+}
+
+/**********************************************************************************
+ *
+ * Decode one capture file
+ *
+ **********************************************************************************/
+
+void decodeFile(file_result_t *result)
+{
+  current_result = result;
+  int file = open(result->path.c_str(), O_RDONLY);
+  struct stat info;
+  if (file < 0 || fstat(file, &info) != 0)
+  {
+    if (file >= 0)
+      close(file);
+    return;
+  }
+  result->readable = true;
+  size_t count = info.st_size / sizeof(uint32_t);
+  if (count == 0)
+  {
+    close(file);
+    return;
+  }
+  const uint32_t *edges = (const uint32_t *)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (edges == MAP_FAILED)
+  {
+    result->readable = false;
+    return;
+  }
+  madvise((void *)edges, info.st_size, MADV_SEQUENTIAL);
+
+  decoder_registry_t registry;
+  memset(&registry, 0, sizeof(registry));
+  decoder_t *decoder = createFernotronDecoder(0);
+  registerDecoder(&registry, decoder);
+  registry.previous_edge_time = edges[0] >> 1;
+
+  int64_t begin = esp_timer_get_time();
+  if (rmt_capture)
+  {
+    decodeRmt(result, &registry, edges, count);
+  }
+  else
+  {
+    for (size_t i = 0; i < count; i += EDGE_BATCH)
+    {
+      feedDecoders(&registry, edges + i, min(count - i, (size_t)EDGE_BATCH));
+    }
+  }
+  flushDecoders(&registry);
+  result->decode_time = esp_timer_get_time() - begin;
+  result->edges = decoder->edges;
+  result->frames = decoder->frames;
+  result->glitches = registry.filter.glitches;
+  result->merged = registry.filter.merged;
+
+  munmap((void *)edges, info.st_size);
+  free(decoder->state);
+  free(decoder);
+}
+
+/**********************************************************************************
+ *
+ * Worker thread with work stealing
+ *
+ **********************************************************************************/
+
+bool takeFile(unsigned int worker, unsigned int *file)
+{
+  work_queue_t *own = &work_queues[worker];
+  {
+    std::lock_guard<std::mutex> lock(own->mutex);
+    if (!own->files.empty())
+    {
+      *file = own->files.back();
+      own->files.pop_back();
+      return true;
+    }
+  }
+  for (unsigned int i = 1; i < work_queues.size(); i++)
+  {
+    work_queue_t *other = &work_queues[(worker + i) % work_queues.size()];
+    std::lock_guard<std::mutex> lock(other->mutex);
+    if (!other->files.empty())
+    {
+      *file = other->files.front();
+      other->files.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void worker(unsigned int id)
+{
+  unsigned int file;
+  while (takeFile(id, &file))
+  {
+    decodeFile(&results[file]);
+  }
+}
+
+/**********************************************************************************
+ *
+ * Files and results
+ *
+ **********************************************************************************/
+
+void addFiles(const std::string &path, std::vector<std::string> *files)
+{
+  struct stat info;
+  if (stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+  {
+    DIR *dir = opendir(path.c_str());
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL)
+    {
+      if (entry->d_name[0] != '.')
+      {
+        addFiles(path + "/" + entry->d_name, files);
+      }
+    }
+    if (dir != NULL)
+      closedir(dir);
+  }
+  else
+  {
+    files->push_back(path);
+  }
+}
+
+std::string resultLine(const file_result_t &result)
+{
+  if (!result.readable)
+  {
+    return result.path + "\tunreadable\t";
+  }
+  return result.path + "\t" + std::to_string(result.frames) + "\t" + result.commands;
+}
+
+// path => rest of line of a previous result file
+std::map<std::string, std::string> readResults(const char *name)
+{
+  std::map<std::string, std::string> previous;
+  std::ifstream input(name);
+  std::string line;
+  while (std::getline(input, line))
+  {
+    size_t tab = line.find('\t');
+    if (tab != std::string::npos)
+    {
+      previous[line.substr(0, tab)] = line.substr(tab + 1);
+    }
+  }
+  return previous;
+}
+
+void diffResults(const char *name)
+{
+  std::map<std::string, std::string> previous = readResults(name);
+  unsigned long changed = 0, added = 0, same = 0;
+  for (const file_result_t &result : results)
+  {
+    std::string line = resultLine(result);
+    std::string now = line.substr(result.path.size() + 1);
+    auto old = previous.find(result.path);
+    if (old == previous.end())
+    {
+      added++;
+      printf("+ %s\n", line.c_str());
+    }
+    else
+    {
+      if (old->second != now)
+      {
+        changed++;
+        printf("- %s\t%s\n+ %s\n", result.path.c_str(), old->second.c_str(), line.c_str());
+      }
+      else
+      {
+        same++;
+      }
+      previous.erase(old);
+    }
+  }
+  for (const auto &old : previous)
+  {
+    printf("- %s\t%s\n", old.first.c_str(), old.second.c_str());
+  }
+  fprintf(stderr, "diff: %lu same, %lu changed, %lu new, %lu missing\n", same, changed, added, (unsigned long)previous.size());
+}
+
+void printStatistics(int64_t wall_time, unsigned int threads)
+{
+  unsigned long files = 0, decoded = 0, edges = 0, frames = 0, lost_blocks = 0, glitches = 0, merged = 0;
+  int64_t decode_time = 0;
+  std::vector<int64_t> times;
+  for (const file_result_t &result : results)
+  {
+    if (!result.readable)
+      continue;
+    files++;
+    decoded += result.frames > 0;
+    edges += result.edges;
+    frames += result.frames;
+    lost_blocks += result.lost_blocks;
+    glitches += result.glitches;
+    merged += result.merged;
+    decode_time += result.decode_time;
+    times.push_back(result.decode_time);
+  }
+  std::sort(times.begin(), times.end());
+  int64_t p50 = times.empty() ? 0 : times[times.size() / 2];
+  int64_t p99 = times.empty() ? 0 : times[times.size() * 99 / 100];
+
+  fprintf(stderr, "%lu files (%lu unreadable), %lu with frames (%.1f %%), %lu frames, %lu edges\n", files,
+          (unsigned long)results.size() - files, decoded, files ? 100.0 * decoded / files : 0.0, frames, edges);
+  fprintf(stderr, "%u threads, wall %.3f s, decode cpu %.3f s, %.1f M edges/s, per file p50 %lld us, p99 %lld us\n",
+          threads, wall_time / 1e6, decode_time / 1e6, wall_time ? (double)edges / wall_time : 0.0, (long long)p50, (long long)p99);
+  fprintf(stderr, "glitch filter: %lu glitches removed, %lu periods merged\n", glitches, merged);
+  if (rmt_capture)
+  {
+    fprintf(stderr, "RMT capture: %lu blocks lost, RMT memory full\n", lost_blocks);
+  }
+}
+
+/**********************************************************************************
+ *
+ * Main
+ *
+ **********************************************************************************/
+
+int main(int argc, char **argv)
+{
+  unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+  const char *output = NULL;
+  const char *previous = NULL;
+  int option;
+  while ((option = getopt(argc, argv, "j:ro:d:")) != -1)
+  {
+    switch (option)
+    {
+    case 'j':
+      threads = std::max(1, atoi(optarg));
+      break;
+    case 'r':
+      rmt_capture = true;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'd':
+      previous = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-j threads] [-r] [-o results] [-d previous] files or directories\n", argv[0]);
+      return 2;
+    }
+  }
+
+  std::vector<std::string> files;
+  for (int i = optind; i < argc; i++)
+  {
+    addFiles(argv[i], &files);
+  }
+  std::sort(files.begin(), files.end()); // stable result order for diffs
+  results.resize(files.size());
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    results[i].path = files[i];
+  }
+
+  threads = std::min(threads, std::max(1u, (unsigned int)files.size()));
+  work_queues = std::vector<work_queue_t>(threads);
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    work_queues[i % threads].files.push_back(i);
+  }
+
+  int64_t begin = esp_timer_get_time();
+  std::vector<std::thread> workers;
+  for (unsigned int i = 0; i < threads; i++)
+  {
+    workers.emplace_back(worker, i);
+  }
+  for (std::thread &thread : workers)
+  {
+    thread.join();
+  }
+  int64_t wall_time = esp_timer_get_time() - begin;
+
+  if (output != NULL)
+  {
+    FILE *file = fopen(output, "w");
+    for (const file_result_t &result : results)
+    {
+      fprintf(file, "%s\n", resultLine(result).c_str());
+    }
+    fclose(file);
+  }
+  if (previous != NULL)
+  {
+    diffResults(previous);
+  }
+  else if (output == NULL)
+  {
+    for (const file_result_t &result : results)
+    {
+      printf("%s\n", resultLine(result).c_str());
+    }
+  }
+  printStatistics(wall_time, threads);
+  return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: Arduino.h
+ *
+ * Just enough of the Arduino core to build the decoder sources on Linux:
+ * String on top of std::string, a silent Serial and no-op pin functions.
+ * The decoders only use Serial for debugging output, it is dropped here.
+ * Critical sections are empty, code that uses them must run in one thread,
+ * the same holds for the queues, which never wait. The RMT driver is
+ * simulated in rmt.cpp.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#define HEX 16
+#define DEC 10
+#define HIGH 1
+#define LOW 0
+#define INPUT_PULLDOWN 0x09
+
+class String
+{
+public:
+  String(const char *text = "") : text(text) {}
+  String(const std::string &text) : text(text) {}
+  String(char c) : text(1, c) {}
+  String(int value, int base = DEC);
+  String(unsigned int value, int base = DEC);
+  String(long value, int base = DEC);
+  String(unsigned long value, int base = DEC);
+  String(float value, unsigned int decimals = 2);
+
+  unsigned int length() const { return text.size(); }
+  const char *c_str() const { return text.c_str(); }
+  char charAt(unsigned int index) const { return index < text.size() ? text[index] : 0; }
+  String substring(unsigned int from) const;
+  String substring(unsigned int from, unsigned int to) const;
+  int indexOf(const String &part, unsigned int from = 0) const;
+  int indexOf(char c, unsigned int from = 0) const;
+  void trim();
+
+  bool operator==(const String &other) const { return text == other.text; }
+  bool operator!=(const String &other) const { return text != other.text; }
+  String &operator+=(const String &other)
+  {
+    text += other.text;
+    return *this;
+  }
+  String &operator+=(char c)
+  {
+    text.push_back(c);
+    return *this;
+  }
+
+  std::string text;
+};
+
+String operator+(const String &a, const String &b);
+String operator+(const String &a, const char *b);
+String operator+(const char *a, const String &b);
+String operator+(const String &a, char b); // like Arduino, a 0 character is appended as well
+
+class HardwareSerial
+{
+public:
+  template <class T> size_t print(const T &, int = DEC) { return 0; }
+  template <class T> size_t println(const T &, int = DEC) { return 0; }
+  size_t println() { return 0; }
+  size_t printf(const char *, ...) { return 0; }
+};
+extern HardwareSerial Serial;
+
+typedef void *TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef void *QueueHandle_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdMS_TO_TICKS(ms) (ms)
+QueueHandle_t xQueueCreate(unsigned int length, unsigned int item_size);
+int xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait);
+int xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks_to_wait);
+inline void vTaskDelay(TickType_t) {}
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+
+inline void configTime(long, int, const char *) {}
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline void delay(uint32_t) {}
+int64_t esp_timer_get_time();
+extern thread_local int64_t simulated_time; // returned by esp_timer_get_time() if >= 0, see rmt.cpp
+inline unsigned long millis() { return esp_timer_get_time() / 1000; }
+
+template <class T, class L> auto min(const T &a, const L &b) -> decltype(b < a ? b : a) { return b < a ? b : a; }
+template <class T, class L> auto max(const T &a, const L &b) -> decltype(b < a ? b : a) { return a < b ? b : a; }
+#define constrain(value, low, high) ((value) < (low) ? (low) : ((value) > (high) ? (high) : (value)))
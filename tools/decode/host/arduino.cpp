@@ -0,0 +1,128 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: arduino.cpp
+ *
+ * Arduino core functions for the host build of the decoder.
+ *
+ */
+#include <Arduino.h>
+#include <stdio.h>
+#include <time.h>
+#include <deque>
+
+HardwareSerial Serial;
+
+static std::string number(long long value, int base)
+{
+  char text[24];
+  snprintf(text, sizeof(text), base == HEX ? "%llx" : "%lld", value);
+  return text;
+}
+
+String::String(int value, int base) : text(number(value, base)) {}
+String::String(unsigned int value, int base) : text(number(value, base)) {}
+String::String(long value, int base) : text(number(value, base)) {}
+String::String(unsigned long value, int base) : text(number(value, base)) {}
+
+String::String(float value, unsigned int decimals)
+{
+  char text[32];
+  snprintf(text, sizeof(text), "%.*f", decimals, value);
+  this->text = text;
+}
+
+String String::substring(unsigned int from) const
+{
+  return from < text.size() ? String(text.substr(from)) : String();
+}
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+  if (from > to)
+  {
+    unsigned int swap = from;
+    from = to;
+    to = swap;
+  }
+  return from < text.size() ? String(text.substr(from, to - from)) : String();
+}
+
+int String::indexOf(const String &part, unsigned int from) const
+{
+  size_t index = text.find(part.text, from);
+  return index == std::string::npos ? -1 : (int)index;
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+  size_t index = text.find(c, from);
+  return index == std::string::npos ? -1 : (int)index;
+}
+
+void String::trim()
+{
+  size_t first = text.find_first_not_of(" \t\r\n");
+  size_t last = text.find_last_not_of(" \t\r\n");
+  text = first == std::string::npos ? "" : text.substr(first, last - first + 1);
+}
+
+String operator+(const String &a, const String &b) { return String(a.text + b.text); }
+String operator+(const String &a, const char *b) { return String(a.text + b); }
+String operator+(const char *a, const String &b) { return String(a + b.text); }
+
+String operator+(const String &a, char b)
+{
+  std::string text = a.text;
+  text.push_back(b);
+  return String(text);
+}
+
+thread_local int64_t simulated_time = -1;
+
+int64_t esp_timer_get_time()
+{
+  if (simulated_time >= 0)
+  {
+    return simulated_time;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// FreeRTOS queue of one thread, full or empty queues return at once
+typedef struct
+{
+  unsigned int length;
+  unsigned int item_size;
+  std::deque<std::string> items;
+} host_queue_t;
+
+QueueHandle_t xQueueCreate(unsigned int length, unsigned int item_size)
+{
+  return new host_queue_t{length, item_size, {}};
+}
+
+int xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+  host_queue_t *q = (host_queue_t *)queue;
+  if (q->items.size() >= q->length)
+  {
+    return pdFALSE;
+  }
+  q->items.push_back(std::string((const char *)item, q->item_size));
+  return pdTRUE;
+}
+
+int xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks_to_wait)
+{
+  host_queue_t *q = (host_queue_t *)queue;
+  if (q->items.empty())
+  {
+    return pdFALSE;
+  }
+  memcpy(item, q->items.front().data(), q->item_size);
+  q->items.pop_front();
+  return pdTRUE;
+}
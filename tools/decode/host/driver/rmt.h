@@ -0,0 +1,113 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: rmt.h
+ *
+ * RMT driver of ESP-IDF 4.4 on Linux. The types and functions are those used
+ * by rmtcapture.cpp and transmit.cpp, simulateRmtEdges() plays the role of the
+ * receiver pin, simulatedRmtFrames() the one of the transmit pin (see rmt.cpp).
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <freertos/ringbuf.h>
+
+typedef int esp_err_t;
+typedef int gpio_num_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+typedef enum
+{
+  RMT_CHANNEL_0,
+  RMT_CHANNEL_1,
+  RMT_CHANNEL_2,
+  RMT_CHANNEL_3,
+  RMT_CHANNEL_4,
+  RMT_CHANNEL_5,
+  RMT_CHANNEL_6,
+  RMT_CHANNEL_7,
+  RMT_CHANNEL_MAX
+} rmt_channel_t;
+
+typedef enum
+{
+  RMT_MODE_TX,
+  RMT_MODE_RX
+} rmt_mode_t;
+
+typedef struct
+{
+  union
+  {
+    struct
+    {
+      uint32_t duration0 : 15;
+      uint32_t level0 : 1;
+      uint32_t duration1 : 15;
+      uint32_t level1 : 1;
+    };
+    uint32_t val;
+  };
+} rmt_item32_t;
+
+typedef struct
+{
+  uint16_t idle_threshold;     // ticks without edge that end a block
+  uint8_t filter_ticks_thresh; // APB ticks (80 MHz)
+  bool filter_en;
+} rmt_rx_config_t;
+
+typedef enum
+{
+  RMT_IDLE_LEVEL_LOW,
+  RMT_IDLE_LEVEL_HIGH
+} rmt_idle_level_t;
+
+typedef struct
+{
+  bool carrier_en;
+  bool idle_output_en;
+  rmt_idle_level_t idle_level;
+} rmt_tx_config_t;
+
+typedef struct
+{
+  rmt_mode_t rmt_mode;
+  rmt_channel_t channel;
+  gpio_num_t gpio_num;
+  uint8_t clk_div; // only 80 (1 us ticks) is simulated
+  uint8_t mem_block_num;
+  uint32_t flags;
+  rmt_rx_config_t rx_config;
+  rmt_tx_config_t tx_config;
+} rmt_config_t;
+
+#define RMT_MEM_ITEM_NUM 64 // items per memory block
+
+esp_err_t rmt_config(const rmt_config_t *config);
+esp_err_t rmt_driver_install(rmt_channel_t channel, size_t rx_buf_size, int intr_alloc_flags);
+esp_err_t rmt_driver_uninstall(rmt_channel_t channel);
+esp_err_t rmt_get_ringbuf_handle(rmt_channel_t channel, RingbufHandle_t *buf_handle);
+esp_err_t rmt_rx_start(rmt_channel_t channel, bool rx_idx_rst);
+esp_err_t rmt_write_items(rmt_channel_t channel, const rmt_item32_t *items, int count, bool wait_tx_done);
+
+/**********************************************************************************
+ *
+ * Simulation: pass edges (time << 1 | level before the edge) of the receiver
+ * pin to the RMT channel. simulateRmtEnd() ends the last block.
+ *
+ **********************************************************************************/
+void simulateRmtEdges(rmt_channel_t channel, const uint32_t *edges, size_t count);
+void simulateRmtEnd(rmt_channel_t channel);
+unsigned long simulatedRmtOverflows(rmt_channel_t channel); // blocks lost, RMT memory full
+
+/**********************************************************************************
+ *
+ * Simulation: frames written to a transmit channel since the last call, the
+ * items of every rmt_write_items() call
+ *
+ **********************************************************************************/
+std::vector<std::vector<rmt_item32_t>> simulatedRmtFrames(rmt_channel_t channel);
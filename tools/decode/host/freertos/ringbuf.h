@@ -0,0 +1,19 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: ringbuf.h
+ *
+ * Ring buffer functions of FreeRTOS as used with the RMT driver. On Linux the
+ * ring buffer of a channel is served by the simulated RMT driver (rmt.cpp).
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void *RingbufHandle_t;
+typedef uint32_t TickType_t;
+
+void *xRingbufferReceive(RingbufHandle_t ring_buffer, size_t *item_size, TickType_t ticks_to_wait);
+void vRingbufferReturnItem(RingbufHandle_t ring_buffer, void *item);
@@ -0,0 +1,254 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: rmt.cpp
+ *
+ * Simulated RMT driver for the host build. The receiver behaves like the
+ * ESP32 hardware as far as the decoders can tell:
+ *
+ * - pulses shorter than the filter threshold are dropped with both edges
+ * - the first edge after idle starts a block, idle_threshold us without an
+ *   edge end it with a duration 0 marker
+ * - a block with more pulses than the channel memory (64 items per block,
+ *   two pulses per item) is lost
+ *
+ * Complete blocks are queued as ring buffer items with the time the driver
+ * would have delivered them. While rmtcapture.cpp holds an item,
+ * esp_timer_get_time() of the thread returns that time, as if the decode task
+ * took the block right away. Channels are per thread, so files can be decoded
+ * in parallel.
+ *
+ * A transmit channel keeps the items written to it, so they can be played
+ * into a decoder.
+ *
+ */
+#include <Arduino.h>
+#include <driver/rmt.h>
+#include <deque>
+#include <vector>
+
+// block in the ring buffer
+typedef struct
+{
+  std::vector<rmt_item32_t> items;
+  uint32_t time; // delivered by the driver (us)
+} rmt_block_t;
+
+// simulated channel
+typedef struct
+{
+  rmt_config_t config;
+  bool installed;
+  bool running;
+  bool receiving;                 // in a block
+  bool pending;                   // edge waiting for the filter
+  uint32_t pending_edge;
+  uint32_t last_time;             // last edge in block (us)
+  size_t pulses;                  // pulses in block
+  bool overflow;                  // block longer than memory
+  unsigned long overflows;
+  std::vector<rmt_item32_t> items; // block being received
+  std::deque<rmt_block_t> ring_buffer;
+  rmt_block_t held;               // item taken by xRingbufferReceive
+  std::vector<std::vector<rmt_item32_t>> frames; // written to a transmit channel
+} rmt_channel_sim_t;
+
+thread_local rmt_channel_sim_t channels[RMT_CHANNEL_MAX];
+
+/**********************************************************************************
+ *
+ * Driver functions
+ *
+ **********************************************************************************/
+
+esp_err_t rmt_config(const rmt_config_t *config)
+{
+  if (config->channel >= RMT_CHANNEL_MAX || config->clk_div != 80 ||
+      config->channel + config->mem_block_num > RMT_CHANNEL_MAX)
+  {
+    return ESP_FAIL;
+  }
+  channels[config->channel].config = *config;
+  return ESP_OK;
+}
+
+esp_err_t rmt_driver_install(rmt_channel_t channel, size_t rx_buf_size, int intr_alloc_flags)
+{
+  rmt_config_t config = channels[channel].config;
+  channels[channel] = rmt_channel_sim_t();
+  channels[channel].config = config;
+  channels[channel].installed = true;
+  return ESP_OK;
+}
+
+esp_err_t rmt_driver_uninstall(rmt_channel_t channel)
+{
+  channels[channel] = rmt_channel_sim_t();
+  return ESP_OK;
+}
+
+esp_err_t rmt_get_ringbuf_handle(rmt_channel_t channel, RingbufHandle_t *buf_handle)
+{
+  *buf_handle = &channels[channel];
+  return channels[channel].installed ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t rmt_rx_start(rmt_channel_t channel, bool rx_idx_rst)
+{
+  channels[channel].running = channels[channel].installed;
+  return channels[channel].running ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t rmt_write_items(rmt_channel_t channel, const rmt_item32_t *items, int count, bool wait_tx_done)
+{
+  rmt_channel_sim_t *sim = &channels[channel];
+  if (!sim->installed || sim->config.rmt_mode != RMT_MODE_TX)
+  {
+    return ESP_FAIL;
+  }
+  sim->frames.push_back(std::vector<rmt_item32_t>(items, items + count));
+  return ESP_OK;
+}
+
+void *xRingbufferReceive(RingbufHandle_t ring_buffer, size_t *item_size, TickType_t ticks_to_wait)
+{
+  rmt_channel_sim_t *sim = (rmt_channel_sim_t *)ring_buffer;
+  if (sim->ring_buffer.empty())
+  {
+    return NULL;
+  }
+  sim->held = sim->ring_buffer.front();
+  sim->ring_buffer.pop_front();
+  simulated_time = sim->held.time;
+  *item_size = sim->held.items.size() * sizeof(rmt_item32_t);
+  return sim->held.items.data();
+}
+
+void vRingbufferReturnItem(RingbufHandle_t ring_buffer, void *item)
+{
+  ((rmt_channel_sim_t *)ring_buffer)->held.items.clear();
+  simulated_time = -1;
+}
+
+/**********************************************************************************
+ *
+ * Receiver pin
+ *
+ **********************************************************************************/
+
+void endBlock(rmt_channel_sim_t *sim, uint8_t level)
+{
+  if (!sim->overflow)
+  {
+    // duration 0 marks the end, in the second half of an item if possible
+    if (sim->pulses % 2 == 1)
+    {
+      sim->items.back().level1 = level;
+      sim->items.back().duration1 = 0;
+    }
+    else
+    {
+      rmt_item32_t item;
+      item.val = 0;
+      item.level0 = level;
+      sim->items.push_back(item);
+    }
+    sim->ring_buffer.push_back({sim->items, sim->last_time + sim->config.rx_config.idle_threshold});
+  }
+  else
+  {
+    sim->overflows++;
+  }
+  sim->items.clear();
+  sim->pulses = 0;
+  sim->overflow = false;
+  sim->receiving = false;
+}
+
+void receiveEdge(rmt_channel_sim_t *sim, uint32_t edge)
+{
+  uint32_t time = edge >> 1;
+  if (sim->receiving && ((time - sim->last_time) & 0x7fffffff) > sim->config.rx_config.idle_threshold)
+  {
+    endBlock(sim, edge & 1);
+  }
+  if (!sim->receiving)
+  {
+    sim->receiving = true;
+    sim->last_time = time;
+    return;
+  }
+
+  uint32_t duration = (time - sim->last_time) & 0x7fffffff;
+  sim->last_time = time;
+  if (sim->pulses >= 2 * RMT_MEM_ITEM_NUM * sim->config.mem_block_num)
+  {
+    sim->overflow = true;
+    return;
+  }
+  if (sim->pulses % 2 == 0)
+  {
+    rmt_item32_t item;
+    item.val = 0;
+    item.duration0 = duration;
+    item.level0 = edge & 1;
+    sim->items.push_back(item);
+  }
+  else
+  {
+    sim->items.back().duration1 = duration;
+    sim->items.back().level1 = edge & 1;
+  }
+  sim->pulses++;
+}
+
+void simulateRmtEdges(rmt_channel_t channel, const uint32_t *edges, size_t count)
+{
+  rmt_channel_sim_t *sim = &channels[channel];
+  if (!sim->running)
+  {
+    return;
+  }
+  uint32_t filter = sim->config.rx_config.filter_en ? sim->config.rx_config.filter_ticks_thresh / 80 : 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    // a pulse shorter than the filter threshold disappears with both edges
+    if (sim->pending && (((edges[i] >> 1) - (sim->pending_edge >> 1)) & 0x7fffffff) < filter)
+    {
+      sim->pending = false;
+      continue;
+    }
+    if (sim->pending)
+    {
+      receiveEdge(sim, sim->pending_edge);
+    }
+    sim->pending = true;
+    sim->pending_edge = edges[i];
+  }
+}
+
+void simulateRmtEnd(rmt_channel_t channel)
+{
+  rmt_channel_sim_t *sim = &channels[channel];
+  if (sim->pending)
+  {
+    receiveEdge(sim, sim->pending_edge);
+    sim->pending = false;
+  }
+  if (sim->receiving)
+  {
+    endBlock(sim, (sim->pending_edge & 1) ^ 1);
+  }
+}
+
+unsigned long simulatedRmtOverflows(rmt_channel_t channel)
+{
+  return channels[channel].overflows;
+}
+
+std::vector<std::vector<rmt_item32_t>> simulatedRmtFrames(rmt_channel_t channel)
+{
+  std::vector<std::vector<rmt_item32_t>> frames;
+  frames.swap(channels[channel].frames);
+  return frames;
+}
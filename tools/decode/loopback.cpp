@@ -0,0 +1,294 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: loopback.cpp
+ *
+ * Transmitter (transmit.cpp) against the decoder (protocol.cpp) on Linux.
+ * Commands take the way of a message on COMMAND_TOPIC: the topic is parsed
+ * and numbered by receiveTransmitCommand(), transmitCommand() plays the
+ * waveform into the simulated RMT transmit channel. The RMT items are turned
+ * into receiver edges, frame after frame with TRANSMIT_FRAME_GAP between
+ * them, and fed to a Fernotron decoder like the decode task does.
+ *
+ * The test fails if the items of a frame differ in a single period from the
+ * pulses of the words of encodeCommand(), or if a command does not come back
+ * from the decoder exactly as it was sent, without errors or repaired bytes.
+ * The commands repeat with new counters and there are more of them than
+ * TRANSMIT_CACHE_SIZE, so cached waveforms with rewritten counter and
+ * checksum words are checked as well as new ones.
+ *
+ * Usage: fernotron-loopback [-n commands] [-s seed]
+ *
+ */
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+#include <driver/rmt.h>
+#include <header.h>
+#include <mqttconnection.h>
+#include <protocol.h>
+#include <f2sutils.h>
+#include <merge.h>
+#include <heapmon.h>
+#include <longframe.h>
+#include <allowlist.h>
+#include <transmit.h>
+
+#define LOOPBACK_COMMANDS 10000        // default number of commands
+#define LOOPBACK_SENDERS 12            // different commands, more than TRANSMIT_CACHE_SIZE
+#define LOOPBACK_GAP 200000            // us between commands
+#define LOOPBACK_CHANNEL RMT_CHANNEL_0 // TRANSMIT_CHANNEL of transmit.cpp
+
+std::vector<command_t> decoded;
+unsigned long radio_switches = 0;
+
+/**********************************************************************************
+ *
+ * Firmware functions used by transmitter and decoder
+ *
+ **********************************************************************************/
+
+void mergeCommand(const command_t &command)
+{
+  decoded.push_back(command);
+}
+
+void queueLongFrame(const long_frame_t &frame)
+{
+}
+
+bool senderAllowed(uint32_t sender)
+{
+  return true;
+}
+
+void learnSender(uint32_t sender)
+{
+}
+
+int receiverRssi(uint8_t receiver)
+{
+  return RSSI_UNKNOWN;
+}
+
+heap_mark_t heapMark()
+{
+  heap_mark_t mark;
+  memset(&mark, 0, sizeof(mark));
+  return mark;
+}
+
+void heapStage(uint8_t stage, const heap_mark_t &begin)
+{
+}
+
+void setRadioTransmit(bool transmit)
+{
+  radio_switches++;
+}
+
+/**********************************************************************************
+ *
+ * Expected frame: preamble and the words of encodeCommand, written here
+ * without the waveform cache of transmit.cpp
+ *
+ **********************************************************************************/
+
+void addPulse(std::vector<rmt_item32_t> *items, unsigned int high, unsigned int low)
+{
+  rmt_item32_t item;
+  item.val = 0;
+  item.level0 = 1;
+  item.duration0 = high;
+  item.level1 = 0;
+  item.duration1 = low;
+  items->push_back(item);
+}
+
+std::vector<rmt_item32_t> expectedFrame(const command_t &command)
+{
+  uint16_t words[FRAME_WORDS];
+  encodeCommand(command, words);
+  std::vector<rmt_item32_t> items;
+  for (int i = 0; i < 7; i++)
+  {
+    addPulse(&items, symbol_length, symbol_length);
+  }
+  for (int w = 0; w < FRAME_WORDS; w++)
+  {
+    addPulse(&items, symbol_length, 8 * symbol_length); // sync
+    for (int bit = 0; bit < 10; bit++)
+    {
+      bool one = (words[w] >> bit) & 1;
+      addPulse(&items, (one ? 1 : 2) * symbol_length, (one ? 2 : 1) * symbol_length);
+    }
+  }
+  return items;
+}
+
+/**********************************************************************************
+ *
+ * Receiver: play RMT items as edges (time << 1 | level before the edge)
+ *
+ **********************************************************************************/
+
+uint32_t now = 0; // us
+
+void playFrame(decoder_registry_t *registry, const std::vector<rmt_item32_t> &items)
+{
+  std::vector<uint32_t> edges;
+  for (const rmt_item32_t &item : items)
+  {
+    edges.push_back((now << 1) | 0); // rising
+    now += item.duration0;
+    edges.push_back((now << 1) | 1); // falling
+    now += item.duration1;
+  }
+  for (size_t i = 0; i < edges.size(); i += EDGE_BATCH)
+  {
+    feedDecoders(registry, &edges[i], min(edges.size() - i, (size_t)EDGE_BATCH));
+  }
+}
+
+// end of a command, the pin stays low until the next one
+void endCommand(decoder_registry_t *registry)
+{
+  now += LOOPBACK_GAP;
+  uint32_t edge = (now << 1) | 0;
+  feedDecoders(registry, &edge, 1);
+  flushDecoders(registry);
+}
+
+/**********************************************************************************
+ *
+ * Main
+ *
+ **********************************************************************************/
+
+bool sameCommand(const command_t &a, const command_t &b)
+{
+  return a.type == b.type && a.id1 == b.id1 && a.id2 == b.id2 && a.id3 == b.id3 && a.counter == b.counter &&
+         a.group == b.group && a.member == b.member && a.action == b.action;
+}
+
+String commandTopic(const command_t &command)
+{
+  char topic[128];
+  unsigned int sender = ((unsigned int)command.id1 << 16) | (command.id2 << 8) | command.id3;
+  String action = actionName(command.action);
+  if (command.type == 8)
+  {
+    snprintf(topic, sizeof(topic), "%sCentralUnit/ID_%06x/Group_%u/Member_%u/%s", COMMAND_TOPIC, sender, command.group,
+             command.member, action.c_str());
+  }
+  else
+  {
+    snprintf(topic, sizeof(topic), "%s%s/ID_%06x/%s", COMMAND_TOPIC, command.type == 1 ? "PlainSender" : "SunSensor",
+             sender, action.c_str());
+  }
+  return topic;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long count = LOOPBACK_COMMANDS;
+  unsigned int seed = 1;
+  int option;
+  while ((option = getopt(argc, argv, "n:s:")) != -1)
+  {
+    switch (option)
+    {
+    case 'n':
+      count = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      seed = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n commands] [-s seed]\n", argv[0]);
+      return 2;
+    }
+  }
+  srand(seed);
+
+  // senders of the three types with a fixed group, member and action each
+  const uint8_t types[] = {1, 2, 8};
+  const uint8_t actions[] = {3, 4, 5, 6, 7, 8, 15};
+  command_t senders[LOOPBACK_SENDERS];
+  for (int i = 0; i < LOOPBACK_SENDERS; i++)
+  {
+    command_t *sender = &senders[i];
+    memset(sender, 0, sizeof(command_t));
+    sender->type = types[i % 3];
+    sender->id1 = (sender->type << 4) | (rand() & 0x0f);
+    sender->id2 = rand();
+    sender->id3 = rand();
+    sender->group = sender->type == 8 ? rand() % 16 : 0;
+    sender->member = sender->type == 8 ? rand() % 8 : 0;
+    sender->action = actions[rand() % sizeof(actions)];
+  }
+
+  TransmitInit();
+  decoder_registry_t registry;
+  memset(&registry, 0, sizeof(registry));
+  registerDecoder(&registry, createFernotronDecoder(0));
+
+  unsigned long wrong_frames = 0, wrong_commands = 0, lost_commands = 0, frames = 0;
+  for (unsigned long n = 0; n < count; n++)
+  {
+    const command_t *sender = &senders[rand() % LOOPBACK_SENDERS];
+    command_t command;
+    if (!receiveTransmitCommand(commandTopic(*sender).c_str()) || !nextTransmitCommand(&command, 0))
+    {
+      printf("command %lu: topic %s refused\n", n, commandTopic(*sender).c_str());
+      return 1;
+    }
+
+    transmitCommand(command);
+    std::vector<rmt_item32_t> expected = expectedFrame(command);
+    decoded.clear();
+    for (const std::vector<rmt_item32_t> &frame : simulatedRmtFrames(LOOPBACK_CHANNEL))
+    {
+      frames++;
+      bool same = frame.size() == expected.size();
+      for (size_t i = 0; same && i < frame.size(); i++)
+      {
+        same = frame[i].val == expected[i].val;
+      }
+      if (!same)
+      {
+        wrong_frames++;
+        printf("command %lu: frame of %s differs from encodeCommand\n", n, commandTopic(command).c_str());
+      }
+      playFrame(&registry, frame);
+      now += TRANSMIT_FRAME_GAP * 1000;
+    }
+    endCommand(&registry);
+
+    if (decoded.empty())
+    {
+      lost_commands++;
+      printf("command %lu: %s counter %u not decoded\n", n, commandTopic(command).c_str(), command.counter);
+    }
+    for (const command_t &received : decoded)
+    {
+      if (!sameCommand(received, command) || received.errors != 0 || received.repaired != 0)
+      {
+        wrong_commands++;
+        printf("command %lu: sent %s counter %u, decoded %02x%02x%02x group %u member %u action %u counter %u errors %u repaired %u\n",
+               n, commandTopic(command).c_str(), command.counter, received.id1, received.id2, received.id3, received.group,
+               received.member, received.action, received.counter, received.errors, received.repaired);
+      }
+    }
+  }
+
+  printf("%lu commands, %lu frames\n", count, frames);
+  printf("frames different from encodeCommand %lu, commands lost %lu, commands wrong %lu\n", wrong_frames, lost_commands,
+         wrong_commands);
+  bool pass = frames == count * TRANSMIT_REPEATS && wrong_frames == 0 && lost_commands == 0 && wrong_commands == 0 &&
+              radio_switches == 2 * count;
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,408 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: soak.cpp
+ *
+ * Heap soak test on Linux. Decodes, publishes and stores millions of
+ * synthetic frames and renders the history page now and then, like the
+ * gateway does over weeks, and fails if the heap leaks or fragments.
+ *
+ * All String memory comes from a fixed arena with a first fit allocator,
+ * about the size of the free heap of the gateway, so fragmentation shows as
+ * a shrinking largest free block just like on the ESP32. The allocator counts
+ * allocations and bytes, heapMark/heapStage report them per frame, publish and
+ * page like the heap monitor of the firmware.
+ *
+ * Usage: fernotron-soak [-n frames]
+ *
+ */
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <new>
+#include <header.h>
+#include <protocol.h>
+#include <mqttmessage.h>
+#include <history.h>
+#include <stats.h>
+#include <heapmon.h>
+#include <longframe.h>
+#include <allowlist.h>
+#include <exporter.h>
+
+#define SOAK_HEAP_SIZE (128 * 1024) // arena for all String memory
+#define SOAK_FRAMES 1000000         // default number of frames
+#define SOAK_SENDERS 40             // synthetic senders
+#define SOAK_PAGE_INTERVAL 100      // frames between page renders
+#define SOAK_SAMPLES 10             // heap samples printed during the run
+#define SOAK_LEAK_LIMIT 256         // free bytes that may be lost after warm up
+#define SOAK_FRAGMENTATION_LIMIT 10 // percent points fragmentation may grow after warm up
+#define ALIGNMENT 16                // alignment of operator new
+
+/**********************************************************************************
+ *
+ * First fit allocator over a fixed arena, free blocks in address order
+ *
+ **********************************************************************************/
+
+typedef struct block
+{
+  size_t size;        // block size including header
+  struct block *next; // next free block, only valid while free
+} block_t;
+
+#define HEADER_SIZE ((sizeof(block_t) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT)
+
+alignas(ALIGNMENT) static uint8_t arena[SOAK_HEAP_SIZE];
+static block_t *free_list = NULL;
+static bool arena_ready = false;
+static uint32_t arena_allocations = 0;
+static uint32_t arena_allocated_bytes = 0;
+static uint32_t arena_used_blocks = 0;
+
+static void *arenaAllocate(size_t size)
+{
+  if (!arena_ready)
+  {
+    free_list = (block_t *)arena;
+    free_list->size = SOAK_HEAP_SIZE;
+    free_list->next = NULL;
+    arena_ready = true;
+  }
+  size_t needed = HEADER_SIZE + (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  for (block_t **link = &free_list; *link != NULL; link = &(*link)->next)
+  {
+    block_t *block = *link;
+    if (block->size < needed)
+    {
+      continue;
+    }
+    if (block->size - needed >= HEADER_SIZE + ALIGNMENT)
+    {
+      // split, rest stays in the free list
+      block_t *rest = (block_t *)((uint8_t *)block + needed);
+      rest->size = block->size - needed;
+      rest->next = block->next;
+      block->size = needed;
+      *link = rest;
+    }
+    else
+    {
+      *link = block->next;
+    }
+    arena_allocations++;
+    arena_allocated_bytes += size;
+    arena_used_blocks++;
+    return (uint8_t *)block + HEADER_SIZE;
+  }
+  return NULL;
+}
+
+static void arenaFree(void *pointer)
+{
+  if (pointer == NULL)
+  {
+    return;
+  }
+  block_t *block = (block_t *)((uint8_t *)pointer - HEADER_SIZE);
+  arena_used_blocks--;
+
+  block_t *previous = NULL;
+  block_t *next = free_list;
+  while (next != NULL && next < block)
+  {
+    previous = next;
+    next = next->next;
+  }
+  block->next = next;
+  if (next != NULL && (uint8_t *)block + block->size == (uint8_t *)next)
+  {
+    block->size += next->size; // merge with following block
+    block->next = next->next;
+  }
+  if (previous == NULL)
+  {
+    free_list = block;
+  }
+  else if ((uint8_t *)previous + previous->size == (uint8_t *)block)
+  {
+    previous->size += block->size; // merge with preceding block
+    previous->next = block->next;
+  }
+  else
+  {
+    previous->next = block;
+  }
+}
+
+void *operator new(size_t size)
+{
+  void *pointer = arenaAllocate(size);
+  if (pointer == NULL)
+  {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return arenaAllocate(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return arenaAllocate(size); }
+void operator delete(void *pointer) noexcept { arenaFree(pointer); }
+void operator delete[](void *pointer) noexcept { arenaFree(pointer); }
+void operator delete(void *pointer, size_t) noexcept { arenaFree(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { arenaFree(pointer); }
+
+/**********************************************************************************
+ *
+ * Heap accounting, same interface as the heap monitor of the firmware
+ *
+ **********************************************************************************/
+
+typedef struct
+{
+  uint64_t count;
+  uint64_t allocations;
+  uint64_t bytes;
+  int64_t retained;
+  int32_t max_retained;
+} soak_stage_t;
+
+const char *stage_names[HEAP_STAGES] = {"frame", "publish", "page"};
+soak_stage_t soak_stages[HEAP_STAGES];
+
+heap_mark_t heapMark()
+{
+  heap_mark_t mark;
+  mark.free_bytes = 0;
+  mark.largest_block = 0;
+  for (block_t *block = free_list; block != NULL; block = block->next)
+  {
+    mark.free_bytes += block->size;
+    mark.largest_block = max(mark.largest_block, (uint32_t)block->size);
+  }
+  mark.used_blocks = arena_used_blocks;
+  mark.allocations = arena_allocations;
+  mark.allocated_bytes = arena_allocated_bytes;
+  return mark;
+}
+
+void heapStage(uint8_t stage, const heap_mark_t &begin)
+{
+  heap_mark_t end = heapMark();
+  int32_t retained = (int32_t)(begin.free_bytes - end.free_bytes);
+  soak_stage_t *stats = &soak_stages[stage];
+  stats->count++;
+  stats->allocations += end.allocations - begin.allocations;
+  stats->bytes += end.allocated_bytes - begin.allocated_bytes;
+  stats->retained += retained;
+  stats->max_retained = max(stats->max_retained, retained);
+}
+
+float fragmentation(const heap_mark_t &mark)
+{
+  return mark.free_bytes == 0 ? 0.0f : 100.0f - 100.0f * mark.largest_block / mark.free_bytes;
+}
+
+/**********************************************************************************
+ *
+ * Firmware functions the soaked sources need
+ *
+ **********************************************************************************/
+
+command_t decoded;      // last command from the decoder
+bool decoded_valid = false;
+
+void mergeCommand(const command_t &command)
+{
+  decoded = command;
+  decoded_valid = true;
+}
+
+void queueLongFrame(const long_frame_t &frame)
+{
+}
+
+bool senderAllowed(uint32_t sender)
+{
+  return true;
+}
+
+void learnSender(uint32_t sender)
+{
+}
+
+int receiverRssi(uint8_t receiver)
+{
+  return -60;
+}
+
+void publishMQTT(String topic, String payload)
+{
+}
+
+void publishMQTTBinary(const char *topic, const uint8_t *payload, unsigned int length)
+{
+}
+
+void publishMQTTRetained(const char *topic, const String &payload)
+{
+}
+
+void appendHistoryLog(const command_t &command, uint32_t time)
+{
+}
+
+void exportCommand(const command_t &command, int64_t time)
+{
+}
+
+/**********************************************************************************
+ *
+ * Synthetic frames as receiver edges
+ *
+ **********************************************************************************/
+
+uint32_t edges[2 * (7 + FRAME_WORDS * 11) + 4];
+uint32_t edge_time = 0;
+
+void addPeriod(unsigned int *count, uint8_t level, unsigned int duration)
+{
+  edge_time += duration;
+  edges[(*count)++] = (edge_time << 1) | level;
+}
+
+unsigned int frameEdges(const command_t &command)
+{
+  uint16_t words[FRAME_WORDS];
+  encodeCommand(command, words);
+  unsigned int count = 0;
+  addPeriod(&count, 0, 20000); // gap before frame
+  for (int i = 0; i < 7; i++)
+  {
+    addPeriod(&count, 1, symbol_length);
+    addPeriod(&count, 0, symbol_length);
+  }
+  for (int w = 0; w < FRAME_WORDS; w++)
+  {
+    addPeriod(&count, 1, symbol_length);
+    addPeriod(&count, 0, 8 * symbol_length);
+    for (int bit = 0; bit < 10; bit++)
+    {
+      bool one = (words[w] >> bit) & 1;
+      addPeriod(&count, 1, one ? symbol_length : 2 * symbol_length);
+      addPeriod(&count, 0, one ? 2 * symbol_length : symbol_length);
+    }
+  }
+  addPeriod(&count, 1, symbol_length); // ends the last word
+  return count;
+}
+
+/**********************************************************************************
+ *
+ * Main
+ *
+ **********************************************************************************/
+
+int main(int argc, char **argv)
+{
+  unsigned long frames = SOAK_FRAMES;
+  if (argc == 3 && strcmp(argv[1], "-n") == 0)
+  {
+    frames = strtoul(argv[2], NULL, 10);
+  }
+  else if (argc != 1)
+  {
+    fprintf(stderr, "usage: %s [-n frames]\n", argv[0]);
+    return 2;
+  }
+
+  decoder_registry_t registry;
+  memset(&registry, 0, sizeof(registry));
+  registerDecoder(&registry, createFernotronDecoder(0));
+
+  srand(1);
+  unsigned long warm_up = frames / SOAK_SAMPLES;
+  unsigned long lost = 0;
+  heap_mark_t baseline = heapMark();
+  printf("%10s %10s %10s %10s %14s\n", "frames", "free", "largest", "blocks", "fragmentation");
+
+  for (unsigned long n = 1; n <= frames; n++)
+  {
+    command_t command;
+    memset(&command, 0, sizeof(command));
+    uint32_t sender = 0x800000 + rand() % SOAK_SENDERS;
+    command.type = 8;
+    command.id1 = sender >> 16;
+    command.id2 = sender >> 8;
+    command.id3 = sender;
+    command.counter = n & 0x0f;
+    command.group = rand() % 8;
+    command.member = rand() % 8;
+    command.action = 3 + rand() % 3;
+
+    decoded_valid = false;
+    unsigned int count = frameEdges(command);
+    for (unsigned int i = 0; i < count; i += EDGE_BATCH)
+    {
+      feedDecoders(&registry, edges + i, min(count - i, (unsigned int)EDGE_BATCH));
+    }
+    if (decoded_valid)
+    {
+      storeCommand(decoded);
+      sendMessage(decoded);
+    }
+    else
+    {
+      lost++;
+    }
+
+    if (n % SOAK_PAGE_INTERVAL == 0)
+    {
+      heap_mark_t mark = heapMark();
+      {
+        String page = readHistory() + statsReport();
+      }
+      heapStage(HEAP_PAGE, mark);
+    }
+
+    if (n % max(frames / SOAK_SAMPLES, 1UL) == 0 || n == warm_up)
+    {
+      heap_mark_t mark = heapMark();
+      printf("%10lu %10u %10u %10u %13.1f%%\n", n, mark.free_bytes, mark.largest_block, mark.used_blocks, fragmentation(mark));
+      if (n == warm_up)
+      {
+        baseline = mark; // history buffer and statistics are filled now
+      }
+    }
+  }
+
+  printf("\n%-8s %10s %12s %12s %12s\n", "stage", "count", "allocs/run", "bytes/run", "retained/run");
+  for (int i = 0; i < HEAP_STAGES; i++)
+  {
+    soak_stage_t *stats = &soak_stages[i];
+    double count = stats->count == 0 ? 1 : stats->count;
+    printf("%-8s %10llu %12.1f %12.1f %12.2f\n", stage_names[i], (unsigned long long)stats->count,
+           stats->allocations / count, stats->bytes / count, stats->retained / count);
+  }
+
+  heap_mark_t end = heapMark();
+  bool failed = false;
+  if (lost > 0)
+  {
+    printf("FAIL: %lu frames not decoded\n", lost);
+    failed = true;
+  }
+  if (end.free_bytes + SOAK_LEAK_LIMIT < baseline.free_bytes)
+  {
+    printf("FAIL: %u bytes lost after warm up\n", baseline.free_bytes - end.free_bytes);
+    failed = true;
+  }
+  if (fragmentation(end) > fragmentation(baseline) + SOAK_FRAGMENTATION_LIMIT)
+  {
+    printf("FAIL: fragmentation grew from %.1f%% to %.1f%%\n", fragmentation(baseline), fragmentation(end));
+    failed = true;
+  }
+  printf("%s\n", failed ? "FAIL" : "PASS");
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,331 @@
+/*
+ * Fernotron 2 MQTT
+ *
+ * File: wifisim.cpp
+ *
+ * Wi-Fi reconnect manager (wificonnection.cpp) against a simulated mesh on
+ * Linux. Two access points with the same SSID on different channels, the
+ * simulated driver answers like the ESP32 with typical delays: a scan takes
+ * 2.2 s, DHCP 0.9 s, an association with a known BSSID and channel 0.12 s.
+ *
+ * A day of mesh trouble is simulated in steps of the network task cycle:
+ * short drops where the access point stays (every 20 minutes), roams where
+ * the access point of the gateway is down for 10 minutes (every 2 hours) and
+ * one outage of both for 3 minutes. DHCP gives leases of 2 hours. The test
+ * fails if a short drop takes longer than an association with the cached
+ * access point and DHCP (the lease is only reused within WIFI_LEASE_REUSE % of
+ * its time), a roam longer than a scan with DHCP after the failed fast
+ * attempt, the outage makes more attempts than the backoff allows, or the
+ * driver is called from an event. It also fails if a cached lease is used
+ * after it ran out, or if DHCP is started while the cached lease may still be
+ * reused or not right after that time: a DHCP restart clears the address like
+ * on the ESP32 and drops the MQTT session.
+ *
+ * Usage: fernotron-wifisim [-s seed]
+ *
+ */
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <map>
+#include <wificonnection.h>
+
+#define SIM_STEP 10                 // ms, network task cycle
+#define SIM_DURATION (24 * 3600000UL) // ms simulated
+#define SIM_SCAN 2200               // ms scan and association
+#define SIM_FAST_ASSOC 120          // ms association with known BSSID and channel
+#define SIM_FAST_FAIL 400           // ms until a missing BSSID is reported
+#define SIM_DHCP 900                // ms
+#define SIM_STATIC 10               // ms with a static address
+#define SIM_LEASE 7200              // s lease time given by DHCP
+#define SIM_REUSE ((unsigned long)SIM_LEASE * 10 * WIFI_LEASE_REUSE) // ms a lease may be reused
+#define SIM_DROP_INTERVAL 1200000   // ms between short drops
+#define SIM_ROAM_INTERVAL 7200000   // ms between roams
+#define SIM_ROAM_TIME 600000        // ms the access point is down
+#define SIM_OUTAGE_START 43200000   // ms
+#define SIM_OUTAGE_TIME 180000      // ms both access points are down
+
+#define EVENT_ASSOCIATED 0
+#define EVENT_GOT_IP 1
+#define EVENT_DISCONNECTED 2
+
+typedef struct
+{
+  uint8_t bssid[6];
+  int32_t channel;
+  bool up;
+} sim_ap_t;
+
+typedef struct
+{
+  int kind;
+  int ap;
+  uint8_t reason;
+  unsigned int generation; // events of an older generation were cancelled
+} sim_event_t;
+
+sim_ap_t aps[2] = {{{0x24, 0x4b, 0xfe, 0, 0, 1}, 1, true}, {{0x24, 0x4b, 0xfe, 0, 0, 2}, 11, true}};
+std::multimap<unsigned long, sim_event_t> events;
+unsigned int generation = 0;
+unsigned long now = 0;
+int target_ap = -1;      // access point of the current attempt or connection
+bool online = false;
+bool static_lease = false;
+unsigned long lease_start = 0;   // ms when DHCP gave the lease
+unsigned long expired_uses = 0;  // cached lease used after it ran out
+unsigned long dhcp_renewals = 0; // DHCP started while online, each drops the MQTT session
+unsigned long early_renewals = 0; // of them while the lease could still be reused
+unsigned long overdue_steps = 0; // steps online with the cached lease after its reuse time
+bool in_event = false;
+unsigned long driver_calls_in_events = 0;
+unsigned long begins = 0;
+
+void schedule(unsigned long delay, int kind, int ap, uint8_t reason)
+{
+  events.insert({now + delay, {kind, ap, reason, generation}});
+}
+
+/**********************************************************************************
+ *
+ * Simulated driver
+ *
+ **********************************************************************************/
+
+void simBegin(const uint8_t *bssid, int32_t channel)
+{
+  driver_calls_in_events += in_event;
+  begins++;
+  generation++;
+  online = false;
+  target_ap = -1;
+  for (int i = 0; i < 2; i++)
+  {
+    bool match = bssid == NULL ? aps[i].up : aps[i].up && memcmp(bssid, aps[i].bssid, 6) == 0 && channel == aps[i].channel;
+    if (match && target_ap < 0)
+    {
+      target_ap = i;
+    }
+  }
+  unsigned long delay = bssid == NULL ? SIM_SCAN : SIM_FAST_ASSOC;
+  if (target_ap < 0)
+  {
+    schedule(bssid == NULL ? SIM_SCAN : SIM_FAST_FAIL, EVENT_DISCONNECTED, -1, WIFI_REASON_NO_AP_FOUND);
+    return;
+  }
+  schedule(delay, EVENT_ASSOCIATED, target_ap, 0);
+  schedule(delay + (static_lease ? SIM_STATIC : SIM_DHCP), EVENT_GOT_IP, target_ap, 0);
+}
+
+void simConfigure(const uint32_t *lease)
+{
+  driver_calls_in_events += in_event;
+  if (lease != NULL && now - lease_start >= SIM_LEASE * 1000UL)
+  {
+    expired_uses++;
+  }
+  if (lease == NULL && static_lease && online)
+  {
+    dhcp_renewals++;
+    early_renewals += now - lease_start < SIM_REUSE;
+    online = false; // the address is cleared until DHCP gives one, TCP connections are lost
+    schedule(SIM_DHCP, EVENT_GOT_IP, target_ap, 0);
+  }
+  static_lease = lease != NULL;
+}
+
+void simDisconnect()
+{
+  driver_calls_in_events += in_event;
+  generation++;
+  schedule(5, EVENT_DISCONNECTED, -1, WIFI_REASON_ASSOC_LEAVE);
+  target_ap = -1;
+  online = false;
+}
+
+const wifi_hal_t sim_wifi_hal = {simBegin, simConfigure, simDisconnect};
+
+// access point goes down or up, the gateway loses it if it was on it
+void setAp(int ap, bool up)
+{
+  aps[ap].up = up;
+  if (!up && target_ap == ap)
+  {
+    generation++;
+    target_ap = -1;
+    online = false;
+    schedule(100, EVENT_DISCONNECTED, -1, 200); // beacon timeout
+  }
+}
+
+void deliverEvents()
+{
+  while (!events.empty() && events.begin()->first <= now)
+  {
+    sim_event_t event = events.begin()->second;
+    events.erase(events.begin());
+    if (event.generation != generation && event.reason != WIFI_REASON_ASSOC_LEAVE)
+    {
+      continue;
+    }
+    in_event = true;
+    switch (event.kind)
+    {
+    case EVENT_ASSOCIATED:
+      wifiAssociated(aps[event.ap].bssid, aps[event.ap].channel, now);
+      break;
+    case EVENT_GOT_IP:
+    {
+      uint32_t lease[4] = {0x0a01a8c0, 0x0101a8c0, 0x00ffffff, 0x0101a8c0};
+      online = true;
+      if (!static_lease)
+      {
+        lease_start = now;
+      }
+      wifiGotIp(lease, static_lease ? 0 : SIM_LEASE, now);
+      break;
+    }
+    case EVENT_DISCONNECTED:
+      wifiDisconnected(event.reason, now);
+      break;
+    }
+    in_event = false;
+  }
+}
+
+/**********************************************************************************
+ *
+ * Main
+ *
+ **********************************************************************************/
+
+// time until the gateway is online again after a disturbance at now
+unsigned long recoverTime(unsigned long limit)
+{
+  unsigned long start = now;
+  while (now - start < limit)
+  {
+    now += SIM_STEP;
+    deliverEvents();
+    wifiRun(now);
+    if (online)
+    {
+      return now - start;
+    }
+  }
+  return limit;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned int seed = 1;
+  int option;
+  while ((option = getopt(argc, argv, "s:")) != -1)
+  {
+    switch (option)
+    {
+    case 's':
+      seed = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-s seed]\n", argv[0]);
+      return 2;
+    }
+  }
+  srand(seed);
+
+  WifiManagerInit(&sim_wifi_hal, now);
+  unsigned long first = recoverTime(60000);
+  printf("first connect        %6lu ms\n", first);
+
+  unsigned long drop_count = 0, drop_worst = 0, drop_total = 0;
+  unsigned long roam_count = 0, roam_worst = 0, roam_total = 0;
+  unsigned long outage_time = 0, outage_begins = 0;
+  unsigned long next_drop = SIM_DROP_INTERVAL / 2, next_roam = SIM_ROAM_INTERVAL;
+  bool outage_done = false;
+  int down_ap = -1;
+  unsigned long up_again = 0;
+
+  while (now < SIM_DURATION)
+  {
+    now += SIM_STEP;
+    deliverEvents();
+    wifiRun(now);
+
+    overdue_steps += online && static_lease && now - lease_start > SIM_REUSE + SIM_STEP;
+    if (down_ap >= 0 && now >= up_again)
+    {
+      setAp(down_ap, true);
+      down_ap = -1;
+    }
+    if (!online)
+    {
+      continue;
+    }
+    if (!outage_done && now >= SIM_OUTAGE_START)
+    {
+      outage_done = true;
+      setAp(0, false);
+      setAp(1, false);
+      unsigned long begin = now;
+      unsigned long count = begins;
+      while (now - begin < SIM_OUTAGE_TIME)
+      {
+        now += SIM_STEP;
+        deliverEvents();
+        wifiRun(now);
+      }
+      outage_begins = begins - count;
+      setAp(0, true);
+      setAp(1, true);
+      outage_time = SIM_OUTAGE_TIME + recoverTime(120000);
+    }
+    else if (now >= next_roam && down_ap < 0)
+    {
+      next_roam = now + SIM_ROAM_INTERVAL;
+      down_ap = target_ap;
+      up_again = now + SIM_ROAM_TIME;
+      setAp(down_ap, false);
+      unsigned long time = recoverTime(60000);
+      roam_count++;
+      roam_total += time;
+      roam_worst = max(roam_worst, time);
+    }
+    else if (now >= next_drop)
+    {
+      next_drop = now + SIM_DROP_INTERVAL / 2 + rand() % SIM_DROP_INTERVAL;
+      generation++;
+      online = false;
+      schedule(20, EVENT_DISCONNECTED, -1, 200);
+      unsigned long time = recoverTime(60000);
+      drop_count++;
+      drop_total += time;
+      drop_worst = max(drop_worst, time);
+    }
+  }
+
+  // a failed scan is repeated after WIFI_BACKOFF, doubled up to WIFI_BACKOFF_MAX
+  unsigned long allowed = 2;
+  for (unsigned long backoff = WIFI_BACKOFF, time = 0; time < SIM_OUTAGE_TIME; backoff = min(2 * backoff, (unsigned long)WIFI_BACKOFF_MAX))
+  {
+    time += backoff + SIM_SCAN;
+    allowed++;
+  }
+  unsigned long drop_limit = 20 + SIM_FAST_ASSOC + SIM_DHCP + 2 * SIM_STEP;
+  unsigned long roam_limit = SIM_FAST_FAIL + SIM_SCAN + SIM_DHCP + 2 * SIM_STEP + 100;
+
+  printf("short drops  %5lu    mean %6lu ms, worst %6lu ms (limit %lu)\n", drop_count, drop_total / max(drop_count, 1UL), drop_worst, drop_limit);
+  printf("roams        %5lu    mean %6lu ms, worst %6lu ms (limit %lu)\n", roam_count, roam_total / max(roam_count, 1UL), roam_worst, roam_limit);
+  printf("outage %lu s: %lu attempts (limit %lu), offline %lu ms\n", SIM_OUTAGE_TIME / 1000, outage_begins, allowed, outage_time);
+  printf("driver calls in events %lu\n", driver_calls_in_events);
+  printf("DHCP restarts %lu (%lu too early), steps on a cached lease after its reuse time %lu, expired leases used %lu\n",
+         dhcp_renewals, early_renewals, overdue_steps, expired_uses);
+  printf("%s\n", wifiReport(now).c_str());
+
+  bool pass = drop_count > 0 && drop_worst <= drop_limit && roam_count > 0 && roam_worst <= roam_limit &&
+              outage_begins <= allowed && outage_time < SIM_OUTAGE_TIME + WIFI_BACKOFF_MAX + SIM_SCAN + SIM_DHCP + 100 &&
+              driver_calls_in_events == 0 && online && dhcp_renewals > 0 && early_renewals == 0 &&
+              overdue_steps == 0 && expired_uses == 0;
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#
+# Fernotron 2 MQTT
+#
+# File: sink.py
+#
+# Stand-in endpoint for the exporter (exporter.h). Takes the batches posted by
+# the gateway, prints the number of lines and the totals of every batch, and
+# appends the lines to a file if one is given. To test the backoff, the sink
+# can answer slowly or fail a share of the requests.
+#
+# Usage: python3 sink.py [--port 8086] [--delay ms] [--fail percent] [--output file]
+#
+# Then set EXPORT_URL to http://<ip address of this computer>:8086/write
+#
+
+import argparse
+import random
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+parser = argparse.ArgumentParser(description="stand-in endpoint for the Fernotron 2 MQTT exporter")
+parser.add_argument("--port", type=int, default=8086)
+parser.add_argument("--delay", type=int, default=0, help="ms to wait before the answer")
+parser.add_argument("--fail", type=int, default=0, help="percent of requests answered with 503")
+parser.add_argument("--output", help="append the received lines to this file")
+options = parser.parse_args()
+
+totals = {"batches": 0, "lines": 0, "bytes": 0, "failed": 0}
+
+
+class Sink(BaseHTTPRequestHandler):
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        time.sleep(options.delay / 1000)
+        if random.randrange(100) < options.fail:
+            totals["failed"] += 1
+            self.send_response(503)
+            self.end_headers()
+            print("failed on purpose, %d failed" % totals["failed"])
+            return
+
+        lines = body.decode("utf-8").splitlines()
+        totals["batches"] += 1
+        totals["lines"] += len(lines)
+        totals["bytes"] += len(body)
+        if options.output:
+            with open(options.output, "a") as output:
+                output.write("\n".join(lines) + "\n")
+        self.send_response(204)
+        self.end_headers()
+        print("%s %d lines (%s), total %d batches, %d lines, %d bytes" % (
+            time.strftime("%H:%M:%S"), len(lines), self.headers.get("Content-Type"),
+            totals["batches"], totals["lines"], totals["bytes"]))
+
+    def log_message(self, format, *args):
+        pass
+
+
+print("listening on port %d" % options.port)
+ThreadingHTTPServer(("", options.port), Sink).serve_forever()
@@ -0,0 +1,80 @@
+#
+# Fernotron 2 MQTT
+#
+# File: compress.py
+#
+# Compress the web page web/index.html into include/index_html.h: gzip bytes in
+# PROGMEM and an ETag from the hash of the page. PlatformIO runs it before every
+# build (extra_scripts in platformio.ini), run it by hand with python3 after a
+# change outside of PlatformIO. The header is only written if the page changed.
+#
+
+import gzip
+import hashlib
+import os
+import re
+
+try:
+    Import("env")  # PlatformIO
+    project_dir = env["PROJECT_DIR"]
+except NameError:
+    project_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..")
+
+source = os.path.join(project_dir, "web", "index.html")
+target = os.path.join(project_dir, "include", "index_html.h")
+
+HEADER = """/*
+ * Fernotron 2 MQTT
+ *
+ * File: index_html.h
+ *
+ * Web page for the command history, gzip compressed. Generated from
+ * web/index.html by tools/web/compress.py, do not edit.
+ *
+ */
+
+/**********************************************************************************
+ *
+ * Includes
+ *
+ **********************************************************************************/
+#include <Arduino.h>
+
+/**********************************************************************************
+ *
+ * index.html, %d bytes, %d bytes compressed
+ *
+ **********************************************************************************/
+#define INDEX_HTML_ETAG "\\"%s\\""
+
+const size_t index_html_gz_length = %d;
+const uint8_t index_html_gz[] PROGMEM = {
+%s
+};
+"""
+
+
+def minify(html):
+    # indentation and empty lines only, the page stays readable in the browser
+    lines = [line.strip() for line in html.splitlines()]
+    return "\n".join(line for line in lines if line) + "\n"
+
+
+with open(source, "rb") as file:
+    html = minify(file.read().decode("utf-8")).encode("utf-8")
+
+compressed = gzip.compress(html, compresslevel=9, mtime=0)  # same bytes for the same page
+etag = hashlib.sha1(html).hexdigest()[:16]
+rows = []
+for i in range(0, len(compressed), 16):
+    rows.append("  " + ", ".join("0x%02x" % b for b in compressed[i:i + 16]) + ",")
+header = HEADER % (len(html), len(compressed), etag, len(compressed), "\n".join(rows))
+
+old = None
+if os.path.exists(target):
+    with open(target) as file:
+        old = file.read()
+if old != header:
+    with open(target, "w") as file:
+        file.write(header)
+    print("compress.py: %s, %d -> %d bytes, ETag %s" % (os.path.normpath(target), len(html), len(compressed), etag))